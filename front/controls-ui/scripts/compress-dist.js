@@ -0,0 +1,61 @@
+// Post-build step: emits a .gz sibling for every compressible file in dist/
+// and writes dist/asset-manifest.txt, which the firmware loads at start-up to
+// serve ETags, gzip variants and cache headers (see main/assets.c).
+//
+// Manifest lines: "<etag> <flags> <path>", flags being any of
+//   g  a .gz sibling exists
+//   i  the file name carries a content hash, it can be cached forever
+// or "-" for none. Safe to re-run: stale .gz files and the manifest are
+// regenerated from what is currently in dist/.
+const fs = require('fs');
+const path = require('path');
+const zlib = require('zlib');
+const crypto = require('crypto');
+
+const DIST = path.join(__dirname, '..', 'dist');
+const MANIFEST = 'asset-manifest.txt';
+const COMPRESSIBLE = /\.(html|js|css|svg|json|txt|map|ico)$/i;
+const HASHED_NAME = /[.-][0-9a-f]{8,}\./i;
+// gzip only pays off if it saves at least this fraction of the original size
+const MIN_SAVING = 0.1;
+
+function walk(dir) {
+  return fs.readdirSync(dir, { withFileTypes: true }).flatMap((entry) => {
+    const full = path.join(dir, entry.name);
+    return entry.isDirectory() ? walk(full) : [full];
+  });
+}
+
+if (!fs.existsSync(DIST)) {
+  console.error(`${DIST} doesn't exist, run 'yarn build' first`);
+  process.exit(1);
+}
+
+const files = walk(DIST).filter((f) => path.basename(f) !== MANIFEST);
+files.filter((f) => f.endsWith('.gz')).forEach((f) => fs.unlinkSync(f));
+
+const lines = [];
+let saved = 0;
+for (const file of files.filter((f) => !f.endsWith('.gz'))) {
+  const data = fs.readFileSync(file);
+  const etag = crypto.createHash('sha256').update(data).digest('hex').slice(0, 16);
+  let flags = '';
+
+  if (COMPRESSIBLE.test(file)) {
+    const gz = zlib.gzipSync(data, { level: zlib.constants.Z_BEST_COMPRESSION });
+    if (gz.length <= data.length * (1 - MIN_SAVING)) {
+      fs.writeFileSync(file + '.gz', gz);
+      saved += data.length - gz.length;
+      flags += 'g';
+    }
+  }
+  if (HASHED_NAME.test(path.basename(file))) {
+    flags += 'i';
+  }
+  const uri = '/' + path.relative(DIST, file).split(path.sep).join('/');
+  lines.push(`${etag} ${flags || '-'} ${uri}`);
+}
+
+lines.sort((a, b) => (a.split(' ')[2] < b.split(' ')[2] ? -1 : 1));
+fs.writeFileSync(path.join(DIST, MANIFEST), lines.join('\n') + '\n');
+console.log(`asset manifest: ${lines.length} files, gzip saves ${saved} bytes`);
@@ -0,0 +1,61 @@
+/* Minimal benchmark helpers for the host build
+
+   Each benchmark binary runs a list of scenarios and prints one line per
+   scenario, either as an aligned table or, with --csv, as
+   "suite,scenario,ops,total_ns,ns_per_op,ops_per_sec" for comparing runs.
+   --iterations N overrides the number of operations per scenario.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+typedef struct {
+    const char *suite;
+    uint64_t iterations;
+    bool csv;
+} bench_opts_t;
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void bench_parse_args(bench_opts_t *opts, int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            opts->csv = true;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            opts->iterations = strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--csv] [--iterations N]\n", argv[0]);
+            exit(2);
+        }
+    }
+    if (opts->csv) {
+        printf("suite,scenario,ops,total_ns,ns_per_op,ops_per_sec\n");
+    } else {
+        printf("%-12s %-24s %12s %12s %14s\n", "suite", "scenario", "ops", "ns/op", "ops/s");
+    }
+}
+
+static inline void bench_report(const bench_opts_t *opts, const char *scenario, uint64_t ops, uint64_t elapsed_ns)
+{
+    double ns_per_op = ops ? (double)elapsed_ns / ops : 0.0;
+    double ops_per_sec = elapsed_ns ? ops * 1e9 / elapsed_ns : 0.0;
+    if (opts->csv) {
+        printf("%s,%s,%llu,%llu,%.2f,%.0f\n", opts->suite, scenario, (unsigned long long)ops,
+               (unsigned long long)elapsed_ns, ns_per_op, ops_per_sec);
+    } else {
+        printf("%-12s %-24s %12llu %12.2f %14.0f\n", opts->suite, scenario, (unsigned long long)ops,
+               ns_per_op, ops_per_sec);
+    }
+    fflush(stdout);
+}
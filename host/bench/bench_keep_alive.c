@@ -0,0 +1,266 @@
+/* Keep-alive engine benchmark
+
+   Simulates hundreds of WebSocket clients against keep_alive_core and against
+   a copy of the previous linear-scan bookkeeping, to show how the per-tick cost
+   of the keep-alive task scales with the number of clients.
+*/
+#include "bench.h"
+#include "keep_alive_core.h"
+
+#define PERIOD_MS       5000
+#define NOT_ALIVE_MS    10000
+#define STEP_MS         10
+#define SIM_STEPS       20000
+
+/* ---- Previous implementation: flat array scanned on every operation ---- */
+
+typedef struct {
+    bool active;
+    int fd;
+    uint32_t last_seen;
+} linear_client_t;
+
+typedef struct {
+    size_t max_clients;
+    linear_client_t *clients;
+} linear_t;
+
+static uint32_t linear_max_delay(linear_t *h, uint32_t now)
+{
+    int64_t check_after_ms = 30000;
+    for (size_t i = 0; i < h->max_clients; ++i) {
+        if (h->clients[i].active) {
+            uint64_t check_at = (uint64_t)h->clients[i].last_seen + PERIOD_MS;
+            if (check_at < (uint64_t)(check_after_ms + now)) {
+                check_after_ms = check_at - now;
+                if (check_after_ms < 0) {
+                    check_after_ms = 1000;
+                }
+            }
+        }
+    }
+    return check_after_ms;
+}
+
+static bool linear_update(linear_t *h, int fd, uint32_t now)
+{
+    for (size_t i = 0; i < h->max_clients; ++i) {
+        if (h->clients[i].active && h->clients[i].fd == fd) {
+            h->clients[i].last_seen = now;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool linear_add(linear_t *h, int fd, uint32_t now)
+{
+    for (size_t i = 0; i < h->max_clients; ++i) {
+        if (!h->clients[i].active) {
+            h->clients[i] = (linear_client_t) { .active = true, .fd = fd, .last_seen = now };
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool linear_remove(linear_t *h, int fd)
+{
+    for (size_t i = 0; i < h->max_clients; ++i) {
+        if (h->clients[i].active && h->clients[i].fd == fd) {
+            h->clients[i].active = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t linear_collect(linear_t *h, uint32_t now)
+{
+    size_t due = 0;
+    for (size_t i = 0; i < h->max_clients; ++i) {
+        if (h->clients[i].active && h->clients[i].last_seen + PERIOD_MS <= now) {
+            due++;
+        }
+    }
+    return due;
+}
+
+/* ---- Simulation ---- */
+
+// Keeps the simulated work observable so it is not optimized away
+static volatile uint64_t sink;
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/*
+ * Every client sends something about every 3 s, so none of them is ever due.
+ * Each step delivers that traffic, then asks for the next deadline and for
+ * due clients, which is what the keep-alive task does on every wake-up.
+ */
+static void sim_core(const bench_opts_t *opts, size_t clients)
+{
+    ka_core_config_t config = {
+        .max_clients = clients, .fd_base = 0, .fd_count = clients,
+        .keep_alive_period_ms = PERIOD_MS, .not_alive_after_ms = NOT_ALIVE_MS,
+    };
+    ka_core_t *core = ka_core_create(&config);
+    int *ping = calloc(clients, sizeof(int));
+    int *dead = calloc(clients, sizeof(int));
+    for (size_t i = 0; i < clients; ++i) {
+        ka_core_add(core, i, 0);
+    }
+
+    size_t touches_per_step = clients * STEP_MS / 3000 + 1;
+    uint64_t checksum = 0;
+    uint32_t now = 0;
+    rng_state = 12345;
+    uint64_t start = bench_now_ns();
+    for (int step = 0; step < SIM_STEPS; ++step) {
+        now += STEP_MS;
+        for (size_t t = 0; t < touches_per_step; ++t) {
+            ka_core_touch(core, rng() % clients, now);
+        }
+        checksum += ka_core_next_deadline_in(core, now);
+        size_t ping_count, dead_count;
+        ka_core_collect_due(core, now, ping, &ping_count, dead, &dead_count);
+        checksum += ping_count + dead_count;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "heap_tick_%zu", clients);
+    bench_report(opts, name, SIM_STEPS, bench_now_ns() - start);
+
+    sink += checksum;
+    free(ping);
+    free(dead);
+    ka_core_destroy(core);
+}
+
+static void sim_linear(const bench_opts_t *opts, size_t clients)
+{
+    linear_t h = { .max_clients = clients, .clients = calloc(clients, sizeof(linear_client_t)) };
+    for (size_t i = 0; i < clients; ++i) {
+        linear_add(&h, i, 0);
+    }
+
+    size_t touches_per_step = clients * STEP_MS / 3000 + 1;
+    uint64_t checksum = 0;
+    uint32_t now = 0;
+    rng_state = 12345;
+    uint64_t start = bench_now_ns();
+    for (int step = 0; step < SIM_STEPS; ++step) {
+        now += STEP_MS;
+        for (size_t t = 0; t < touches_per_step; ++t) {
+            linear_update(&h, rng() % clients, now);
+        }
+        checksum += linear_max_delay(&h, now);
+        checksum += linear_collect(&h, now);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "linear_tick_%zu", clients);
+    bench_report(opts, name, SIM_STEPS, bench_now_ns() - start);
+
+    sink += checksum;
+    free(h.clients);
+}
+
+// Clients connecting and disconnecting while the table is nearly full
+static void churn_core(const bench_opts_t *opts, size_t clients)
+{
+    ka_core_config_t config = {
+        .max_clients = clients, .fd_base = 0, .fd_count = clients,
+        .keep_alive_period_ms = PERIOD_MS, .not_alive_after_ms = NOT_ALIVE_MS,
+    };
+    ka_core_t *core = ka_core_create(&config);
+    for (size_t i = 0; i < clients; ++i) {
+        ka_core_add(core, i, i);
+    }
+    uint64_t failures = 0;
+    uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < opts->iterations; ++i) {
+        int fd = rng() % clients;
+        failures += !ka_core_remove(core, fd);
+        failures += !ka_core_add(core, fd, i);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "heap_churn_%zu", clients);
+    bench_report(opts, name, opts->iterations, bench_now_ns() - start);
+    if (failures) {
+        fprintf(stderr, "%s: %llu failed operations\n", name, (unsigned long long)failures);
+        exit(1);
+    }
+    ka_core_destroy(core);
+}
+
+static void churn_linear(const bench_opts_t *opts, size_t clients)
+{
+    linear_t h = { .max_clients = clients, .clients = calloc(clients, sizeof(linear_client_t)) };
+    for (size_t i = 0; i < clients; ++i) {
+        linear_add(&h, i, i);
+    }
+    uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < opts->iterations; ++i) {
+        int fd = rng() % clients;
+        linear_remove(&h, fd);
+        linear_add(&h, fd, i);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "linear_churn_%zu", clients);
+    bench_report(opts, name, opts->iterations, bench_now_ns() - start);
+    free(h.clients);
+}
+
+// Checks the engine pings silent clients once and then declares them dead
+static void check_behaviour(void)
+{
+    ka_core_config_t config = {
+        .max_clients = 4, .fd_base = 50, .fd_count = 8,
+        .keep_alive_period_ms = PERIOD_MS, .not_alive_after_ms = NOT_ALIVE_MS,
+    };
+    ka_core_t *core = ka_core_create(&config);
+    int ping[4], dead[4];
+    size_t ping_count, dead_count;
+    bool ok = ka_core_add(core, 50, 0) && ka_core_add(core, 57, 0) && !ka_core_add(core, 58, 0);
+
+    ka_core_touch(core, 57, 4000);
+    ok = ok && ka_core_next_deadline_in(core, 0) == PERIOD_MS;
+    ka_core_collect_due(core, PERIOD_MS, ping, &ping_count, dead, &dead_count);
+    ok = ok && ping_count == 1 && ping[0] == 50 && dead_count == 0;
+    ka_core_collect_due(core, 9000, ping, &ping_count, dead, &dead_count);
+    ok = ok && ping_count == 1 && ping[0] == 57 && dead_count == 0;
+    ka_core_collect_due(core, NOT_ALIVE_MS, ping, &ping_count, dead, &dead_count);
+    ok = ok && ping_count == 0 && dead_count == 1 && dead[0] == 50;
+    ok = ok && ka_core_remove(core, 50) && ka_core_count(core) == 1;
+    ka_core_destroy(core);
+
+    if (!ok) {
+        fprintf(stderr, "keep-alive core misbehaves\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts_t opts = { .suite = "keep_alive", .iterations = 1000000 };
+    bench_parse_args(&opts, argc, argv);
+    check_behaviour();
+
+    static const size_t sizes[] = { 4, 16, 64, 256, 1024 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        sim_core(&opts, sizes[i]);
+        sim_linear(&opts, sizes[i]);
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        churn_core(&opts, sizes[i]);
+        churn_linear(&opts, sizes[i]);
+    }
+    return 0;
+}
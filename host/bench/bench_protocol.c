@@ -0,0 +1,287 @@
+/* Protocol core microbenchmark
+
+   Drives proto_handle_text() and proto_handle_binary() with realistic command
+   mixes against in-memory storage/actuator stubs and reports commands/sec and
+   ns/command.
+*/
+#include "bench.h"
+#include "protocol.h"
+
+#define MAX_MIX_LEN 1024
+
+typedef struct {
+    uint8_t payload[16];
+    size_t len;
+    bool binary;
+} command_t;
+
+static uint8_t values[PROTO_FIELD_MAX];
+static uint32_t changed_at[PROTO_FIELD_MAX];
+static uint32_t generation;
+static uint64_t bytes_replied;
+static uint64_t bytes_broadcast;
+static uint64_t actuations;
+
+static uint8_t stub_load(proto_field_t field)
+{
+    return values[field];
+}
+
+static uint32_t stub_store(proto_field_t field, uint8_t val)
+{
+    if (values[field] == val) {
+        return 0;
+    }
+    values[field] = val;
+    changed_at[field] = ++generation;
+    return generation;
+}
+
+static uint32_t stub_store_batch(const proto_set_t *sets, size_t count)
+{
+    bool changed = false;
+    for (size_t i = 0; i < count; ++i) {
+        if (values[sets[i].field] != sets[i].val) {
+            values[sets[i].field] = sets[i].val;
+            changed_at[sets[i].field] = generation + 1;
+            changed = true;
+        }
+    }
+    return changed ? ++generation : 0;
+}
+
+static uint32_t stub_changed_at(proto_field_t field)
+{
+    return changed_at[field];
+}
+
+static uint32_t stub_generation(void)
+{
+    return generation;
+}
+
+static bool stub_actuate(proto_field_t field, uint8_t val)
+{
+    actuations++;
+    return true;
+}
+
+static bool stub_actuate_batch(const proto_set_t *sets, size_t count)
+{
+    actuations += count;
+    return true;
+}
+
+static void stub_reply(void *conn, proto_encoding_t enc, const uint8_t *msg, size_t len)
+{
+    bytes_replied += len;
+}
+
+static void stub_broadcast(const proto_update_t *update)
+{
+    bytes_broadcast += update->text_len + update->binary_len;
+}
+
+static bool stub_run_sequence(uint8_t id)
+{
+    actuations++;
+    return id < 3;
+}
+
+static const proto_ops_t ops = {
+    .load = stub_load,
+    .store = stub_store,
+    .store_batch = stub_store_batch,
+    .changed_at = stub_changed_at,
+    .generation = stub_generation,
+    .actuate = stub_actuate,
+    .actuate_batch = stub_actuate_batch,
+    .reply = stub_reply,
+    .broadcast = stub_broadcast,
+    .run_sequence = stub_run_sequence,
+};
+
+static size_t add_command(command_t *mix, size_t n, const char *text)
+{
+    mix[n].len = strlen(text);
+    memcpy(mix[n].payload, text, mix[n].len);
+    mix[n].binary = false;
+    return n + 1;
+}
+
+static size_t add_binary(command_t *mix, size_t n, const uint8_t *payload, size_t len)
+{
+    mix[n].len = len;
+    memcpy(mix[n].payload, payload, len);
+    mix[n].binary = true;
+    return n + 1;
+}
+
+// A slider dragged back and forth across its range, as sent by the UI
+static size_t mix_slider_storm(command_t *mix)
+{
+    size_t n = 0;
+    char buf[8];
+    for (int v = 0; v <= 255; ++v) {
+        snprintf(buf, sizeof(buf), "sl%d", v);
+        n = add_command(mix, n, buf);
+    }
+    for (int v = 255; v >= 0; --v) {
+        snprintf(buf, sizeof(buf), "sl%d", v);
+        n = add_command(mix, n, buf);
+    }
+    return n;
+}
+
+// Clients polling the whole state
+static size_t mix_state_poll(command_t *mix)
+{
+    return add_command(mix, 0, "g");
+}
+
+// Clients polling single values
+static size_t mix_single_get(command_t *mix)
+{
+    size_t n = add_command(mix, 0, "gl");
+    return add_command(mix, n, "gv");
+}
+
+// Reconnecting clients catching up from a recent generation
+static size_t mix_resync(command_t *mix)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "g@%u", generation > 1 ? generation - 1 : 0);
+    return add_command(mix, 0, buf);
+}
+
+static size_t mix_binary_resync(command_t *mix)
+{
+    uint32_t since = generation > 1 ? generation - 1 : 0;
+    const uint8_t sync[] = { PROTO_BIN_OP_SYNC, since, since >> 8, since >> 16, since >> 24 };
+    return add_binary(mix, 0, sync, sizeof(sync));
+}
+
+static size_t mix_visor_toggle(command_t *mix)
+{
+    size_t n = add_command(mix, 0, "sv1");
+    return add_command(mix, n, "sv0");
+}
+
+// Scene changes, LED and visor set together in one frame
+static size_t mix_scene_batch(command_t *mix)
+{
+    size_t n = add_command(mix, 0, "sl200;sv1");
+    return add_command(mix, n, "sl0;sv0");
+}
+
+static size_t mix_binary_scene_batch(command_t *mix)
+{
+    const uint8_t up[] = { PROTO_BIN_OP_SET, PROTO_BIN_FIELD_LED, 200, PROTO_BIN_FIELD_VISOR, 1 };
+    const uint8_t down[] = { PROTO_BIN_OP_SET, PROTO_BIN_FIELD_LED, 0, PROTO_BIN_FIELD_VISOR, 0 };
+    size_t n = add_binary(mix, 0, up, sizeof(up));
+    return add_binary(mix, n, down, sizeof(down));
+}
+
+// Roughly what a session looks like: mostly slider steps, some polls and visor moves
+static size_t mix_session(command_t *mix)
+{
+    size_t n = 0;
+    char buf[8];
+    for (int i = 0; i < 100; ++i) {
+        if (i % 10 == 0) {
+            n = add_command(mix, n, "g");
+        } else if (i % 10 == 5) {
+            n = add_command(mix, n, i % 20 == 5 ? "sv1" : "sv0");
+        } else if (i % 10 == 7) {
+            n = add_command(mix, n, "gl");
+        } else {
+            snprintf(buf, sizeof(buf), "sl%d", (i * 37) % 256);
+            n = add_command(mix, n, buf);
+        }
+    }
+    return n;
+}
+
+static size_t mix_binary_state_poll(command_t *mix)
+{
+    const uint8_t get[] = { PROTO_BIN_OP_GET };
+    return add_binary(mix, 0, get, sizeof(get));
+}
+
+static size_t mix_binary_slider_storm(command_t *mix)
+{
+    size_t n = 0;
+    for (int v = 0; v <= 255; ++v) {
+        const uint8_t set[] = { PROTO_BIN_OP_SET, PROTO_BIN_FIELD_LED, v };
+        n = add_binary(mix, n, set, sizeof(set));
+    }
+    for (int v = 255; v >= 0; --v) {
+        const uint8_t set[] = { PROTO_BIN_OP_SET, PROTO_BIN_FIELD_LED, v };
+        n = add_binary(mix, n, set, sizeof(set));
+    }
+    return n;
+}
+
+// Malformed input must be rejected cheaply
+static size_t mix_invalid(command_t *mix)
+{
+    size_t n = add_command(mix, 0, "x");
+    n = add_command(mix, n, "sl");
+    n = add_command(mix, n, "sl999");
+    n = add_command(mix, n, "sv2");
+    n = add_command(mix, n, "sl1;sl2");
+    n = add_command(mix, n, "sl1;");
+    return add_command(mix, n, "gq");
+}
+
+typedef struct {
+    const char *name;
+    size_t (*build)(command_t *mix);
+    bool expect_errors;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "state_poll", mix_state_poll, false },
+    { "single_get", mix_single_get, false },
+    { "slider_storm", mix_slider_storm, false },
+    { "visor_toggle", mix_visor_toggle, false },
+    { "scene_batch", mix_scene_batch, false },
+    { "bin_scene_batch", mix_binary_scene_batch, false },
+    { "session_mix", mix_session, false },
+    { "bin_state_poll", mix_binary_state_poll, false },
+    { "bin_slider_storm", mix_binary_slider_storm, false },
+    { "resync", mix_resync, false },
+    { "bin_resync", mix_binary_resync, false },
+    { "invalid", mix_invalid, true },
+};
+
+int main(int argc, char **argv)
+{
+    bench_opts_t opts = { .suite = "protocol", .iterations = 5000000 };
+    bench_parse_args(&opts, argc, argv);
+
+    static command_t mix[MAX_MIX_LEN];
+    int failures = 0;
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); ++s) {
+        size_t mix_len = scenarios[s].build(mix);
+        uint64_t errors = 0;
+
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < opts.iterations; ++i) {
+            const command_t *cmd = &mix[i % mix_len];
+            proto_err_t err = cmd->binary ? proto_handle_binary(&ops, NULL, cmd->payload, cmd->len)
+                                          : proto_handle_text(&ops, NULL, cmd->payload, cmd->len);
+            errors += err != PROTO_OK;
+        }
+        bench_report(&opts, scenarios[s].name, opts.iterations, bench_now_ns() - start);
+
+        if ((errors != 0) != scenarios[s].expect_errors) {
+            fprintf(stderr, "%s: unexpected error count %llu\n", scenarios[s].name, (unsigned long long)errors);
+            failures++;
+        }
+    }
+    // Keep the stubs' side effects observable so the work is not optimized away
+    fprintf(stderr, "replied %llu B, broadcast %llu B, %llu actuations\n", (unsigned long long)bytes_replied,
+            (unsigned long long)bytes_broadcast, (unsigned long long)actuations);
+    return failures ? 1 : 0;
+}
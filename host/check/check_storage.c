@@ -0,0 +1,179 @@
+/* Host check of the persisted state blob
+
+   Boots the storage layer (main/nvs.c) on the NVS shim, once per case, from
+   a prepared partition file, and checks what it loads and what it leaves in
+   the file: migration from the per-key layout, a clean reload, a corrupt
+   blob, and blobs written by newer firmware. Each case runs in a child
+   process, since init_nvs() is meant to run once per boot.
+
+     check_storage [--keep]     (--keep leaves the partition files in /tmp)
+
+   Exits non-zero if any case fails.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "esp_crc.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "shim.h"
+#include "storage.h"
+
+shim_options_t shim_options;
+
+/* Layout of main/nvs.c, version 1 */
+#define BLOB_KEY        "state"
+#define BLOB_HEADER_LEN 8
+#define BLOB_MAX_SIZE   256
+
+typedef struct {
+    const char *name;
+    bool legacy;            // write the per-key layout
+    uint16_t version;       // blob to write, 0 for none
+    uint16_t length;        // bytes of values in the blob
+    bool corrupt;           // flip a bit after the CRC is computed
+    uint8_t led, visor;     // values to store
+    uint8_t want_led, want_visor;
+    bool want_rewrite;      // init_nvs() commits the state again
+    uint16_t want_version;  // version left in the file
+    uint16_t want_length;   // bytes of values left in the file
+} check_case_t;
+
+static const check_case_t CASES[] = {
+    { "empty partition", .want_rewrite = true, .want_version = 1, .want_length = 2 },
+    { "per-key layout", .legacy = true, .led = 168, .visor = 1,
+      .want_led = 168, .want_visor = 1, .want_rewrite = true, .want_version = 1, .want_length = 2 },
+    { "current blob", .version = 1, .length = 2, .led = 42, .visor = 1,
+      .want_led = 42, .want_visor = 1, .want_version = 1, .want_length = 2 },
+    { "corrupt blob", .version = 1, .length = 2, .corrupt = true, .led = 42, .visor = 1,
+      .want_rewrite = true, .want_version = 1, .want_length = 2 },
+    { "newer blob", .version = 2, .length = 40, .led = 7, .visor = 1,
+      .want_led = 7, .want_visor = 1, .want_version = 2, .want_length = 40 },
+    { "newer blob over the read buffer", .version = 3, .length = 600, .led = 9, .visor = 1,
+      .want_led = 9, .want_visor = 1, .want_version = 3, .want_length = 600 },
+};
+
+static uint8_t blob[BLOB_HEADER_LEN + 1024];
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static bool prepare(const check_case_t *c)
+{
+    nvs_handle_t handle;
+    unlink(shim_options.nvs_path);
+    if (nvs_flash_init() != ESP_OK || nvs_open("storage", NVS_READWRITE, &handle) != ESP_OK) {
+        return false;
+    }
+    bool ok = true;
+    if (c->legacy) {
+        ok &= nvs_set_u8(handle, "led", c->led) == ESP_OK;
+        ok &= nvs_set_u8(handle, "visor", c->visor) == ESP_OK;
+    }
+    if (c->version) {
+        memset(blob, 0x5a, sizeof(blob));
+        put_u16(blob + 4, c->version);
+        put_u16(blob + 6, c->length);
+        blob[BLOB_HEADER_LEN] = c->led;
+        blob[BLOB_HEADER_LEN + 1] = c->visor;
+        put_u32(blob, esp_crc32_le(0, blob + 4, 4 + c->length));
+        if (c->corrupt) {
+            blob[BLOB_HEADER_LEN] ^= 1;
+        }
+        ok &= nvs_set_blob(handle, BLOB_KEY, blob, BLOB_HEADER_LEN + c->length) == ESP_OK;
+    }
+    ok &= nvs_commit(handle) == ESP_OK;
+    nvs_close(handle);
+    return ok;
+}
+
+#define EXPECT(cond, ...)                   \
+    do {                                    \
+        if (!(cond)) {                      \
+            printf("  " __VA_ARGS__);       \
+            printf("\n");                   \
+            ok = false;                     \
+        }                                   \
+    } while (0)
+
+// Runs in the child: boots the storage and checks the loaded values and the file
+static bool run(const check_case_t *c)
+{
+    bool ok = true;
+    if (!prepare(c)) {
+        printf("  cannot prepare the partition\n");
+        return false;
+    }
+    EXPECT(init_nvs() == ESP_OK, "init_nvs failed");
+    EXPECT(read_led() == c->want_led, "led %d, want %d", read_led(), c->want_led);
+    EXPECT(read_visor() == c->want_visor, "visor %d, want %d", read_visor(), c->want_visor);
+    storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT((stats.commits > 0) == c->want_rewrite, "%u commits at boot", (unsigned)stats.commits);
+
+    // Read the file back as the next boot would
+    nvs_handle_t handle;
+    uint8_t u8;
+    size_t length = sizeof(blob);
+    EXPECT(nvs_flash_init() == ESP_OK && nvs_open("storage", NVS_READONLY, &handle) == ESP_OK,
+           "cannot reopen the partition");
+    EXPECT(nvs_get_u8(handle, "led", &u8) == ESP_ERR_NVS_NOT_FOUND, "per-key led left behind");
+    EXPECT(nvs_get_u8(handle, "visor", &u8) == ESP_ERR_NVS_NOT_FOUND, "per-key visor left behind");
+    if (nvs_get_blob(handle, BLOB_KEY, blob, &length) != ESP_OK) {
+        printf("  no state blob\n");
+        return false;
+    }
+    nvs_close(handle);
+
+    uint16_t version = blob[4] | blob[5] << 8;
+    uint16_t values_len = blob[6] | blob[7] << 8;
+    uint32_t crc = blob[0] | blob[1] << 8 | blob[2] << 16 | (uint32_t)blob[3] << 24;
+    EXPECT(length == (size_t)BLOB_HEADER_LEN + values_len, "blob of %zu bytes holds %d values", length, values_len);
+    EXPECT(crc == esp_crc32_le(0, blob + 4, length - 4), "blob CRC mismatch");
+    EXPECT(version == c->want_version, "blob version %d, want %d", version, c->want_version);
+    EXPECT(values_len == c->want_length, "blob holds %d values, want %d", values_len, c->want_length);
+    EXPECT(blob[BLOB_HEADER_LEN] == c->want_led && blob[BLOB_HEADER_LEN + 1] == c->want_visor,
+           "blob values %d %d, want %d %d", blob[BLOB_HEADER_LEN], blob[BLOB_HEADER_LEN + 1],
+           c->want_led, c->want_visor);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bool keep = argc > 1 && strcmp(argv[1], "--keep") == 0;
+    esp_log_level_set("*", ESP_LOG_NONE);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/check_storage_%d_%zu.txt", (int)getpid(), i);
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            shim_options.nvs_path = path;
+            exit(run(&CASES[i]) ? 0 : 1);
+        }
+        int status = 1;
+        waitpid(pid, &status, 0);
+        bool passed = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        printf("%-36s %s\n", CASES[i].name, passed ? "ok" : "FAILED");
+        failed += !passed;
+        if (!keep) {
+            unlink(path);
+        }
+    }
+    return failed ? 1 : 0;
+}
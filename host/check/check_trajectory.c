@@ -0,0 +1,196 @@
+/* Host check of the servo trajectory planner
+
+   Drives main/trajectory.c with the Kconfig defaults over sweeps of moves and
+   preemptions, and checks that no axis ever passes the waypoint it heads for,
+   that every path ends at rest exactly on its last waypoint, and that moves
+   nobody preempts keep the velocity change within the acceleration bound.
+
+     check_trajectory
+
+   Exits non-zero if any sweep fails.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "trajectory.h"
+
+#define MAX_TICKS 10000
+
+/* Visor poses of main/servo.c, in us */
+#define TOP_DOWN 1149
+#define TOP_UP1  1654
+#define TOP_UP2  2410
+#define BOT_DOWN 456
+#define BOT_UP   1086
+
+static const traj_config_t CONFIG = {
+    .axes = 2,
+    .tick_ms = CONFIG_MK3_SERVO_TICK_MS,
+    .max_speed = CONFIG_MK3_SERVO_MAX_SPEED,
+    .accel = CONFIG_MK3_SERVO_ACCEL,
+};
+
+static const traj_waypoint_t VISOR_DOWN[] = {
+    { .pulse = { TOP_DOWN, BOT_DOWN } },
+};
+static const traj_waypoint_t VISOR_UP[] = {
+    { .pulse = { TOP_UP1, BOT_UP } },
+    { .pulse = { TOP_UP2, BOT_UP } },
+};
+
+static int sign(int32_t x)
+{
+    return (x > 0) - (x < 0);
+}
+
+/*
+ * Steps until the path is done, or for at most ticks steps, checking every
+ * tick. Passing the target is measured on the Q8 position, from the side the
+ * axis was on when it started heading for the waypoint.
+ */
+static bool run(traj_t *traj, int ticks, bool bounded, const char *what)
+{
+    int side[TRAJ_MAX_AXES];
+    int index = -1;
+    uint16_t pulse[TRAJ_MAX_AXES];
+    for (int tick = 0; tick < ticks; ++tick) {
+        if (traj->index != index) {
+            index = traj->index;
+            for (int i = 0; i < traj->axes; ++i) {
+                side[i] = sign(((int32_t)traj->path[index].pulse[i] << 8) - traj->pos[i]);
+            }
+        }
+        int32_t vel[TRAJ_MAX_AXES];
+        for (int i = 0; i < traj->axes; ++i) {
+            vel[i] = traj->vel[i];
+        }
+        const traj_waypoint_t *wp = &traj->path[traj->index];
+        traj_event_t event = traj_step(traj, pulse);
+        for (int i = 0; i < traj->axes; ++i) {
+            int32_t err = ((int32_t)wp->pulse[i] << 8) - traj->pos[i];
+            if (side[i] && sign(err) == -side[i]) {
+                printf("  %s: axis %d at %d passed %d at tick %d\n", what, i, traj->pos[i] >> 8, wp->pulse[i], tick);
+                return false;
+            }
+            int32_t change = traj->vel[i] - vel[i];
+            if (bounded && (change > traj->accel || change < -traj->accel)) {
+                printf("  %s: axis %d changed speed by %d (bound %d) at tick %d\n", what, i, change, traj->accel, tick);
+                return false;
+            }
+        }
+        if (event == TRAJ_DONE) {
+            const traj_waypoint_t *last = &traj->path[traj->count - 1];
+            for (int i = 0; i < traj->axes; ++i) {
+                if (pulse[i] != last->pulse[i] || traj->vel[i] != 0) {
+                    printf("  %s: axis %d done at %d moving %d, want %d at rest\n", what, i, pulse[i], traj->vel[i], last->pulse[i]);
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    if (ticks == MAX_TICKS) {
+        printf("  %s: not done after %d ticks\n", what, ticks);
+        return false;
+    }
+    return true;
+}
+
+static bool move(traj_t *traj, uint16_t top, uint16_t bot, int ticks, bool bounded, const char *what)
+{
+    const traj_waypoint_t wp = { .pulse = { top, bot } };
+    traj_start(traj, &wp, 1);
+    return run(traj, ticks, bounded, what);
+}
+
+// Every target from one end of the range, as the reported 1000 -> 1266 move
+static bool sweep_targets(void)
+{
+    bool ok = true;
+    for (uint16_t from = 1000; from <= 2000; from += 1000) {
+        for (uint16_t to = 1000; to <= 2000; ++to) {
+            traj_t traj;
+            const uint16_t pulse[] = { from, BOT_DOWN };
+            traj_init(&traj, &CONFIG, pulse);
+            char what[32];
+            snprintf(what, sizeof(what), "%d -> %d", from, to);
+            ok &= move(&traj, to, BOT_DOWN, MAX_TICKS, true, what);
+        }
+    }
+    return ok;
+}
+
+// A second target replaces the first after any number of ticks
+static bool sweep_preemptions(void)
+{
+    static const uint16_t FIRST[] = { 1010, 1266, 1500, 2000 };
+    bool ok = true;
+    for (size_t f = 0; f < sizeof(FIRST) / sizeof(FIRST[0]); ++f) {
+        for (int after = 1; after <= 40; ++after) {
+            for (uint16_t to = 900; to <= 2100; to += 7) {
+                traj_t traj;
+                const uint16_t pulse[] = { 1000, BOT_DOWN };
+                traj_init(&traj, &CONFIG, pulse);
+                char what[48];
+                snprintf(what, sizeof(what), "1000 -> %d, after %d ticks -> %d", FIRST[f], after, to);
+                ok &= move(&traj, FIRST[f], BOT_DOWN, after, true, what);
+                ok &= move(&traj, to, BOT_DOWN, MAX_TICKS, false, what);
+            }
+        }
+    }
+    return ok;
+}
+
+// The visor paths, whole and reversed at every tick of the other one
+static bool sweep_visor(void)
+{
+    static const struct {
+        const traj_waypoint_t *path;
+        size_t count;
+        const traj_waypoint_t *back;
+        size_t back_count;
+        const char *name;
+    } MOVES[] = {
+        { VISOR_UP, 2, VISOR_DOWN, 1, "visor up" },
+        { VISOR_DOWN, 1, VISOR_UP, 2, "visor down" },
+    };
+    bool ok = true;
+    for (size_t m = 0; m < sizeof(MOVES) / sizeof(MOVES[0]); ++m) {
+        const traj_waypoint_t *start = &MOVES[m].back[MOVES[m].back_count - 1];
+        for (int after = 0; after <= 60; ++after) {
+            traj_t traj;
+            traj_init(&traj, &CONFIG, start->pulse);
+            char what[48];
+            snprintf(what, sizeof(what), "%s, reversed after %d ticks", MOVES[m].name, after);
+            traj_start(&traj, MOVES[m].path, MOVES[m].count);
+            if (after == 0) {
+                ok &= run(&traj, MAX_TICKS, true, MOVES[m].name);
+                continue;
+            }
+            ok &= run(&traj, after, true, what);
+            traj_start(&traj, MOVES[m].back, MOVES[m].back_count);
+            ok &= run(&traj, MAX_TICKS, false, what);
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        bool (*run)(void);
+    } SWEEPS[] = {
+        { "targets", sweep_targets },
+        { "preemptions", sweep_preemptions },
+        { "visor paths", sweep_visor },
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(SWEEPS) / sizeof(SWEEPS[0]); ++i) {
+        bool passed = SWEEPS[i].run();
+        printf("%-36s %s\n", SWEEPS[i].name, passed ? "ok" : "FAILED");
+        failed += !passed;
+    }
+    return failed ? 1 : 0;
+}
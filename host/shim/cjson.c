@@ -0,0 +1,172 @@
+/* The cJSON subset of cJSON.h, printing the way cJSON_Print() does */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} out_t;
+
+static void out_append(out_t *out, const char *s, size_t len)
+{
+    if (out->buf == NULL) {
+        return;
+    }
+    if (out->len + len + 1 > out->size) {
+        size_t size = (out->len + len + 1) * 2;
+        char *buf = realloc(out->buf, size);
+        if (buf == NULL) {
+            free(out->buf);
+            out->buf = NULL;
+            return;
+        }
+        out->buf = buf;
+        out->size = size;
+    }
+    memcpy(out->buf + out->len, s, len);
+    out->len += len;
+    out->buf[out->len] = '\0';
+}
+
+static void out_puts(out_t *out, const char *s)
+{
+    out_append(out, s, strlen(s));
+}
+
+static void out_indent(out_t *out, int depth)
+{
+    for (int i = 0; i < depth; ++i) {
+        out_append(out, "\t", 1);
+    }
+}
+
+static void print_string(out_t *out, const char *s)
+{
+    out_append(out, "\"", 1);
+    for (; *s; ++s) {
+        char esc[8];
+        switch (*s) {
+            case '"': out_puts(out, "\\\""); break;
+            case '\\': out_puts(out, "\\\\"); break;
+            case '\n': out_puts(out, "\\n"); break;
+            case '\r': out_puts(out, "\\r"); break;
+            case '\t': out_puts(out, "\\t"); break;
+            default:
+                if ((unsigned char)*s < 0x20) {
+                    snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*s);
+                    out_puts(out, esc);
+                } else {
+                    out_append(out, s, 1);
+                }
+        }
+    }
+    out_append(out, "\"", 1);
+}
+
+static void print_item(out_t *out, const cJSON *item, int depth)
+{
+    char num[32];
+    switch (item->type) {
+        case cJSON_Number:
+            if (item->valuedouble == (int)item->valuedouble) {
+                snprintf(num, sizeof(num), "%d", (int)item->valuedouble);
+            } else {
+                snprintf(num, sizeof(num), "%1.15g", item->valuedouble);
+            }
+            out_puts(out, num);
+            break;
+        case cJSON_String:
+            print_string(out, item->valuestring);
+            break;
+        case cJSON_Object:
+            out_puts(out, item->child ? "{\n" : "{");
+            for (const cJSON *child = item->child; child; child = child->next) {
+                out_indent(out, depth + 1);
+                print_string(out, child->string);
+                out_puts(out, ":\t");
+                print_item(out, child, depth + 1);
+                out_puts(out, child->next ? ",\n" : "\n");
+            }
+            if (item->child) {
+                out_indent(out, depth);
+            }
+            out_puts(out, "}");
+            break;
+    }
+}
+
+cJSON *cJSON_CreateObject(void)
+{
+    cJSON *item = calloc(1, sizeof(*item));
+    if (item) {
+        item->type = cJSON_Object;
+    }
+    return item;
+}
+
+static cJSON *add_item(cJSON *object, const char *name, int type)
+{
+    if (object == NULL) {
+        return NULL;
+    }
+    cJSON *item = calloc(1, sizeof(*item));
+    if (item == NULL || (item->string = strdup(name)) == NULL) {
+        free(item);
+        return NULL;
+    }
+    item->type = type;
+    cJSON **link = &object->child;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = item;
+    return item;
+}
+
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *name, const char *string)
+{
+    cJSON *item = add_item(object, name, cJSON_String);
+    if (item) {
+        item->valuestring = strdup(string);
+    }
+    return item;
+}
+
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number)
+{
+    cJSON *item = add_item(object, name, cJSON_Number);
+    if (item) {
+        item->valuedouble = number;
+    }
+    return item;
+}
+
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *name)
+{
+    return add_item(object, name, cJSON_Object);
+}
+
+char *cJSON_Print(const cJSON *item)
+{
+    out_t out = { .buf = malloc(256), .size = 256 };
+    if (out.buf) {
+        out.buf[0] = '\0';
+    }
+    print_item(&out, item, 0);
+    return out.buf;
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    while (item) {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
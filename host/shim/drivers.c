@@ -0,0 +1,147 @@
+/* LEDC and MCPWM without hardware: every output change becomes a line of
+   the actuator timeline, "t_us,device,channel,value,duration_ms" */
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "driver/ledc.h"
+#include "driver/mcpwm.h"
+#include "shim.h"
+
+typedef struct {
+    uint32_t duty;
+    uint32_t fade_target;
+    int fade_ms;
+    int64_t fade_end_us;
+} ledc_state_t;
+
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *timeline;
+static ledc_state_t ledc_state[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+
+bool shim_timeline_open(const char *path)
+{
+    pthread_mutex_lock(&timeline_lock);
+    timeline = fopen(path, "w");
+    if (timeline) {
+        fputs("t_us,device,channel,value,duration_ms\n", timeline);
+    }
+    pthread_mutex_unlock(&timeline_lock);
+    return timeline != NULL;
+}
+
+void shim_timeline_close(void)
+{
+    pthread_mutex_lock(&timeline_lock);
+    if (timeline) {
+        fclose(timeline);
+        timeline = NULL;
+    }
+    pthread_mutex_unlock(&timeline_lock);
+}
+
+void shim_timeline_record(const char *device, int channel, uint32_t value, uint32_t duration_ms)
+{
+    pthread_mutex_lock(&timeline_lock);
+    if (timeline) {
+        fprintf(timeline, "%lld,%s,%d,%u,%u\n", (long long)shim_now_us(), device, channel, value, duration_ms);
+    }
+    pthread_mutex_unlock(&timeline_lock);
+}
+
+static ledc_state_t *ledc_get(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || channel >= LEDC_CHANNEL_MAX) {
+        return NULL;
+    }
+    return &ledc_state[speed_mode][channel];
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    ledc_state_t *state = ledc_get(ledc_conf->speed_mode, ledc_conf->channel);
+    if (state == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    state->duty = ledc_conf->duty;
+    shim_timeline_record("ledc", ledc_conf->channel, state->duty, 0);
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    ledc_state_t *state = ledc_get(speed_mode, channel);
+    if (state == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    state->duty = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    ledc_state_t *state = ledc_get(speed_mode, channel);
+    if (state == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    shim_timeline_record("ledc", channel, state->duty, 0);
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty,
+                                  int max_fade_time_ms)
+{
+    ledc_state_t *state = ledc_get(speed_mode, channel);
+    if (state == NULL || max_fade_time_ms < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The fade service blocks here until the running fade is over
+    int64_t remaining_us = state->fade_end_us - shim_now_us();
+    if (remaining_us > 0) {
+        usleep(remaining_us);
+    }
+    state->fade_target = target_duty;
+    state->fade_ms = max_fade_time_ms;
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    ledc_state_t *state = ledc_get(speed_mode, channel);
+    if (state == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    state->duty = state->fade_target;
+    state->fade_end_us = shim_now_us() + state->fade_ms * 1000LL;
+    shim_timeline_record("ledc", channel, state->duty, state->fade_ms);
+    if (fade_mode == LEDC_FADE_WAIT_DONE) {
+        usleep(state->fade_ms * 1000);
+    }
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_gpio_init(mcpwm_unit_t mcpwm_num, mcpwm_io_signals_t io_signal, int gpio_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_init(mcpwm_unit_t mcpwm_num, mcpwm_timer_t timer_num, const mcpwm_config_t *mcpwm_conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_set_duty_in_us(mcpwm_unit_t mcpwm_num, mcpwm_timer_t timer_num, mcpwm_generator_t gen,
+                               uint32_t duty_in_us)
+{
+    shim_timeline_record("mcpwm", gen, duty_in_us, 0);
+    return ESP_OK;
+}
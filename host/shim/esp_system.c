@@ -0,0 +1,230 @@
+/* System services of the host build: log, errors, random, heap, shutdown,
+   and the network bring-up calls, which have nothing to do on a host */
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "mdns.h"
+#include "nvs.h"
+#include "lwip/apps/netbiosns.h"
+#include "protocol_examples_common.h"
+#include "shim.h"
+#include "shim_compat.h"
+
+#define MAX_SHUTDOWN_HANDLERS 8
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+static shutdown_handler_t shutdown_handlers[MAX_SHUTDOWN_HANDLERS];
+static uint32_t min_free_heap = UINT32_MAX;
+static int64_t start_us;
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+__attribute__((constructor)) static void start_clock(void)
+{
+    start_us = monotonic_us();
+}
+
+int64_t shim_now_us(void)
+{
+    return monotonic_us() - start_us;
+}
+
+size_t shim_strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+size_t shim_strlcat(char *dst, const char *src, size_t size)
+{
+    size_t dst_len = strnlen(dst, size);
+    if (dst_len == size) {
+        return size + strlen(src);
+    }
+    return dst_len + shim_strlcpy(dst + dst_len, src, size - dst_len);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_TYPE_MISMATCH: return "ESP_ERR_NVS_TYPE_MISMATCH";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NOT_ENOUGH_SPACE: return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    log_level = level;
+}
+
+esp_log_level_t esp_log_level_get(void)
+{
+    return log_level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return shim_now_us() / 1000;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+uint32_t esp_random(void)
+{
+    return arc4random();
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    for (int i = 0; i < MAX_SHUTDOWN_HANDLERS; ++i) {
+        if (shutdown_handlers[i] == NULL) {
+            shutdown_handlers[i] = handler;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void shim_run_shutdown_handlers(void)
+{
+    // Last registered runs first, as on the device
+    for (int i = MAX_SHUTDOWN_HANDLERS - 1; i >= 0; --i) {
+        if (shutdown_handlers[i]) {
+            shutdown_handlers[i]();
+        }
+    }
+}
+
+void esp_restart(void)
+{
+    shim_run_shutdown_handlers();
+    shim_timeline_close();
+    exit(0);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    uint32_t free_bytes = info.fordblks > UINT32_MAX ? UINT32_MAX : info.fordblks;
+    if (free_bytes < min_free_heap) {
+        min_free_heap = free_bytes;
+    }
+    return free_bytes;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    esp_get_free_heap_size();
+    return min_free_heap;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return mallinfo2().fordblks;
+}
+
+void esp_chip_info(esp_chip_info_t *out_info)
+{
+    memset(out_info, 0, sizeof(*out_info));
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    out_info->cores = cores > 0 && cores < 256 ? cores : 1;
+}
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+                                     esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_hostname_set(const char *hostname)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_instance_name_set(const char *instance_name)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto, uint16_t port,
+                           mdns_txt_item_t txt[], size_t num_items)
+{
+    return ESP_OK;
+}
+
+void netbiosns_init(void)
+{
+}
+
+void netbiosns_set_name(const char *hostname)
+{
+}
+
+esp_err_t example_connect(void)
+{
+    ESP_LOGI("example_connect", "Host build, serving on every interface, port %u", shim_options.port);
+    return ESP_OK;
+}
+
+esp_err_t example_disconnect(void)
+{
+    return ESP_OK;
+}
@@ -0,0 +1,175 @@
+/* esp_timer on a single "esp_timer" task: armed timers sit in a list sorted
+   by expiry and the task sleeps on a condition until the first one is due */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "shim.h"
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t expiry_us;
+    uint64_t period_us;
+    bool armed;
+    struct esp_timer *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;
+static struct esp_timer *armed_list;
+static bool task_started;
+
+int64_t esp_timer_get_time(void)
+{
+    return shim_now_us();
+}
+
+static void list_insert(struct esp_timer *timer)
+{
+    struct esp_timer **link = &armed_list;
+    while (*link && (*link)->expiry_us <= timer->expiry_us) {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link = timer;
+    timer->armed = true;
+}
+
+static void list_remove(struct esp_timer *timer)
+{
+    for (struct esp_timer **link = &armed_list; *link; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+    timer->armed = false;
+}
+
+static void timer_task(void *arg)
+{
+    pthread_mutex_lock(&lock);
+    while (true) {
+        if (armed_list == NULL) {
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+        int64_t wait_us = armed_list->expiry_us - shim_now_us();
+        if (wait_us > 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += wait_us / 1000000;
+            ts.tv_nsec += (wait_us % 1000000) * 1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&wake, &lock, &ts);
+            continue;
+        }
+
+        struct esp_timer *timer = armed_list;
+        list_remove(timer);
+        if (timer->period_us) {
+            timer->expiry_us += timer->period_us;
+            list_insert(timer);
+        }
+        esp_timer_cb_t callback = timer->callback;
+        void *cb_arg = timer->arg;
+        // Callbacks may start or stop timers, including their own
+        pthread_mutex_unlock(&lock);
+        callback(cb_arg);
+        pthread_mutex_lock(&lock);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+
+    pthread_mutex_lock(&lock);
+    if (!task_started) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&wake, &attr);
+        pthread_condattr_destroy(&attr);
+        task_started = xTaskCreate(timer_task, "esp_timer", 4096, NULL, configMAX_PRIORITIES - 1, NULL) == pdPASS;
+    }
+    pthread_mutex_unlock(&lock);
+    if (!task_started) {
+        free(timer);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    if (timer->armed) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry_us = shim_now_us() + timeout_us;
+    timer->period_us = period_us;
+    list_insert(timer);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    esp_err_t err = timer->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    if (timer->armed) {
+        list_remove(timer);
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    bool armed = timer->armed;
+    pthread_mutex_unlock(&lock);
+    if (armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    free(timer);
+    return ESP_OK;
+}
@@ -0,0 +1,16 @@
+/* Server side of esp-tls on OpenSSL
+
+   Kept out of httpd.c so the call from there stays an undefined reference
+   that -Wl,--wrap can redirect to the firmware's TLS hooks.
+*/
+#include "esp_tls.h"
+
+int esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls)
+{
+    tls->sockfd = sockfd;
+    tls->ssl = SSL_new(cfg->ctx);
+    if (tls->ssl == NULL || SSL_set_fd(tls->ssl, sockfd) != 1) {
+        return -1;
+    }
+    return SSL_accept(tls->ssl) == 1 ? 0 : -1;
+}
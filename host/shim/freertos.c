@@ -0,0 +1,461 @@
+/* FreeRTOS tasks, notifications, queues and semaphores on pthreads */
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "shim.h"
+
+/* Host stacks are the device stack scaled up, painted to find the high-water mark */
+#define STACK_SCALE         16
+#define STACK_MIN_BYTES     (256 * 1024)
+#define STACK_PAINT         0xa5
+
+struct shim_task {
+    struct shim_task *next;
+    char name[16];
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    UBaseType_t priority;
+    uint8_t *stack;
+    size_t stack_size;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify_value;
+    bool notify_pending;
+};
+
+struct shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    size_t item_size;
+    size_t length;
+    size_t count;
+    size_t head;
+    uint8_t items[];
+};
+
+struct shim_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+};
+
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shim_task *tasks;
+static __thread struct shim_task *current_task;
+
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_nsec + (uint64_t)ticks * (1000000000u / configTICK_RATE_HZ);
+    ts.tv_sec += ns / 1000000000u;
+    ts.tv_nsec = ns % 1000000000u;
+    return ts;
+}
+
+/*
+ * Waits on cond until ready() holds or the ticks run out, with lock held.
+ * Returns whether ready() holds.
+ */
+static bool wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+                       bool (*ready)(const void *), const void *obj)
+{
+    if (ready(obj) || ticks == 0) {
+        return ready(obj);
+    }
+    struct timespec deadline = deadline_after(ticks);
+    while (!ready(obj)) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, lock);
+        } else if (pthread_cond_timedwait(cond, lock, &deadline) == ETIMEDOUT) {
+            return ready(obj);
+        }
+    }
+    return true;
+}
+
+static struct shim_task *task_new(const char *name)
+{
+    struct shim_task *task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return NULL;
+    }
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    pthread_mutex_init(&task->lock, NULL);
+    init_cond(&task->cond);
+    return task;
+}
+
+static void task_register(struct shim_task *task)
+{
+    pthread_mutex_lock(&tasks_lock);
+    task->next = tasks;
+    tasks = task;
+    pthread_mutex_unlock(&tasks_lock);
+}
+
+static void task_unregister(struct shim_task *task)
+{
+    pthread_mutex_lock(&tasks_lock);
+    for (struct shim_task **p = &tasks; *p; p = &(*p)->next) {
+        if (*p == task) {
+            *p = task->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tasks_lock);
+}
+
+// Threads not started by xTaskCreate (main, timers) get a task on first use
+static struct shim_task *self(void)
+{
+    if (current_task == NULL) {
+        current_task = task_new("main");
+        if (current_task == NULL) {
+            abort();
+        }
+        current_task->thread = pthread_self();
+        task_register(current_task);
+    }
+    return current_task;
+}
+
+static void *task_main(void *arg)
+{
+    struct shim_task *task = arg;
+    current_task = task;
+    pthread_setname_np(pthread_self(), task->name);
+    task->fn(task->arg);
+    // Returning from a task function is an error on FreeRTOS, tolerated here
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    struct shim_task *task = task_new(name);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->priority = priority;
+    task->stack_size = ((size_t)stack_depth * STACK_SCALE + 4095) & ~(size_t)4095;
+    if (task->stack_size < STACK_MIN_BYTES) {
+        task->stack_size = STACK_MIN_BYTES;
+    }
+    task->stack = aligned_alloc(4096, task->stack_size);
+    if (task->stack == NULL) {
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, STACK_PAINT, task->stack_size);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, task->stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    task_register(task);
+    if (created_task) {
+        *created_task = task;
+    }
+    int err = pthread_create(&task->thread, &attr, task_main, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        task_unregister(task);
+        free(task->stack);
+        free(task);
+        if (created_task) {
+            *created_task = NULL;
+        }
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, created_task, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != current_task) {
+        // Only self-deletion is used by the firmware
+        abort();
+    }
+    task = self();
+    task_unregister(task);
+    // The stack is in use until the thread is gone, so it is leaked
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return shim_now_us() / (1000000 / configTICK_RATE_HZ);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return self();
+}
+
+TaskHandle_t xTaskGetHandle(const char *name)
+{
+    pthread_mutex_lock(&tasks_lock);
+    struct shim_task *task = tasks;
+    while (task && strncmp(task->name, name, sizeof(task->name)) != 0) {
+        task = task->next;
+    }
+    pthread_mutex_unlock(&tasks_lock);
+    return task;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = self();
+    }
+    if (task->stack == NULL) {
+        return 0;
+    }
+    // The stack grows down, from the end of the allocation
+    size_t untouched = 0;
+    while (untouched < task->stack_size && task->stack[untouched] == STACK_PAINT) {
+        untouched++;
+    }
+    return untouched;
+}
+
+static bool has_notify_value(const void *obj)
+{
+    return ((const struct shim_task *)obj)->notify_value != 0;
+}
+
+static bool has_notification(const void *obj)
+{
+    return ((const struct shim_task *)obj)->notify_pending;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    struct shim_task *task = self();
+    pthread_mutex_lock(&task->lock);
+    uint32_t value = 0;
+    if (wait_until(&task->cond, &task->lock, ticks_to_wait, has_notify_value, task)) {
+        value = task->notify_value;
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    task->notify_pending = false;
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t ret = pdPASS;
+    pthread_mutex_lock(&task->lock);
+    switch (action) {
+        case eSetBits:
+            task->notify_value |= value;
+            break;
+        case eIncrement:
+            task->notify_value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->notify_value = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (task->notify_pending) {
+                ret = pdFAIL;
+            } else {
+                task->notify_value = value;
+            }
+            break;
+        case eNoAction:
+            break;
+    }
+    task->notify_pending = true;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return ret;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value,
+                           TickType_t ticks_to_wait)
+{
+    struct shim_task *task = self();
+    pthread_mutex_lock(&task->lock);
+    if (!task->notify_pending) {
+        task->notify_value &= ~clear_on_entry;
+    }
+    bool received = wait_until(&task->cond, &task->lock, ticks_to_wait, has_notification, task);
+    if (value) {
+        *value = task->notify_value;
+    }
+    if (received) {
+        task->notify_value &= ~clear_on_exit;
+        task->notify_pending = false;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return received ? pdTRUE : pdFALSE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    if (length == 0) {
+        return NULL;
+    }
+    struct shim_queue *q = calloc(1, sizeof(*q) + (size_t)length * item_size);
+    if (q == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    init_cond(&q->not_empty);
+    init_cond(&q->not_full);
+    q->item_size = item_size;
+    q->length = length;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q);
+}
+
+static bool queue_has_room(const void *obj)
+{
+    const struct shim_queue *q = obj;
+    return q->count < q->length;
+}
+
+static bool queue_has_items(const void *obj)
+{
+    return ((const struct shim_queue *)obj)->count > 0;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&q->lock);
+    bool room = wait_until(&q->not_full, &q->lock, ticks_to_wait, queue_has_room, q);
+    if (room) {
+        memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+        q->count++;
+        pthread_cond_signal(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return room ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *buffer, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&q->lock);
+    bool got = wait_until(&q->not_empty, &q->lock, ticks_to_wait, queue_has_items, q);
+    if (got) {
+        memcpy(buffer, q->items + q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return got ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+static SemaphoreHandle_t semaphore_create(uint32_t count)
+{
+    struct shim_semaphore *sem = calloc(1, sizeof(*sem));
+    if (sem == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->lock, NULL);
+    init_cond(&sem->cond);
+    sem->count = count;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return semaphore_create(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return semaphore_create(0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_mutex_destroy(&sem->lock);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
+
+static bool semaphore_available(const void *obj)
+{
+    return ((const struct shim_semaphore *)obj)->count > 0;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool taken = wait_until(&sem->cond, &sem->lock, ticks_to_wait, semaphore_available, sem);
+    if (taken) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool given = sem->count == 0;
+    if (given) {
+        sem->count = 1;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return given ? pdTRUE : pdFALSE;
+}
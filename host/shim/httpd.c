@@ -0,0 +1,982 @@
+/* esp_http_server and esp_https_server for the host build
+
+   One "httpd" task polls the listener, the sessions and a wake-up pipe for
+   httpd_queue_work(), and runs everything else on the same thread: TLS
+   handshakes, request parsing, URI handlers, WebSocket frames and queued
+   work, so the firmware sees the serialization it relies on. Sockets are
+   blocking with the configured timeouts, as on the device. Framing comes
+   from the host tools' ws_wire.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include "esp_http_server.h"
+#include "esp_https_server.h"
+#include "esp_log.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "shim.h"
+#include "ws_wire.h"
+
+#define WORK_QUEUE_SIZE     64
+#define MAX_HEADER_SIZE     2048
+
+typedef struct {
+    httpd_work_fn_t fn;
+    void *arg;
+    int close_fd;               /* >= 0 for httpd_sess_trigger_close() */
+} work_t;
+
+typedef struct {
+    bool active;
+    ws_conn_t conn;
+    const httpd_uri_t *ws_uri;  /* set once upgraded */
+    void *ctx;
+    httpd_free_ctx_fn_t free_ctx;
+    uint64_t last_used;
+} session_t;
+
+typedef struct {
+    session_t *session;
+    char headers[MAX_HEADER_SIZE + 1];
+    size_t body_left;
+    const char *status;
+    const char *type;
+    size_t hdr_count;
+    const char *hdr_fields[16];
+    const char *hdr_values[16];
+    bool chunked;
+    bool sent;
+    const ws_frame_t *frame;
+} request_aux_t;
+
+typedef struct {
+    httpd_config_t config;
+    SSL_CTX *ssl_ctx;           /* NULL for plain HTTP */
+    int listener;
+    int wake_pipe[2];
+    httpd_uri_t *handlers;
+    size_t handler_count;
+    session_t *sessions;
+    uint64_t use_counter;
+
+    pthread_mutex_t work_lock;
+    work_t work[WORK_QUEUE_SIZE];
+    size_t work_head;
+    size_t work_count;
+
+    volatile bool stop;
+    SemaphoreHandle_t stopped;
+} server_t;
+
+static const char *TAG = "httpd_shim";
+
+static const char *const ERR_STATUS[HTTPD_ERR_CODE_MAX] = {
+    [HTTPD_500_INTERNAL_SERVER_ERROR] = "500 Internal Server Error",
+    [HTTPD_501_METHOD_NOT_IMPLEMENTED] = "501 Method Not Implemented",
+    [HTTPD_505_VERSION_NOT_SUPPORTED] = "505 Version Not Supported",
+    [HTTPD_400_BAD_REQUEST] = "400 Bad Request",
+    [HTTPD_401_UNAUTHORIZED] = "401 Unauthorized",
+    [HTTPD_403_FORBIDDEN] = "403 Forbidden",
+    [HTTPD_404_NOT_FOUND] = "404 Not Found",
+    [HTTPD_405_METHOD_NOT_ALLOWED] = "405 Method Not Allowed",
+    [HTTPD_408_REQ_TIMEOUT] = "408 Request Timeout",
+    [HTTPD_411_LENGTH_REQUIRED] = "411 Length Required",
+    [HTTPD_414_URI_TOO_LONG] = "414 URI Too Long",
+    [HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE] = "431 Request Header Fields Too Large",
+};
+
+static const char *const METHOD_NAMES[] = {
+    [HTTP_DELETE] = "DELETE",
+    [HTTP_GET] = "GET",
+    [HTTP_HEAD] = "HEAD",
+    [HTTP_POST] = "POST",
+    [HTTP_PUT] = "PUT",
+};
+
+static session_t *find_session(server_t *server, int fd)
+{
+    for (int i = 0; i < server->config.max_open_sockets; ++i) {
+        if (server->sessions[i].active && server->sessions[i].conn.fd == fd) {
+            return &server->sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static void close_session(server_t *server, session_t *session)
+{
+    int fd = session->conn.fd;
+    if (server->config.close_fn) {
+        server->config.close_fn(server, fd);
+    }
+    if (session->ctx && session->free_ctx) {
+        session->free_ctx(session->ctx);
+    }
+    ws_conn_close(&session->conn);
+    memset(session, 0, sizeof(*session));
+}
+
+static void accept_session(server_t *server)
+{
+    int fd = accept(server->listener, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    // Loopback with Nagle and delayed ACKs would add 40 ms stalls the device does not have
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval rcv = { .tv_sec = server->config.recv_wait_timeout };
+    struct timeval snd = { .tv_sec = server->config.send_wait_timeout };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcv, sizeof(rcv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd, sizeof(snd));
+
+    session_t *session = NULL;
+    session_t *oldest = NULL;
+    for (int i = 0; i < server->config.max_open_sockets && session == NULL; ++i) {
+        session_t *s = &server->sessions[i];
+        if (!s->active) {
+            session = s;
+        } else if (oldest == NULL || s->last_used < oldest->last_used) {
+            oldest = s;
+        }
+    }
+    if (session == NULL && server->config.lru_purge_enable && oldest) {
+        ESP_LOGW(TAG, "Session limit reached, closing least recently used fd %d", oldest->conn.fd);
+        close_session(server, oldest);
+        session = oldest;
+    }
+    if (session == NULL) {
+        ESP_LOGW(TAG, "Session limit reached, refusing fd %d", fd);
+        close(fd);
+        return;
+    }
+
+    session->conn.fd = fd;
+    session->conn.ssl = NULL;
+    session->conn.rx_len = 0;
+    if (server->ssl_ctx) {
+        esp_tls_cfg_server_t cfg = { .ctx = server->ssl_ctx };
+        esp_tls_t tls = { 0 };
+        if (esp_tls_server_session_create(&cfg, fd, &tls) != 0) {
+            if (tls.ssl) {
+                SSL_free(tls.ssl);
+            }
+            close(fd);
+            return;
+        }
+        session->conn.ssl = tls.ssl;
+    }
+    if (server->config.open_fn && server->config.open_fn(server, fd) != ESP_OK) {
+        ws_conn_close(&session->conn);
+        return;
+    }
+    session->active = true;
+    session->last_used = ++server->use_counter;
+}
+
+static size_t find_header_end(const ws_conn_t *conn)
+{
+    for (size_t i = 3; i < conn->rx_len; ++i) {
+        if (memcmp(conn->rx + i - 3, "\r\n\r\n", 4) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static const char *find_header(const char *headers, const char *field, size_t *len)
+{
+    size_t field_len = strlen(field);
+    for (const char *line = strstr(headers, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        const char *p = line + 2;
+        if (strncasecmp(p, field, field_len) == 0 && p[field_len] == ':') {
+            p += field_len + 1;
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+            *len = strcspn(p, "\r\n");
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static request_aux_t *req_aux(httpd_req_t *r)
+{
+    return r->aux;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    size_t len = 0;
+    return find_header(req_aux(r)->headers, field, &len) ? len : 0;
+}
+
+// Copies at most size - 1 bytes of a value and terminates it, as httpd does
+static esp_err_t copy_value(const char *value, size_t len, char *val, size_t val_size)
+{
+    if (val_size == 0) {
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    size_t n = len < val_size - 1 ? len : val_size - 1;
+    memcpy(val, value, n);
+    val[n] = '\0';
+    return n < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    size_t len;
+    const char *value = find_header(req_aux(r)->headers, field, &len);
+    if (value == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return copy_value(value, len, val, val_size);
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *query = strchr(r->uri, '?');
+    if (query == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return copy_value(query + 1, strlen(query + 1), buf, buf_len);
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+    for (const char *p = qry; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            p += key_len + 1;
+            return copy_value(p, strcspn(p, "&"), val, val_size);
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    request_aux_t *aux = req_aux(r);
+    ws_conn_t *conn = &aux->session->conn;
+    if (buf_len > aux->body_left) {
+        buf_len = aux->body_left;
+    }
+    if (buf_len == 0) {
+        return 0;
+    }
+    if (conn->rx_len == 0 && !ws_fill(conn)) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    size_t n = conn->rx_len < buf_len ? conn->rx_len : buf_len;
+    memcpy(buf, conn->rx, n);
+    ws_consume(conn, n);
+    aux->body_left -= n;
+    return n;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return req_aux(r)->session->conn.fd;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    req_aux(r)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    req_aux(r)->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    request_aux_t *aux = req_aux(r);
+    server_t *server = r->handle;
+    if (aux->hdr_count >= server->config.max_resp_headers || aux->hdr_count >= 16) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    aux->hdr_fields[aux->hdr_count] = field;
+    aux->hdr_values[aux->hdr_count] = value;
+    aux->hdr_count++;
+    return ESP_OK;
+}
+
+static int format_head(request_aux_t *aux, char *out, size_t size, ssize_t content_len)
+{
+    int len = snprintf(out, size, "HTTP/1.1 %s\r\nContent-Type: %s\r\n", aux->status, aux->type);
+    if (content_len >= 0) {
+        len += snprintf(out + len, size - len, "Content-Length: %zd\r\n", content_len);
+    } else {
+        len += snprintf(out + len, size - len, "Transfer-Encoding: chunked\r\n");
+    }
+    for (size_t i = 0; i < aux->hdr_count && (size_t)len < size; ++i) {
+        len += snprintf(out + len, size - len, "%s: %s\r\n", aux->hdr_fields[i], aux->hdr_values[i]);
+    }
+    if ((size_t)len + 3 > size) {
+        return -1;
+    }
+    len += snprintf(out + len, size - len, "\r\n");
+    return len;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    request_aux_t *aux = req_aux(r);
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    char head[1024];
+    int head_len = format_head(aux, head, sizeof(head), buf_len);
+    if (head_len < 0) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    aux->sent = true;
+    ws_conn_t *conn = &aux->session->conn;
+    if (!ws_write(conn, head, head_len) || (buf_len > 0 && !ws_write(conn, buf, buf_len))) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    request_aux_t *aux = req_aux(r);
+    ws_conn_t *conn = &aux->session->conn;
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    if (!aux->chunked) {
+        char head[1024];
+        int head_len = format_head(aux, head, sizeof(head), -1);
+        if (head_len < 0) {
+            return ESP_ERR_HTTPD_RESP_HDR;
+        }
+        aux->chunked = true;
+        aux->sent = true;
+        if (!ws_write(conn, head, head_len)) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+    }
+    char size_line[16];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", buf_len);
+    if (!ws_write(conn, size_line, size_len) || (buf_len > 0 && !ws_write(conn, buf, buf_len)) ||
+        !ws_write(conn, "\r\n", 2)) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    if (error >= HTTPD_ERR_CODE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    request_aux_t *aux = req_aux(req);
+    aux->status = ERR_STATUS[error];
+    aux->type = HTTPD_TYPE_TEXT;
+    aux->hdr_count = 0;
+    return httpd_resp_send(req, msg ? msg : aux->status, HTTPD_RESP_USE_STRLEN);
+}
+
+int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
+{
+    request_aux_t *aux = req_aux(r);
+    aux->sent = true;
+    return ws_write(&aux->session->conn, buf, buf_len) ? (int)buf_len : HTTPD_SOCK_ERR_FAIL;
+}
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+    size_t tpl_len = strlen(uri_template);
+    if (tpl_len > 0 && uri_template[tpl_len - 1] == '*') {
+        // "/path/*" also matches "/path" and "/path/"
+        size_t prefix = tpl_len - 1;
+        if (prefix > 0 && uri_template[prefix - 1] == '/' && match_upto == prefix - 1) {
+            prefix--;
+        }
+        return match_upto >= prefix && strncmp(uri_template, uri_to_match, prefix) == 0;
+    }
+    if (tpl_len > 0 && uri_template[tpl_len - 1] == '?') {
+        // The character before '?' is optional
+        size_t exact = tpl_len - 1;
+        return (match_upto == exact && strncmp(uri_template, uri_to_match, exact) == 0) ||
+               (exact > 0 && match_upto == exact - 1 && strncmp(uri_template, uri_to_match, exact - 1) == 0);
+    }
+    return match_upto == tpl_len && strncmp(uri_template, uri_to_match, tpl_len) == 0;
+}
+
+static bool uri_matches(server_t *server, const char *tpl, const char *uri, size_t len)
+{
+    if (server->config.uri_match_fn) {
+        return server->config.uri_match_fn(tpl, uri, len);
+    }
+    return strlen(tpl) == len && strncmp(tpl, uri, len) == 0;
+}
+
+static void req_init(httpd_req_t *req, request_aux_t *aux, server_t *server, session_t *session)
+{
+    memset(req, 0, sizeof(*req));
+    aux->session = session;
+    aux->status = HTTPD_200;
+    aux->type = HTTPD_TYPE_TEXT;
+    aux->hdr_count = 0;
+    aux->chunked = false;
+    aux->sent = false;
+    aux->frame = NULL;
+    req->handle = server;
+    req->aux = aux;
+    req->sess_ctx = session->ctx;
+    req->free_ctx = session->free_ctx;
+}
+
+// Keeps what the handler did to the session context, as httpd does
+static void req_done(httpd_req_t *req, session_t *session)
+{
+    if (req->ignore_sess_ctx_changes) {
+        return;
+    }
+    if (session->ctx && session->ctx != req->sess_ctx && session->free_ctx) {
+        session->free_ctx(session->ctx);
+    }
+    session->ctx = req->sess_ctx;
+    session->free_ctx = req->free_ctx;
+}
+
+static bool upgrade_session(server_t *server, session_t *session, const httpd_uri_t *uri, httpd_req_t *req)
+{
+    request_aux_t *aux = req_aux(req);
+    char key[64], upgrade[32], protocols[128];
+    if (httpd_req_get_hdr_value_str(req, "Upgrade", upgrade, sizeof(upgrade)) != ESP_OK ||
+        strcasecmp(upgrade, "websocket") != 0 ||
+        httpd_req_get_hdr_value_str(req, "Sec-WebSocket-Key", key, sizeof(key)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not a WebSocket upgrade");
+        return false;
+    }
+    bool subprotocol = uri->supported_subprotocol &&
+                       httpd_req_get_hdr_value_str(req, "Sec-WebSocket-Protocol", protocols,
+                                                   sizeof(protocols)) == ESP_OK &&
+                       strstr(protocols, uri->supported_subprotocol) != NULL;
+    char accept[32], reply[256];
+    ws_accept_key(key, accept);
+    int len = snprintf(reply, sizeof(reply),
+                       "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: %s\r\n%s%s%s\r\n", accept,
+                       subprotocol ? "Sec-WebSocket-Protocol: " : "", subprotocol ? uri->supported_subprotocol : "",
+                       subprotocol ? "\r\n" : "");
+    aux->sent = true;
+    if (!ws_write(&session->conn, reply, len)) {
+        return false;
+    }
+    session->ws_uri = uri;
+    ESP_LOGD(TAG, "fd %d upgraded to WebSocket", session->conn.fd);
+    return true;
+}
+
+// Handles one complete request at the front of the receive buffer, false to close the session
+static bool handle_request(server_t *server, session_t *session, size_t head_len)
+{
+    static httpd_req_t req;
+    static request_aux_t aux;
+    req_init(&req, &aux, server, session);
+    ws_conn_t *conn = &session->conn;
+
+    memcpy(aux.headers, conn->rx, head_len);
+    aux.headers[head_len] = '\0';
+    ws_consume(conn, head_len);
+
+    char method[8], target[HTTPD_MAX_URI_LEN + 2], version[16];
+    if (sscanf(aux.headers, "%7s %513s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7)) {
+        httpd_resp_send_err(&req, HTTPD_400_BAD_REQUEST, NULL);
+        return false;
+    }
+    if (strlen(target) > HTTPD_MAX_URI_LEN) {
+        httpd_resp_send_err(&req, HTTPD_414_URI_TOO_LONG, NULL);
+        return false;
+    }
+    req.method = -1;
+    for (size_t i = 0; i < sizeof(METHOD_NAMES) / sizeof(METHOD_NAMES[0]); ++i) {
+        if (strcmp(method, METHOD_NAMES[i]) == 0) {
+            req.method = i;
+        }
+    }
+    if (req.method < 0) {
+        httpd_resp_send_err(&req, HTTPD_501_METHOD_NOT_IMPLEMENTED, NULL);
+        return false;
+    }
+    strcpy((char *)req.uri, target);
+
+    char value[32];
+    if (httpd_req_get_hdr_value_str(&req, "Content-Length", value, sizeof(value)) == ESP_OK) {
+        req.content_len = strtoul(value, NULL, 10);
+    }
+    aux.body_left = req.content_len;
+    bool keep_alive = strcmp(version, "HTTP/1.1") == 0;
+    if (httpd_req_get_hdr_value_str(&req, "Connection", value, sizeof(value)) == ESP_OK) {
+        keep_alive = strcasecmp(value, "close") != 0;
+    }
+
+    size_t match_len = strcspn(req.uri, "?");
+    const httpd_uri_t *uri = NULL;
+    bool uri_found = false;
+    for (size_t i = 0; i < server->handler_count && uri == NULL; ++i) {
+        if (uri_matches(server, server->handlers[i].uri, req.uri, match_len)) {
+            uri_found = true;
+            if (server->handlers[i].method == (httpd_method_t)req.method) {
+                uri = &server->handlers[i];
+            }
+        }
+    }
+    if (uri == NULL) {
+        httpd_resp_send_err(&req, uri_found ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND, NULL);
+        return false;
+    }
+    req.user_ctx = uri->user_ctx;
+
+    if (uri->is_websocket && !upgrade_session(server, session, uri, &req)) {
+        return false;
+    }
+    esp_err_t ret = uri->handler(&req);
+    req_done(&req, session);
+    if (ret != ESP_OK || session->ws_uri) {
+        return ret == ESP_OK;
+    }
+
+    // Whatever the handler did not read is discarded
+    char discard[256];
+    while (aux.body_left > 0) {
+        if (httpd_req_recv(&req, discard, sizeof(discard)) <= 0) {
+            return false;
+        }
+    }
+    return keep_alive;
+}
+
+static bool handle_frame(server_t *server, session_t *session, const ws_frame_t *frame)
+{
+    const httpd_uri_t *uri = session->ws_uri;
+    bool control = frame->opcode & 0x8;
+    if (frame->opcode == WS_OP_CLOSE) {
+        ws_send(&session->conn, WS_OP_CLOSE, frame->payload, frame->len < 2 ? frame->len : 2, false);
+        return false;
+    }
+    if (control && !uri->handle_ws_control_frames) {
+        if (frame->opcode == WS_OP_PING) {
+            ws_send(&session->conn, WS_OP_PONG, frame->payload, frame->len, false);
+        }
+        return true;
+    }
+
+    static httpd_req_t req;
+    static request_aux_t aux;
+    req_init(&req, &aux, server, session);
+    aux.headers[0] = '\0';
+    aux.frame = frame;
+    req.method = 0;
+    strcpy((char *)req.uri, uri->uri);
+    req.user_ctx = uri->user_ctx;
+    esp_err_t ret = uri->handler(&req);
+    req_done(&req, session);
+    return ret == ESP_OK;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len)
+{
+    const ws_frame_t *frame = req_aux(req)->frame;
+    if (frame == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pkt->final = true;
+    pkt->fragmented = false;
+    pkt->type = frame->opcode;
+    pkt->len = frame->len;
+    if (max_len == 0) {
+        return ESP_OK;  // only the length was asked for
+    }
+    if (frame->len > max_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(pkt->payload, frame->payload, frame->len);
+    return ESP_OK;
+}
+
+static esp_err_t ws_send_session(session_t *session, httpd_ws_frame_t *frame)
+{
+    if (session == NULL || session->ws_uri == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (frame->len > WS_MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ws_send(&session->conn, frame->type, frame->payload, frame->len, false) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_ws_send_frame(httpd_req_t *req, httpd_ws_frame_t *pkt)
+{
+    return ws_send_session(req_aux(req)->session, pkt);
+}
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd, httpd_ws_frame_t *frame)
+{
+    return ws_send_session(find_session(hd, fd), frame);
+}
+
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    session_t *session = find_session(hd, sockfd);
+    if (session == NULL) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+    return ws_write(&session->conn, buf, buf_len) ? (int)buf_len : HTTPD_SOCK_ERR_FAIL;
+}
+
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd)
+{
+    session_t *session = find_session(hd, fd);
+    if (session == NULL) {
+        return HTTPD_WS_CLIENT_INVALID;
+    }
+    return session->ws_uri ? HTTPD_WS_CLIENT_WEBSOCKET : HTTPD_WS_CLIENT_HTTP;
+}
+
+static void serve_session(server_t *server, session_t *session)
+{
+    ws_conn_t *conn = &session->conn;
+    session->last_used = ++server->use_counter;
+    if (!ws_fill(conn)) {
+        if (conn->rx_len == sizeof(conn->rx) && !session->ws_uri) {
+            static httpd_req_t req;
+            static request_aux_t aux;
+            req_init(&req, &aux, server, session);
+            aux.headers[0] = '\0';
+            httpd_resp_send_err(&req, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE, NULL);
+        }
+        close_session(server, session);
+        return;
+    }
+
+    while (session->active && conn->rx_len > 0) {
+        bool keep = true;
+        if (session->ws_uri) {
+            static ws_frame_t frame;
+            int ret = ws_next_frame(conn, &frame);
+            if (ret == 0) {
+                return;
+            }
+            keep = ret > 0 && handle_frame(server, session, &frame);
+        } else {
+            size_t head_len = find_header_end(conn);
+            if (head_len == 0) {
+                return;
+            }
+            keep = head_len <= MAX_HEADER_SIZE && handle_request(server, session, head_len);
+        }
+        if (!keep) {
+            close_session(server, session);
+        }
+    }
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+    server_t *server = handle;
+    if (server == NULL || work == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&server->work_lock);
+    if (server->work_count == WORK_QUEUE_SIZE) {
+        pthread_mutex_unlock(&server->work_lock);
+        return ESP_FAIL;
+    }
+    server->work[(server->work_head + server->work_count++) % WORK_QUEUE_SIZE] =
+        (work_t) { .fn = work, .arg = arg, .close_fd = -1 };
+    pthread_mutex_unlock(&server->work_lock);
+    write(server->wake_pipe[1], "w", 1);
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    server_t *server = handle;
+    if (server == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&server->work_lock);
+    if (server->work_count == WORK_QUEUE_SIZE) {
+        pthread_mutex_unlock(&server->work_lock);
+        return ESP_FAIL;
+    }
+    server->work[(server->work_head + server->work_count++) % WORK_QUEUE_SIZE] =
+        (work_t) { .close_fd = sockfd };
+    pthread_mutex_unlock(&server->work_lock);
+    write(server->wake_pipe[1], "c", 1);
+    return ESP_OK;
+}
+
+static void run_work(server_t *server)
+{
+    char drain[64];
+    while (read(server->wake_pipe[0], drain, sizeof(drain)) == sizeof(drain)) {
+    }
+    while (true) {
+        pthread_mutex_lock(&server->work_lock);
+        if (server->work_count == 0) {
+            pthread_mutex_unlock(&server->work_lock);
+            return;
+        }
+        work_t work = server->work[server->work_head];
+        server->work_head = (server->work_head + 1) % WORK_QUEUE_SIZE;
+        server->work_count--;
+        pthread_mutex_unlock(&server->work_lock);
+
+        if (work.fn) {
+            work.fn(work.arg);
+        } else {
+            session_t *session = find_session(server, work.close_fd);
+            if (session) {
+                close_session(server, session);
+            }
+        }
+    }
+}
+
+void *httpd_get_global_user_ctx(httpd_handle_t handle)
+{
+    return ((server_t *)handle)->config.global_user_ctx;
+}
+
+void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
+{
+    session_t *session = find_session(handle, sockfd);
+    return session ? session->ctx : NULL;
+}
+
+esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds, int *client_fds)
+{
+    server_t *server = handle;
+    size_t count = 0;
+    for (int i = 0; i < server->config.max_open_sockets; ++i) {
+        if (server->sessions[i].active) {
+            if (count == *fds) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            client_fds[count++] = server->sessions[i].conn.fd;
+        }
+    }
+    *fds = count;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    server_t *server = handle;
+    for (size_t i = 0; i < server->handler_count; ++i) {
+        if (strcmp(server->handlers[i].uri, uri_handler->uri) == 0 &&
+            server->handlers[i].method == uri_handler->method) {
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    if (server->handler_count == server->config.max_uri_handlers) {
+        ESP_LOGW(TAG, "No slot left for %s", uri_handler->uri);
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    httpd_uri_t *slot = &server->handlers[server->handler_count];
+    *slot = *uri_handler;
+    // httpd keeps its own copy of the URI, callers pass stack strings
+    slot->uri = strdup(uri_handler->uri);
+    if (slot->uri == NULL) {
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    server->handler_count++;
+    return ESP_OK;
+}
+
+static void server_task(void *arg)
+{
+    server_t *server = arg;
+    int max_fds = server->config.max_open_sockets + 2;
+    struct pollfd *fds = calloc(max_fds, sizeof(*fds));
+    session_t **owners = calloc(max_fds, sizeof(*owners));
+    if (fds == NULL || owners == NULL) {
+        abort();
+    }
+
+    while (!server->stop) {
+        nfds_t count = 0;
+        fds[count++] = (struct pollfd) { .fd = server->listener, .events = POLLIN };
+        fds[count++] = (struct pollfd) { .fd = server->wake_pipe[0], .events = POLLIN };
+        bool pending = false;
+        for (int i = 0; i < server->config.max_open_sockets; ++i) {
+            session_t *session = &server->sessions[i];
+            if (session->active) {
+                owners[count] = session;
+                fds[count++] = (struct pollfd) { .fd = session->conn.fd, .events = POLLIN };
+                pending |= ws_pending(&session->conn);
+            }
+        }
+        if (poll(fds, count, pending ? 0 : -1) < 0 && errno != EINTR) {
+            ESP_LOGE(TAG, "poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            run_work(server);
+        }
+        for (nfds_t i = 2; i < count; ++i) {
+            // Queued work may have closed or replaced the session
+            session_t *session = owners[i];
+            if (session->active && session->conn.fd == fds[i].fd &&
+                ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) || ws_pending(&session->conn))) {
+                serve_session(server, session);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_session(server);
+        }
+    }
+
+    for (int i = 0; i < server->config.max_open_sockets; ++i) {
+        if (server->sessions[i].active) {
+            close_session(server, &server->sessions[i]);
+        }
+    }
+    free(fds);
+    free(owners);
+    xSemaphoreGive(server->stopped);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t server_start(httpd_handle_t *handle, const httpd_config_t *config, SSL_CTX *ssl_ctx)
+{
+    server_t *server = calloc(1, sizeof(*server));
+    if (server == NULL) {
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    server->config = *config;
+    server->ssl_ctx = ssl_ctx;
+    server->handlers = calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+    server->sessions = calloc(config->max_open_sockets, sizeof(session_t));
+    server->stopped = xSemaphoreCreateBinary();
+    pthread_mutex_init(&server->work_lock, NULL);
+    if (server->handlers == NULL || server->sessions == NULL || server->stopped == NULL ||
+        pipe(server->wake_pipe) != 0) {
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    fcntl(server->wake_pipe[0], F_SETFL, O_NONBLOCK);
+
+    server->listener = socket(AF_INET6, SOCK_STREAM, 0);
+    int one = 1, zero = 0;
+    setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(server->listener, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_port = htons(config->server_port),
+                                 .sin6_addr = in6addr_any };
+    if (bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listener, config->backlog_conn) != 0) {
+        ESP_LOGE(TAG, "Cannot listen on port %u: %s", config->server_port, strerror(errno));
+        close(server->listener);
+        return ESP_ERR_HTTPD_TASK;
+    }
+
+    if (xTaskCreate(server_task, "httpd", config->stack_size, server, config->task_priority, NULL) != pdPASS) {
+        return ESP_ERR_HTTPD_TASK;
+    }
+    ESP_LOGI(TAG, "Serving %s on port %u", ssl_ctx ? "HTTPS" : "HTTP", config->server_port);
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    return server_start(handle, config, NULL);
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    server_t *server = handle;
+    if (server == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    server->stop = true;
+    write(server->wake_pipe[1], "s", 1);
+    xSemaphoreTake(server->stopped, portMAX_DELAY);
+
+    close(server->listener);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    for (size_t i = 0; i < server->handler_count; ++i) {
+        free((char *)server->handlers[i].uri);
+    }
+    if (server->config.global_user_ctx && server->config.global_user_ctx_free_fn) {
+        server->config.global_user_ctx_free_fn(server->config.global_user_ctx);
+    }
+    if (server->ssl_ctx) {
+        SSL_CTX_free(server->ssl_ctx);
+    }
+    vSemaphoreDelete(server->stopped);
+    pthread_mutex_destroy(&server->work_lock);
+    free(server->handlers);
+    free(server->sessions);
+    free(server);
+    return ESP_OK;
+}
+
+static SSL_CTX *ssl_ctx_from_pem(const httpd_ssl_config_t *config)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    BIO *cert_bio = BIO_new_mem_buf(config->cacert_pem, config->cacert_len);
+    BIO *key_bio = BIO_new_mem_buf(config->prvtkey_pem, config->prvtkey_len);
+    X509 *cert = cert_bio ? PEM_read_bio_X509(cert_bio, NULL, NULL, NULL) : NULL;
+    EVP_PKEY *key = key_bio ? PEM_read_bio_PrivateKey(key_bio, NULL, NULL, NULL) : NULL;
+    bool ok = ctx && cert && key && SSL_CTX_use_certificate(ctx, cert) == 1 && SSL_CTX_use_PrivateKey(ctx, key) == 1;
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    BIO_free(cert_bio);
+    BIO_free(key_bio);
+    if (!ok) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (!config->session_tickets) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+    return ctx;
+}
+
+esp_err_t httpd_ssl_start(httpd_handle_t *handle, httpd_ssl_config_t *config)
+{
+    config->httpd.server_port = shim_options.port;
+    if (shim_options.plain) {
+        return server_start(handle, &config->httpd, NULL);
+    }
+    SSL_CTX *ctx = ssl_ctx_from_pem(config);
+    if (ctx == NULL) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = server_start(handle, &config->httpd, ctx);
+    if (err != ESP_OK) {
+        SSL_CTX_free(ctx);
+    }
+    return err;
+}
+
+void httpd_ssl_stop(httpd_handle_t handle)
+{
+    httpd_stop(handle);
+}
@@ -0,0 +1,26 @@
+/* The subset of cJSON used by the firmware, for the host build
+
+   Objects holding strings, numbers and objects; printed formatted, the way
+   cJSON_Print() does.
+*/
+#pragma once
+
+typedef struct cJSON {
+    struct cJSON *next;
+    struct cJSON *child;
+    int type;
+    char *valuestring;
+    double valuedouble;
+    char *string;
+} cJSON;
+
+#define cJSON_Number    (1 << 3)
+#define cJSON_String    (1 << 4)
+#define cJSON_Object    (1 << 6)
+
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *name, const char *string);
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number);
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *name);
+char *cJSON_Print(const cJSON *item);
+void cJSON_Delete(cJSON *item);
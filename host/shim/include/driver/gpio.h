@@ -0,0 +1,4 @@
+/* driver/gpio.h for the host build */
+#pragma once
+
+#include "esp_err.h"
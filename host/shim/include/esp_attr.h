@@ -0,0 +1,8 @@
+/* esp_attr.h for the host build: placement attributes mean nothing here */
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_ATTR
@@ -0,0 +1,17 @@
+/* esp_cpu.h for the host build
+
+   The "cycle counter" is the monotonic clock at 250 MHz, truncated to 32
+   bits, so it wraps about as often as the counter of a 240 MHz ESP32;
+   esp_rom_get_cpu_ticks_per_us() matches it.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint32_t esp_cpu_get_ccount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec) / 4);
+}
@@ -0,0 +1,17 @@
+/* esp_crc.h for the host build: the ROM CRC routines, bit by bit */
+#pragma once
+
+#include <stdint.h>
+
+/* CRC-32 as zlib computes it when crc starts at 0; pass the previous result to continue */
+static inline uint32_t esp_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
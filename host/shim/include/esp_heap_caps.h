@@ -0,0 +1,10 @@
+/* esp_heap_caps.h for the host build */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+size_t heap_caps_get_largest_free_block(uint32_t caps);
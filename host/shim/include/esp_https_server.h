@@ -0,0 +1,56 @@
+/* esp_https_server.h for the host build
+
+   The host HTTP server, wrapped in OpenSSL. The port comes from the command
+   line (--port), as does --plain, which serves HTTP and ws:// instead.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_http_server.h"
+
+typedef enum {
+    HTTPD_SSL_TRANSPORT_SECURE,
+    HTTPD_SSL_TRANSPORT_INSECURE,
+} httpd_ssl_transport_mode_t;
+
+typedef struct {
+    httpd_config_t httpd;
+    const uint8_t *cacert_pem;      /*!< server certificate */
+    size_t cacert_len;
+    const uint8_t *prvtkey_pem;
+    size_t prvtkey_len;
+    httpd_ssl_transport_mode_t transport_mode;
+    uint16_t port_secure;
+    uint16_t port_insecure;
+    bool session_tickets;
+} httpd_ssl_config_t;
+
+#define HTTPD_SSL_CONFIG_DEFAULT() {                \
+        .httpd = {                                  \
+            .task_priority      = tskIDLE_PRIORITY + 5, \
+            .stack_size         = 10240,            \
+            .core_id            = tskNO_AFFINITY,   \
+            .server_port        = 0,                \
+            .ctrl_port          = 32768,            \
+            .max_open_sockets   = 4,                \
+            .max_uri_handlers   = 8,                \
+            .max_resp_headers   = 8,                \
+            .backlog_conn       = 5,                \
+            .lru_purge_enable   = true,             \
+            .recv_wait_timeout  = 5,                \
+            .send_wait_timeout  = 5,                \
+        },                                          \
+        .cacert_pem = NULL,                         \
+        .cacert_len = 0,                            \
+        .prvtkey_pem = NULL,                        \
+        .prvtkey_len = 0,                           \
+        .transport_mode = HTTPD_SSL_TRANSPORT_SECURE, \
+        .port_secure = 443,                         \
+        .port_insecure = 80,                        \
+        .session_tickets = false,                   \
+    }
+
+esp_err_t httpd_ssl_start(httpd_handle_t *handle, httpd_ssl_config_t *config);
+void httpd_ssl_stop(httpd_handle_t handle);
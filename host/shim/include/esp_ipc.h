@@ -0,0 +1,13 @@
+/* esp_ipc.h for the host build: one core, calls run in place */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef void (*esp_ipc_func_t)(void *arg);
+
+static inline esp_err_t esp_ipc_call_blocking(uint32_t cpu_id, esp_ipc_func_t func, void *arg)
+{
+    func(arg);
+    return ESP_OK;
+}
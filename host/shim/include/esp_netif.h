@@ -0,0 +1,6 @@
+/* esp_netif.h for the host build: the host network stack is already up */
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t esp_netif_init(void);
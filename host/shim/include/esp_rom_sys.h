@@ -0,0 +1,10 @@
+/* esp_rom_sys.h for the host build */
+#pragma once
+
+#include <stdint.h>
+
+/* See esp_cpu.h */
+static inline uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 250;
+}
@@ -0,0 +1,30 @@
+/* esp_system.h for the host build */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+typedef struct {
+    int model;
+    uint32_t features;
+    uint8_t cores;
+    uint8_t revision;
+} esp_chip_info_t;
+
+uint32_t esp_random(void);
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+
+/**
+ * @brief Runs the shutdown handlers and exits the process
+ */
+void esp_restart(void) __attribute__((noreturn));
+
+/**
+ * @brief Free bytes in the malloc arena, not comparable with the device heap
+ */
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+void esp_chip_info(esp_chip_info_t *out_info);
@@ -0,0 +1,20 @@
+/* esp_tls.h for the host build: server sessions on OpenSSL */
+#pragma once
+
+#include <openssl/ssl.h>
+
+typedef struct {
+    SSL_CTX *ctx;
+} esp_tls_cfg_server_t;
+
+typedef struct {
+    SSL *ssl;
+    int sockfd;
+} esp_tls_t;
+
+/**
+ * @brief Runs the server side of the TLS handshake on a connected socket
+ *
+ * @return 0 on success
+ */
+int esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls);
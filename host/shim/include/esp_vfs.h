@@ -0,0 +1,15 @@
+/* esp_vfs.h for the host build
+
+   Files are plain host paths, which are longer than the VFS prefixes of the
+   device, so the prefix limit is raised. Brings in the POSIX file calls, as
+   the ESP-IDF header does.
+*/
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+#define ESP_VFS_PATH_MAX 256
@@ -0,0 +1,4 @@
+/* esp_vfs_fat.h for the host build */
+#pragma once
+
+#include "esp_err.h"
@@ -0,0 +1,16 @@
+/* semphr.h for the host build, see FreeRTOS.h
+
+   Mutexes are binary semaphores that start given: no recursion and no
+   priority inheritance.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct shim_semaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
@@ -0,0 +1,5 @@
+/* lwip/apps/netbiosns.h for the host build: nothing is announced */
+#pragma once
+
+void netbiosns_init(void);
+void netbiosns_set_name(const char *hostname);
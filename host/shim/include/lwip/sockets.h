@@ -0,0 +1,7 @@
+/* lwip/sockets.h for the host build: host file descriptors start at 0 */
+#pragma once
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LWIP_SOCKET_OFFSET 0
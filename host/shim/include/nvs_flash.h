@@ -0,0 +1,7 @@
+/* nvs_flash.h for the host build: the partition is a file (--nvs) */
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
@@ -0,0 +1,7 @@
+/* protocol_examples_common.h for the host build: the host is already connected */
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t example_connect(void);
+esp_err_t example_disconnect(void);
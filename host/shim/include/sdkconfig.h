@@ -0,0 +1,58 @@
+/* Configuration of the host build of the firmware
+
+   The values of main/Kconfig.projbuild and sdkconfig.defaults that the
+   firmware sources read, with the Kconfig defaults. The web root is chosen at
+   run time (--www), so the mount point is a variable here.
+*/
+#pragma once
+
+extern const char *host_www_path;
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_HTTPD_WS_SUPPORT 1
+#define CONFIG_HTTPD_MAX_REQ_HDR_LEN 1024
+#define CONFIG_LWIP_MAX_SOCKETS 128
+
+#define CONFIG_EXAMPLE_MDNS_HOST_NAME "esp-home"
+#define CONFIG_EXAMPLE_WEB_DEPLOY_SF 1
+#define CONFIG_EXAMPLE_WEB_MOUNT_POINT host_www_path
+
+#define CONFIG_MK3_STATE_FLUSH_WINDOW_MS 2000
+#define CONFIG_MK3_STATE_FLUSH_IDLE_MS 300
+#define CONFIG_MK3_STATE_FLUSH_TASK_STACK_SIZE 2560
+
+#define CONFIG_MK3_SERVO_TICK_MS 20
+#define CONFIG_MK3_SERVO_MAX_SPEED 1500
+#define CONFIG_MK3_SERVO_ACCEL 6000
+
+#define CONFIG_MK3_LED_TASK_PRIORITY 5
+#define CONFIG_MK3_LED_TASK_STACK_SIZE 2048
+
+#define CONFIG_MK3_CHOREO_TASK_PRIORITY 6
+#define CONFIG_MK3_CHOREO_TASK_STACK_SIZE 2560
+
+#define CONFIG_MK3_ACTUATOR_TASK_PRIORITY 4
+#define CONFIG_MK3_ACTUATOR_TASK_STACK_SIZE 2048
+
+#define CONFIG_MK3_HTTPD_MAX_SOCKETS 4
+#define CONFIG_MK3_WS_MAX_CLIENTS 4
+#define CONFIG_MK3_SSE_MAX_CLIENTS 2
+#define CONFIG_MK3_SSE_HEARTBEAT_S 15
+#define CONFIG_MK3_STATE_WAIT_MAX_S 60
+
+#define CONFIG_MK3_WS_GET_RATE 20
+#define CONFIG_MK3_WS_GET_BURST 10
+#define CONFIG_MK3_WS_SET_RATE 60
+#define CONFIG_MK3_WS_SET_BURST 30
+
+/* Set with -DMK3_HOST_TRACE=ON */
+#ifdef MK3_HOST_TRACE
+#define CONFIG_MK3_TRACE 1
+#define CONFIG_MK3_TRACE_RING_SIZE 512
+#endif
+
+#define CONFIG_MK3_TLS_PROFILE_RSA2048 1
+#define CONFIG_MK3_TLS_SESSION_CACHE 1
+#define CONFIG_MK3_TLS_SESSION_CACHE_SIZE 4
+#define CONFIG_MK3_TLS_SESSION_CACHE_TIMEOUT 3600
+#define CONFIG_MK3_TLS_SESSION_TICKETS 1
@@ -0,0 +1,14 @@
+/* Included ahead of every firmware source in the host build
+
+   newlib extras that glibc (before 2.38) lacks.
+*/
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+size_t shim_strlcpy(char *dst, const char *src, size_t size);
+size_t shim_strlcat(char *dst, const char *src, size_t size);
+
+#define strlcpy shim_strlcpy
+#define strlcat shim_strlcat
@@ -0,0 +1,2 @@
+/* soc/mcpwm_periph.h for the host build */
+#pragma once
@@ -0,0 +1,93 @@
+/* The firmware as a Linux process
+
+     mk3_firmware [--port N] [--plain] [--www DIR] [--nvs FILE] [--timeline CSV]
+                  [--log-level e|w|i|d] [--duration S]
+
+   Runs app_main() as the device does after boot, then waits for SIGINT or
+   SIGTERM (or --duration seconds), runs the shutdown handlers, so pending
+   NVS writes are flushed, and exits.
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+#include "shim.h"
+
+void app_main(void);
+
+shim_options_t shim_options = {
+    .port = 8443,
+    .nvs_path = "mk3_nvs.txt",
+};
+
+const char *host_www_path = MK3_WWW_DIR;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--port N] [--plain] [--www DIR] [--nvs FILE] [--timeline CSV]\n"
+                    "       [--log-level e|w|i|d] [--duration S]\n", prog);
+    exit(2);
+}
+
+static esp_log_level_t parse_level(const char *arg)
+{
+    switch (arg[0]) {
+        case 'e': return ESP_LOG_ERROR;
+        case 'w': return ESP_LOG_WARN;
+        case 'i': return ESP_LOG_INFO;
+        case 'd': return ESP_LOG_DEBUG;
+        default: return ESP_LOG_VERBOSE;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int duration_s = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            shim_options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--plain") == 0) {
+            shim_options.plain = true;
+        } else if (strcmp(argv[i], "--www") == 0 && i + 1 < argc) {
+            host_www_path = argv[++i];
+        } else if (strcmp(argv[i], "--nvs") == 0 && i + 1 < argc) {
+            shim_options.nvs_path = argv[++i];
+        } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            shim_options.timeline_path = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            esp_log_level_set("*", parse_level(argv[++i]));
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration_s = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (shim_options.timeline_path && !shim_timeline_open(shim_options.timeline_path)) {
+        perror(shim_options.timeline_path);
+        return 1;
+    }
+
+    // Every task inherits the mask, so the signals are only taken here
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    app_main();
+
+    if (duration_s > 0) {
+        struct timespec timeout = { .tv_sec = duration_s };
+        sigtimedwait(&signals, NULL, &timeout);
+    } else {
+        int sig;
+        sigwait(&signals, &sig);
+    }
+    ESP_LOGI("main", "Shutting down");
+    esp_restart();
+}
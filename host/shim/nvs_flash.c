@@ -0,0 +1,294 @@
+/* NVS on a text file: one "namespace key type hex" line per entry
+
+   Entries are held in memory; nvs_commit() rewrites the file through a
+   temporary and an fsync, so a commit costs about what a flash write does
+   and an interrupted one leaves the previous file in place.
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "shim.h"
+
+#define MAX_ENTRIES     64
+#define MAX_HANDLES     8
+#define MAX_VALUE_SIZE  1984
+#define TYPE_U8         "u8"
+#define TYPE_BLOB       "blb"
+
+typedef struct {
+    char ns[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char type[4];
+    size_t len;
+    uint8_t data[MAX_VALUE_SIZE];
+} entry_t;
+
+typedef struct {
+    bool open;
+    bool writable;
+    char ns[NVS_KEY_NAME_MAX_SIZE];
+} handle_t;
+
+static const char *TAG = "nvs_shim";
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized;
+static entry_t entries[MAX_ENTRIES];
+static size_t entry_count;
+static handle_t handles[MAX_HANDLES];
+
+static bool parse_hex(const char *hex, uint8_t *out, size_t *len)
+{
+    size_t n = strlen(hex);
+    if (n % 2 != 0 || n / 2 > MAX_VALUE_SIZE) {
+        return false;
+    }
+    for (size_t i = 0; i < n / 2; ++i) {
+        unsigned byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            return false;
+        }
+        out[i] = byte;
+    }
+    *len = n / 2;
+    return true;
+}
+
+static esp_err_t load_file(void)
+{
+    FILE *file = fopen(shim_options.nvs_path, "r");
+    if (file == NULL) {
+        return ESP_OK;  // an empty partition
+    }
+    static char line[64 + 2 * MAX_VALUE_SIZE];
+    static char hex[2 * MAX_VALUE_SIZE + 1];
+    esp_err_t err = ESP_OK;
+    entry_count = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (entry_count == MAX_ENTRIES) {
+            err = ESP_ERR_NVS_NO_FREE_PAGES;
+            break;
+        }
+        entry_t *entry = &entries[entry_count];
+        if (sscanf(line, "%15s %15s %3s %3968s", entry->ns, entry->key, entry->type, hex) != 4 ||
+            !parse_hex(hex, entry->data, &entry->len)) {
+            ESP_LOGE(TAG, "Corrupt entry in %s", shim_options.nvs_path);
+            err = ESP_ERR_NVS_NO_FREE_PAGES;  // what the device reports for pages it cannot read
+            break;
+        }
+        entry_count++;
+    }
+    fclose(file);
+    return err;
+}
+
+static esp_err_t save_file(void)
+{
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", shim_options.nvs_path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < entry_count; ++i) {
+        fprintf(file, "%s %s %s ", entries[i].ns, entries[i].key, entries[i].type);
+        for (size_t j = 0; j < entries[i].len; ++j) {
+            fprintf(file, "%02x", entries[i].data[j]);
+        }
+        fputc('\n', file);
+    }
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok &= fclose(file) == 0;
+    if (!ok || rename(tmp_path, shim_options.nvs_path) != 0) {
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static entry_t *find_entry(const char *ns, const char *key)
+{
+    for (size_t i = 0; i < entry_count; ++i) {
+        if (strcmp(entries[i].ns, ns) == 0 && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static handle_t *get_handle(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > MAX_HANDLES || !handles[handle - 1].open) {
+        return NULL;
+    }
+    return &handles[handle - 1];
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    pthread_mutex_lock(&lock);
+    esp_err_t err = load_file();
+    initialized = err == ESP_OK;
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&lock);
+    entry_count = 0;
+    initialized = false;
+    unlink(shim_options.nvs_path);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    pthread_mutex_lock(&lock);
+    esp_err_t err = initialized ? ESP_ERR_NVS_NOT_ENOUGH_SPACE : ESP_ERR_NVS_NOT_INITIALIZED;
+    for (int i = 0; initialized && i < MAX_HANDLES; ++i) {
+        if (!handles[i].open) {
+            handles[i].open = true;
+            handles[i].writable = open_mode == NVS_READWRITE;
+            strcpy(handles[i].ns, name);
+            *out_handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    pthread_mutex_lock(&lock);
+    esp_err_t err = ESP_OK;
+    handle_t *h = get_handle(handle);
+    entry_t *entry = h ? find_entry(h->ns, key) : NULL;
+    if (h == NULL) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (strcmp(entry->type, TYPE_U8) != 0 || entry->len != 1) {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else {
+        *out_value = entry->data[0];
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    pthread_mutex_lock(&lock);
+    esp_err_t err = ESP_OK;
+    handle_t *h = get_handle(handle);
+    entry_t *entry = h ? find_entry(h->ns, key) : NULL;
+    if (h == NULL) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (strcmp(entry->type, TYPE_BLOB) != 0) {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else if (out_value == NULL) {
+        *length = entry->len;   // a size query
+    } else if (*length < entry->len) {
+        *length = entry->len;
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, entry->data, entry->len);
+        *length = entry->len;
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+// Creates or replaces an entry of the handle's namespace
+static esp_err_t set_entry(nvs_handle_t handle, const char *key, const char *type, const void *value, size_t length)
+{
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (length > MAX_VALUE_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+    pthread_mutex_lock(&lock);
+    esp_err_t err = ESP_OK;
+    handle_t *h = get_handle(handle);
+    entry_t *entry = h ? find_entry(h->ns, key) : NULL;
+    if (h == NULL) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (!h->writable) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else if (entry == NULL && entry_count == MAX_ENTRIES) {
+        err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    } else {
+        if (entry == NULL) {
+            entry = &entries[entry_count++];
+            strcpy(entry->ns, h->ns);
+            strcpy(entry->key, key);
+        }
+        strcpy(entry->type, type);
+        memcpy(entry->data, value, length);
+        entry->len = length;
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return set_entry(handle, key, TYPE_U8, &value, 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return set_entry(handle, key, TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&lock);
+    esp_err_t err = ESP_OK;
+    handle_t *h = get_handle(handle);
+    entry_t *entry = h ? find_entry(h->ns, key) : NULL;
+    if (h == NULL) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (!h->writable) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else {
+        *entry = entries[--entry_count];
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&lock);
+    esp_err_t err = get_handle(handle) ? save_file() : ESP_ERR_NVS_INVALID_HANDLE;
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&lock);
+    handle_t *h = get_handle(handle);
+    if (h) {
+        h->open = false;
+    }
+    pthread_mutex_unlock(&lock);
+}
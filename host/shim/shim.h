@@ -0,0 +1,44 @@
+/* Internals shared by the host shims */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Command line options of the host firmware
+ */
+typedef struct {
+    uint16_t port;              /*!< listening port of the HTTP(S) server */
+    bool plain;                 /*!< serve HTTP and ws:// instead of HTTPS and wss:// */
+    const char *nvs_path;       /*!< file standing in for the NVS partition */
+    const char *timeline_path;  /*!< actuator timeline CSV, NULL for none */
+} shim_options_t;
+
+extern shim_options_t shim_options;
+
+/**
+ * @brief Microseconds since the process started, the time base of every shim
+ */
+int64_t shim_now_us(void);
+
+/**
+ * @brief Appends an actuator event to the timeline, if one is recorded
+ *
+ * @param device "ledc" or "mcpwm"
+ * @param channel channel or generator
+ * @param value duty, or pulse width in microseconds
+ * @param duration_ms fade time, 0 for an immediate change
+ */
+void shim_timeline_record(const char *device, int channel, uint32_t value, uint32_t duration_ms);
+
+/**
+ * @brief Opens the timeline file and writes its header
+ */
+bool shim_timeline_open(const char *path);
+
+void shim_timeline_close(void);
+
+/**
+ * @brief Runs the handlers registered with esp_register_shutdown_handler()
+ */
+void shim_run_shutdown_handlers(void);
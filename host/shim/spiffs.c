@@ -0,0 +1,42 @@
+/* SPIFFS mount on a host directory (--www), which is served as is */
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_spiffs.h"
+
+static const char *TAG = "spiffs_shim";
+
+static const char *mount_point;
+static size_t used_bytes_sum;
+
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t *conf)
+{
+    struct stat st;
+    if (stat(conf->base_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        // Let the API and WebSocket run without a front-end build
+        ESP_LOGW(TAG, "%s is not a directory, static files will not be found", conf->base_path);
+    }
+    mount_point = conf->base_path;
+    return ESP_OK;
+}
+
+static int add_size(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    if (flag == FTW_F) {
+        used_bytes_sum += st->st_size;
+    }
+    return 0;
+}
+
+esp_err_t esp_spiffs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes)
+{
+    if (mount_point == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    used_bytes_sum = 0;
+    nftw(mount_point, add_size, 16, FTW_PHYS);
+    *total_bytes = used_bytes_sum;
+    *used_bytes = used_bytes_sum;
+    return ESP_OK;
+}
@@ -0,0 +1,124 @@
+/* tls_server.h on OpenSSL, in place of main/tls_server.c and its mbedTLS hooks
+
+   Same behaviour: the profile picks the certificate pair, the session cache
+   and tickets follow the "TLS" menu defaults in sdkconfig.h, and every
+   handshake is timed through the esp_tls_server_session_create() wrap.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "tls_server.h"
+
+static const char *TAG = "tls";
+
+static tls_server_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static SSL_CTX *configured_ctx;
+
+#if CONFIG_MK3_TLS_PROFILE_ECDSA_P256
+#define PROFILE_NAME "ECDSA P-256"
+#define PROFILE_DIR MK3_CERT_DIR "/ecdsa"
+#else
+#define PROFILE_NAME "RSA 2048"
+#define PROFILE_DIR MK3_CERT_DIR
+#endif
+
+// Stands in for the EMBED_TXTFILES symbols, the PEMs live for the whole run
+static const uint8_t *load_pem(const char *path, size_t *len)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    uint8_t *pem = malloc(size + 1);
+    if (pem && fread(pem, 1, size, file) == (size_t)size) {
+        pem[size] = '\0';
+        *len = size + 1;   // the embedded files are NUL-terminated too
+    } else {
+        free(pem);
+        pem = NULL;
+    }
+    fclose(file);
+    return pem;
+}
+
+void tls_server_configure(httpd_ssl_config_t *conf)
+{
+    conf->cacert_pem = load_pem(PROFILE_DIR "/cacert.pem", &conf->cacert_len);
+    conf->prvtkey_pem = load_pem(PROFILE_DIR "/prvtkey.pem", &conf->prvtkey_len);
+
+#if CONFIG_MK3_TLS_SESSION_TICKETS
+    conf->session_tickets = true;
+    ESP_LOGI(TAG, "Session tickets enabled");
+#endif
+#if CONFIG_MK3_TLS_SESSION_CACHE
+    ESP_LOGI(TAG, "Session cache: %d entries, %d s", CONFIG_MK3_TLS_SESSION_CACHE_SIZE,
+             CONFIG_MK3_TLS_SESSION_CACHE_TIMEOUT);
+#endif
+    ESP_LOGI(TAG, "Certificate profile: " PROFILE_NAME);
+}
+
+void tls_server_get_stats(tls_server_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// The counterpart of the mbedtls_ssl_setup() hook, applied once to the shared context
+static void configure_ctx(SSL_CTX *ctx)
+{
+    if (ctx == configured_ctx) {
+        return;
+    }
+#if CONFIG_MK3_TLS_SESSION_CACHE
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, CONFIG_MK3_TLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, CONFIG_MK3_TLS_SESSION_CACHE_TIMEOUT);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"mk3", 3);
+#else
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+#endif
+#if CONFIG_MK3_TLS_PROFILE_ECDSA_P256
+    SSL_CTX_set1_groups_list(ctx, "P-256");
+#endif
+    configured_ctx = ctx;
+}
+
+int __real_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls);
+
+int __wrap_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls)
+{
+    configure_ctx(cfg->ctx);
+    int64_t start = esp_timer_get_time();
+    int ret = __real_esp_tls_server_session_create(cfg, sockfd, tls);
+    uint32_t elapsed = esp_timer_get_time() - start;
+    bool resumed = ret == 0 && SSL_session_reused(tls->ssl);
+
+    portENTER_CRITICAL(&stats_lock);
+    if (ret != 0) {
+        stats.failed++;
+    } else if (resumed) {
+        stats.resumed++;
+        stats.resumed_us += elapsed;
+        stats.resumed_max_us = MAX(stats.resumed_max_us, elapsed);
+    } else {
+        stats.full++;
+        stats.full_us += elapsed;
+        stats.full_max_us = MAX(stats.full_max_us, elapsed);
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    ESP_LOGD(TAG, "fd %d: %s handshake in %u us", sockfd,
+             ret != 0 ? "failed" : resumed ? "resumed" : "full", elapsed);
+    return ret;
+}
@@ -0,0 +1,537 @@
+/* WebSocket load generator for /ws
+
+   Opens N concurrent connections, each running its own closed loop of text
+   commands drawn from a weighted mix (one command in flight per connection),
+   and reports, in microseconds:
+
+     handshake    TCP connect + TLS + WebSocket upgrade
+     rtt_<cmd>    send to completion: "okl"/"okv" for sets, the "@<gen>"
+                  terminator for g
+     fanout       send of an sl by one client to receipt of the matching
+                  "l<n>@<gen>" broadcast by each of the others
+
+   plus connection failures, "busy" answers and timeouts. Each client only
+   sets LED values from its own residue class (value % clients == id), so a
+   broadcast value identifies its sender; fan-out is only measured with up to
+   128 clients. Visor broadcasts carry no usable identity and are not timed.
+
+     mk3_load [--clients N] [--duration S] [--commands N] [--rate R]
+              [--mix g=1,sl=8,sv=1] [--cafile PEM] [--csv] URL
+
+   URL is ws://host[:port]/ws or wss://host[:port]/ws. Without --cafile the
+   server certificate is not verified (the firmware ships a self-signed one).
+   --commands stops each client after N commands instead of after --duration.
+   --rate paces each client to at most R commands/s; by default clients send
+   as fast as the answers come back. --csv prints
+   "metric,count,p50_us,p99_us,p999_us,max_us,per_sec" for comparing runs.
+*/
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include "ws_wire.h"
+
+#define MAX_CLIENTS         1024
+#define MAX_FANOUT_CLIENTS  128
+#define REPLY_TIMEOUT_S     5
+
+typedef enum {
+    CMD_GET = 0,
+    CMD_SET_LED,
+    CMD_SET_VISOR,
+    CMD_MAX,
+} cmd_t;
+
+static const char *const CMD_NAMES[CMD_MAX] = { "g", "sl", "sv" };
+
+typedef struct {
+    uint32_t *v;
+    size_t len;
+    size_t cap;
+} samples_t;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    samples_t handshake;
+    samples_t rtt[CMD_MAX];
+    samples_t fanout;
+    uint64_t busy;
+    uint64_t timeouts;
+    bool connected;
+    bool failed;            /* dropped after connecting */
+} client_t;
+
+static struct {
+    char host[256];
+    char port[8];
+    char path[128];
+    bool tls;
+    SSL_CTX *ctx;
+    int clients;
+    double duration_s;
+    uint64_t commands;
+    double rate;
+    unsigned weights[CMD_MAX];
+    bool csv;
+} opts = {
+    .clients = 4,
+    .duration_s = 10,
+    .weights = { 1, 8, 1 },
+};
+
+static client_t clients[MAX_CLIENTS];
+static volatile bool stopping;
+static uint64_t start_us;
+static pthread_barrier_t ready;
+
+// Send time of the last LED set per value; values are partitioned by client
+static uint64_t led_sent_us[256];
+
+static void samples_add(samples_t *s, uint64_t us)
+{
+    if (s->len == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(*s->v));
+        if (s->v == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->v[s->len++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+static void samples_merge(samples_t *into, const samples_t *from)
+{
+    for (size_t i = 0; i < from->len; ++i) {
+        samples_add(into, from->v[i]);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const samples_t *s, double p)
+{
+    if (s->len == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (s->len - 1) + 0.5);
+    return s->v[i];
+}
+
+static void print_header(void)
+{
+    if (opts.csv) {
+        printf("metric,count,p50_us,p99_us,p999_us,max_us,per_sec\n");
+    } else {
+        printf("%-12s %10s %10s %10s %10s %10s %12s\n", "metric", "count", "p50_us", "p99_us", "p999_us", "max_us",
+               "per_sec");
+    }
+}
+
+static void report_samples(const char *metric, samples_t *s, double elapsed_s)
+{
+    qsort(s->v, s->len, sizeof(*s->v), cmp_u32);
+    uint32_t max = s->len ? s->v[s->len - 1] : 0;
+    double per_sec = elapsed_s > 0 ? s->len / elapsed_s : 0;
+    if (opts.csv) {
+        printf("%s,%zu,%u,%u,%u,%u,%.1f\n", metric, s->len, percentile(s, 0.50), percentile(s, 0.99),
+               percentile(s, 0.999), max, per_sec);
+    } else {
+        printf("%-12s %10zu %10u %10u %10u %10u %12.1f\n", metric, s->len, percentile(s, 0.50),
+               percentile(s, 0.99), percentile(s, 0.999), max, per_sec);
+    }
+}
+
+static void report_count(const char *metric, uint64_t count)
+{
+    if (opts.csv) {
+        printf("%s,%llu,,,,,\n", metric, (unsigned long long)count);
+    } else {
+        printf("%-12s %10llu\n", metric, (unsigned long long)count);
+    }
+}
+
+static int dial(void)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(opts.host, opts.port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        int one = 1;
+        struct timeval tv = { .tv_sec = REPLY_TIMEOUT_S };
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return fd;
+}
+
+static cmd_t pick_command(unsigned *seed)
+{
+    unsigned total = 0;
+    for (int i = 0; i < CMD_MAX; ++i) {
+        total += opts.weights[i];
+    }
+    unsigned r = rand_r(seed) % total;
+    for (int i = 0; i < CMD_MAX; ++i) {
+        if (r < opts.weights[i]) {
+            return i;
+        }
+        r -= opts.weights[i];
+    }
+    return CMD_GET;
+}
+
+// Parses "l<n>@<gen>", returns -1 for anything else
+static int parse_led_update(const ws_frame_t *frame)
+{
+    if (frame->len < 2 || frame->payload[0] != 'l') {
+        return -1;
+    }
+    char *end;
+    long val = strtol((const char *)frame->payload + 1, &end, 10);
+    return *end == '@' && val >= 0 && val <= 255 ? (int)val : -1;
+}
+
+static void time_broadcast(client_t *c, const ws_frame_t *frame)
+{
+    int val = parse_led_update(frame);
+    if (opts.clients > 1 && opts.clients <= MAX_FANOUT_CLIENTS && val >= 0 && val % opts.clients != c->id) {
+        uint64_t sent = __atomic_load_n(&led_sent_us[val], __ATOMIC_ACQUIRE);
+        if (sent != 0) {
+            samples_add(&c->fanout, ws_now_us() - sent);
+        }
+    }
+}
+
+// Times the broadcasts that arrive while a paced client waits for its next slot
+static bool drain_until(client_t *c, ws_conn_t *conn, uint64_t deadline_us)
+{
+    ws_frame_t frame;
+    uint64_t now;
+    while ((now = ws_now_us()) < deadline_us) {
+        struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+        if (!ws_pending(conn) && poll(&pfd, 1, (deadline_us - now + 999) / 1000) <= 0) {
+            continue;
+        }
+        if (!ws_fill(conn)) {
+            return false;
+        }
+        int ret;
+        while ((ret = ws_next_frame(conn, &frame)) > 0) {
+            if (frame.opcode == WS_OP_CLOSE) {
+                return false;
+            }
+            if (frame.opcode == WS_OP_TEXT) {
+                time_broadcast(c, &frame);
+            }
+        }
+        if (ret < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Reads frames until the command completes. Broadcasts from other clients are
+ * timed on the way; while a g is in flight its answer frames look the same as
+ * broadcasts, so none are timed.
+ */
+static bool await_completion(client_t *c, ws_conn_t *conn, cmd_t cmd, bool *busy)
+{
+    static const char *const ACKS[CMD_MAX] = { NULL, "okl", "okv" };
+    ws_frame_t frame;
+    while (true) {
+        int ret = ws_next_frame(conn, &frame);
+        if (ret < 0) {
+            return false;
+        }
+        if (ret == 0) {
+            if (!ws_fill(conn)) {
+                return false;
+            }
+            continue;
+        }
+        if (frame.opcode == WS_OP_CLOSE) {
+            return false;
+        }
+        if (frame.opcode != WS_OP_TEXT) {
+            continue;
+        }
+        const char *text = (const char *)frame.payload;
+        if (strcmp(text, "busy") == 0) {
+            *busy = true;
+            return true;
+        }
+        if (cmd == CMD_GET ? text[0] == '@' : strcmp(text, ACKS[cmd]) == 0) {
+            *busy = false;
+            return true;
+        }
+        if (cmd != CMD_GET) {
+            time_broadcast(c, &frame);
+        }
+    }
+}
+
+static void *client_main(void *arg)
+{
+    client_t *c = arg;
+    unsigned seed = c->id * 2654435761u + 1;
+    ws_conn_t conn = { .fd = -1 };
+
+    uint64_t t0 = ws_now_us();
+    int fd = dial();
+    if (fd >= 0 && ws_conn_init(&conn, fd, opts.ctx, false) &&
+        ws_client_handshake(&conn, opts.host, opts.path, NULL)) {
+        samples_add(&c->handshake, ws_now_us() - t0);
+        c->connected = true;
+    } else if (fd >= 0) {
+        ws_conn_close(&conn);
+    }
+    // Commands only start once every client has connected or failed
+    pthread_barrier_wait(&ready);
+    if (!c->connected) {
+        return NULL;
+    }
+
+    // LED values owned by this client: id, id + clients, id + 2 * clients...
+    int led_steps = (255 - c->id) / opts.clients + 1;
+    int led_step = 0;
+    uint8_t visor = 0;
+    uint64_t interval_us = opts.rate > 0 ? 1e6 / opts.rate : 0;
+    uint64_t next_us = ws_now_us();
+    for (uint64_t n = 0; !stopping && (opts.commands == 0 || n < opts.commands); ++n) {
+        if (interval_us) {
+            if (!drain_until(c, &conn, next_us)) {
+                c->failed = true;
+                break;
+            }
+            next_us += interval_us;
+        }
+
+        cmd_t cmd = pick_command(&seed);
+        char text[16];
+        int led = -1;
+        switch (cmd) {
+            case CMD_GET:
+                snprintf(text, sizeof(text), "g");
+                break;
+            case CMD_SET_LED:
+                led = c->id < 256 ? (c->id + opts.clients * (led_step++ % led_steps)) : (int)(rand_r(&seed) % 256);
+                snprintf(text, sizeof(text), "sl%d", led);
+                break;
+            default:
+                visor ^= 1;
+                snprintf(text, sizeof(text), "sv%u", visor);
+                break;
+        }
+
+        uint64_t sent = ws_now_us();
+        if (led >= 0) {
+            __atomic_store_n(&led_sent_us[led], sent, __ATOMIC_RELEASE);
+        }
+        bool busy;
+        if (!ws_send(&conn, WS_OP_TEXT, text, strlen(text), true) || !await_completion(c, &conn, cmd, &busy)) {
+            if (ws_now_us() - sent >= REPLY_TIMEOUT_S * 1000000ull) {
+                c->timeouts++;
+            }
+            c->failed = true;
+            break;
+        }
+        if (busy) {
+            c->busy++;
+        } else {
+            samples_add(&c->rtt[cmd], ws_now_us() - sent);
+        }
+    }
+
+    if (!c->failed) {
+        ws_send(&conn, WS_OP_CLOSE, NULL, 0, true);
+    }
+    ws_conn_close(&conn);
+    return NULL;
+}
+
+static bool parse_url(const char *url)
+{
+    const char *rest;
+    if (strncmp(url, "wss://", 6) == 0) {
+        opts.tls = true;
+        rest = url + 6;
+    } else if (strncmp(url, "ws://", 5) == 0) {
+        rest = url + 5;
+    } else {
+        return false;
+    }
+    size_t host_len = strcspn(rest, ":/");
+    if (host_len == 0 || host_len >= sizeof(opts.host)) {
+        return false;
+    }
+    memcpy(opts.host, rest, host_len);
+    opts.host[host_len] = '\0';
+    rest += host_len;
+
+    snprintf(opts.port, sizeof(opts.port), "%s", opts.tls ? "443" : "80");
+    if (*rest == ':') {
+        size_t port_len = strcspn(++rest, "/");
+        if (port_len == 0 || port_len >= sizeof(opts.port)) {
+            return false;
+        }
+        memcpy(opts.port, rest, port_len);
+        opts.port[port_len] = '\0';
+        rest += port_len;
+    }
+    snprintf(opts.path, sizeof(opts.path), "%s", *rest ? rest : "/ws");
+    return true;
+}
+
+static bool parse_mix(char *mix)
+{
+    memset(opts.weights, 0, sizeof(opts.weights));
+    for (char *item = strtok(mix, ","); item; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        if (eq == NULL) {
+            return false;
+        }
+        *eq = '\0';
+        int cmd = -1;
+        for (int i = 0; i < CMD_MAX; ++i) {
+            if (strcmp(item, CMD_NAMES[i]) == 0) {
+                cmd = i;
+            }
+        }
+        if (cmd < 0) {
+            return false;
+        }
+        opts.weights[cmd] = atoi(eq + 1);
+    }
+    return opts.weights[CMD_GET] + opts.weights[CMD_SET_LED] + opts.weights[CMD_SET_VISOR] > 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--clients N] [--duration S] [--commands N] [--rate R]\n"
+            "          [--mix g=1,sl=8,sv=1] [--cafile PEM] [--csv] ws[s]://host[:port][/ws]\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *url = NULL;
+    const char *cafile = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            opts.clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            opts.duration_s = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--commands") == 0 && i + 1 < argc) {
+            opts.commands = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            opts.rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+            if (!parse_mix(argv[++i])) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--cafile") == 0 && i + 1 < argc) {
+            cafile = argv[++i];
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            opts.csv = true;
+        } else if (url == NULL && argv[i][0] != '-') {
+            url = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (url == NULL || !parse_url(url) || opts.clients < 1 || opts.clients > MAX_CLIENTS) {
+        usage(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (opts.tls) {
+        opts.ctx = SSL_CTX_new(TLS_client_method());
+        if (opts.ctx == NULL || (cafile && SSL_CTX_load_verify_locations(opts.ctx, cafile, NULL) != 1)) {
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+        SSL_CTX_set_verify(opts.ctx, cafile ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL);
+    }
+
+    pthread_barrier_init(&ready, NULL, opts.clients + 1);
+    for (int i = 0; i < opts.clients; ++i) {
+        clients[i].id = i;
+        if (pthread_create(&clients[i].thread, NULL, client_main, &clients[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    pthread_barrier_wait(&ready);
+    start_us = ws_now_us();
+    if (opts.commands == 0) {
+        usleep(opts.duration_s * 1e6);
+        stopping = true;
+    }
+    for (int i = 0; i < opts.clients; ++i) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    double elapsed_s = (ws_now_us() - start_us) / 1e6;
+
+    samples_t handshake = { 0 }, rtt[CMD_MAX] = { { 0 } }, all = { 0 }, fanout = { 0 };
+    uint64_t connected = 0, busy = 0, timeouts = 0, dropped = 0;
+    for (int i = 0; i < opts.clients; ++i) {
+        client_t *c = &clients[i];
+        samples_merge(&handshake, &c->handshake);
+        for (int cmd = 0; cmd < CMD_MAX; ++cmd) {
+            samples_merge(&rtt[cmd], &c->rtt[cmd]);
+            samples_merge(&all, &c->rtt[cmd]);
+        }
+        samples_merge(&fanout, &c->fanout);
+        connected += c->connected;
+        busy += c->busy;
+        timeouts += c->timeouts;
+        dropped += c->failed;
+    }
+
+    print_header();
+    report_samples("handshake", &handshake, 0);
+    for (int cmd = 0; cmd < CMD_MAX; ++cmd) {
+        char metric[16];
+        snprintf(metric, sizeof(metric), "rtt_%s", CMD_NAMES[cmd]);
+        report_samples(metric, &rtt[cmd], elapsed_s);
+    }
+    report_samples("rtt_all", &all, elapsed_s);
+    report_samples("fanout", &fanout, elapsed_s);
+    report_count("connected", connected);
+    report_count("conn_failed", opts.clients - connected);
+    report_count("dropped", dropped);
+    report_count("busy", busy);
+    report_count("timeouts", timeouts);
+
+    // Non-zero if the run did not measure anything, so scripts notice
+    return connected > 0 && all.len > 0 ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+/* Stand-in for the firmware's /ws endpoint
+
+   Serves the real protocol core (main/protocol.c) over ws:// or wss:// on a
+   single thread, like the firmware's httpd task: no keep-alive, no actuators,
+   state in memory. Meant as a local target for mk3_load, to compare the tool
+   and protocol changes without a board.
+
+     mk3_standin [--port N] [--tls] [--cert PEM] [--key PEM] [--work-us N]
+
+   --work-us burns the given time per set command, to stand in for slower
+   hardware paths.
+*/
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include "protocol.h"
+#include "ws_wire.h"
+
+#define MAX_CLIENTS 256
+
+typedef struct {
+    ws_conn_t conn;
+    bool active;
+    proto_encoding_t encoding;
+    uint32_t topics;
+} client_t;
+
+static client_t clients[MAX_CLIENTS];
+static uint8_t values[PROTO_FIELD_MAX];
+static uint32_t changed_at[PROTO_FIELD_MAX];
+static uint32_t generation = 1;
+static unsigned work_us;
+
+static uint8_t standin_load(proto_field_t field)
+{
+    return values[field];
+}
+
+static uint32_t standin_store(proto_field_t field, uint8_t val)
+{
+    if (values[field] == val) {
+        return 0;
+    }
+    values[field] = val;
+    changed_at[field] = ++generation;
+    return generation;
+}
+
+static uint32_t standin_store_batch(const proto_set_t *sets, size_t count)
+{
+    bool changed = false;
+    for (size_t i = 0; i < count; ++i) {
+        if (values[sets[i].field] != sets[i].val) {
+            values[sets[i].field] = sets[i].val;
+            changed_at[sets[i].field] = generation + 1;
+            changed = true;
+        }
+    }
+    return changed ? ++generation : 0;
+}
+
+static uint32_t standin_changed_at(proto_field_t field)
+{
+    return changed_at[field];
+}
+
+static uint32_t standin_generation(void)
+{
+    return generation;
+}
+
+static bool standin_actuate(proto_field_t field, uint8_t val)
+{
+    uint64_t until = ws_now_us() + work_us;
+    while (ws_now_us() < until) {
+    }
+    return true;
+}
+
+static bool standin_actuate_batch(const proto_set_t *sets, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        standin_actuate(sets[i].field, sets[i].val);
+    }
+    return true;
+}
+
+static void standin_reply(void *conn, proto_encoding_t enc, const uint8_t *msg, size_t len)
+{
+    ws_send(conn, enc == PROTO_ENC_BINARY ? WS_OP_BINARY : WS_OP_TEXT, msg, len, false);
+}
+
+static void standin_broadcast(const proto_update_t *update)
+{
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        if (!clients[i].active || !(clients[i].topics & update->topics)) {
+            continue;
+        }
+        if (clients[i].encoding == PROTO_ENC_BINARY) {
+            ws_send(&clients[i].conn, WS_OP_BINARY, update->binary, update->binary_len, false);
+        } else {
+            ws_send(&clients[i].conn, WS_OP_TEXT, update->text, update->text_len, false);
+        }
+    }
+}
+
+static bool standin_run_sequence(uint8_t id)
+{
+    return id < 6;
+}
+
+// The connection is the first member of its client
+static bool standin_subscribe(void *conn, uint32_t topics)
+{
+    ((client_t *)conn)->topics = topics;
+    return true;
+}
+
+static const proto_ops_t ops = {
+    .load = standin_load,
+    .store = standin_store,
+    .store_batch = standin_store_batch,
+    .changed_at = standin_changed_at,
+    .generation = standin_generation,
+    .actuate = standin_actuate,
+    .actuate_batch = standin_actuate_batch,
+    .reply = standin_reply,
+    .broadcast = standin_broadcast,
+    .run_sequence = standin_run_sequence,
+    .subscribe = standin_subscribe,
+};
+
+static void drop_client(client_t *client)
+{
+    ws_conn_close(&client->conn);
+    client->active = false;
+}
+
+static void accept_client(int listener, SSL_CTX *ctx)
+{
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    client_t *client = NULL;
+    for (int i = 0; i < MAX_CLIENTS && client == NULL; ++i) {
+        if (!clients[i].active) {
+            client = &clients[i];
+        }
+    }
+    char path[64];
+    if (client == NULL) {
+        close(fd);
+        return;
+    }
+    // Handshakes block the loop, as they block the firmware's httpd task
+    if (!ws_conn_init(&client->conn, fd, ctx, true) || !ws_server_handshake(&client->conn, path, sizeof(path)) ||
+        strcmp(path, "/ws") != 0) {
+        ws_conn_close(&client->conn);
+        return;
+    }
+    client->active = true;
+    client->encoding = PROTO_ENC_TEXT;
+    client->topics = PROTO_TOPIC_ALL;
+}
+
+static void serve_client(client_t *client)
+{
+    if (!ws_fill(&client->conn)) {
+        drop_client(client);
+        return;
+    }
+    ws_frame_t frame;
+    int ret;
+    while ((ret = ws_next_frame(&client->conn, &frame)) > 0) {
+        switch (frame.opcode) {
+            case WS_OP_TEXT:
+                proto_handle_text(&ops, &client->conn, frame.payload, frame.len);
+                break;
+            case WS_OP_BINARY:
+                client->encoding = PROTO_ENC_BINARY;
+                proto_handle_binary(&ops, &client->conn, frame.payload, frame.len);
+                break;
+            case WS_OP_PING:
+                ws_send(&client->conn, WS_OP_PONG, frame.payload, frame.len, false);
+                break;
+            case WS_OP_CLOSE:
+                ws_send(&client->conn, WS_OP_CLOSE, NULL, 0, false);
+                drop_client(client);
+                return;
+        }
+    }
+    if (ret < 0) {
+        drop_client(client);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--port N] [--tls] [--cert PEM] [--key PEM] [--work-us N]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int port = 8080;
+    bool tls = false;
+    const char *cert = MK3_CERT_DIR "/cacert.pem";
+    const char *key = MK3_CERT_DIR "/prvtkey.pem";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tls") == 0) {
+            tls = true;
+        } else if (strcmp(argv[i], "--cert") == 0 && i + 1 < argc) {
+            cert = argv[++i];
+        } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+            key = argv[++i];
+        } else if (strcmp(argv[i], "--work-us") == 0 && i + 1 < argc) {
+            work_us = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX *ctx = NULL;
+    if (tls) {
+        ctx = SSL_CTX_new(TLS_server_method());
+        if (ctx == NULL || SSL_CTX_use_certificate_file(ctx, cert, SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1) {
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        perror("listen");
+        return 1;
+    }
+    fprintf(stderr, "mk3_standin listening on %s://0.0.0.0:%d/ws\n", tls ? "wss" : "ws", port);
+
+    static struct pollfd fds[MAX_CLIENTS + 1];
+    static client_t *owners[MAX_CLIENTS + 1];
+    while (true) {
+        nfds_t count = 0;
+        fds[count++] = (struct pollfd) { .fd = listener, .events = POLLIN };
+        bool pending = false;
+        for (int i = 0; i < MAX_CLIENTS; ++i) {
+            if (clients[i].active) {
+                owners[count] = &clients[i];
+                fds[count++] = (struct pollfd) { .fd = clients[i].conn.fd, .events = POLLIN };
+                pending |= ws_pending(&clients[i].conn);
+            }
+        }
+        if (poll(fds, count, pending ? 0 : -1) < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+        for (nfds_t i = 1; i < count; ++i) {
+            if (owners[i]->active && ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) || ws_pending(&owners[i]->conn))) {
+                serve_client(owners[i]);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_client(listener, ctx);
+        }
+    }
+}
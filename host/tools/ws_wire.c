@@ -0,0 +1,264 @@
+/* Minimal WebSocket plumbing for the host tools */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include "ws_wire.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+uint64_t ws_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+bool ws_conn_init(ws_conn_t *conn, int fd, SSL_CTX *ctx, bool server)
+{
+    conn->fd = fd;
+    conn->ssl = NULL;
+    conn->rx_len = 0;
+    if (ctx == NULL) {
+        return true;
+    }
+    conn->ssl = SSL_new(ctx);
+    if (conn->ssl == NULL) {
+        return false;
+    }
+    SSL_set_fd(conn->ssl, fd);
+    return (server ? SSL_accept(conn->ssl) : SSL_connect(conn->ssl)) == 1;
+}
+
+void ws_conn_close(ws_conn_t *conn)
+{
+    if (conn->ssl) {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+bool ws_write(ws_conn_t *conn, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        int n = conn->ssl ? SSL_write(conn->ssl, p, len) : (int)write(conn->fd, p, len);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ws_fill(ws_conn_t *conn)
+{
+    if (conn->rx_len == sizeof(conn->rx)) {
+        return false;
+    }
+    size_t room = sizeof(conn->rx) - conn->rx_len;
+    int n = conn->ssl ? SSL_read(conn->ssl, conn->rx + conn->rx_len, room)
+                      : (int)read(conn->fd, conn->rx + conn->rx_len, room);
+    if (n <= 0) {
+        return false;
+    }
+    conn->rx_len += n;
+    return true;
+}
+
+bool ws_pending(const ws_conn_t *conn)
+{
+    return conn->ssl && SSL_pending(conn->ssl) > 0;
+}
+
+void ws_consume(ws_conn_t *conn, size_t len)
+{
+    memmove(conn->rx, conn->rx + len, conn->rx_len - len);
+    conn->rx_len -= len;
+}
+
+// Reads until the end of the HTTP header block, returns its length including the blank line
+static size_t read_http_head(ws_conn_t *conn)
+{
+    while (true) {
+        for (size_t i = 3; i < conn->rx_len; ++i) {
+            if (memcmp(conn->rx + i - 3, "\r\n\r\n", 4) == 0) {
+                return i + 1;
+            }
+        }
+        if (!ws_fill(conn)) {
+            return 0;
+        }
+    }
+}
+
+static bool header_value(const char *head, const char *name, char *out, size_t size)
+{
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        const char *p = line + 2;
+        if (strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            p += name_len + 1;
+            while (*p == ' ') {
+                p++;
+            }
+            size_t len = strcspn(p, "\r\n");
+            if (len >= size) {
+                return false;
+            }
+            memcpy(out, p, len);
+            out[len] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+void ws_accept_key(const char *key, char *out)
+{
+    char buf[128];
+    uint8_t digest[SHA_DIGEST_LENGTH];
+    snprintf(buf, sizeof(buf), "%s" WS_GUID, key);
+    SHA1((const uint8_t *)buf, strlen(buf), digest);
+    EVP_EncodeBlock((uint8_t *)out, digest, sizeof(digest));
+}
+
+bool ws_client_handshake(ws_conn_t *conn, const char *host, const char *path, const char *subprotocol)
+{
+    uint8_t nonce[16];
+    char key[32];
+    char request[512];
+    for (size_t i = 0; i < sizeof(nonce); ++i) {
+        nonce[i] = rand();
+    }
+    EVP_EncodeBlock((uint8_t *)key, nonce, sizeof(nonce));
+    int len = snprintf(request, sizeof(request),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n%s%s%s\r\n",
+                       path, host, key, subprotocol ? "Sec-WebSocket-Protocol: " : "",
+                       subprotocol ? subprotocol : "", subprotocol ? "\r\n" : "");
+    if (!ws_write(conn, request, len)) {
+        return false;
+    }
+
+    size_t head_len = read_http_head(conn);
+    if (head_len == 0 || head_len >= sizeof(conn->rx)) {
+        return false;
+    }
+    char head[WS_RX_BUF_SIZE + 1];
+    memcpy(head, conn->rx, head_len);
+    head[head_len] = '\0';
+    ws_consume(conn, head_len);
+
+    char expected[32], accept[64];
+    ws_accept_key(key, expected);
+    return strncmp(head, "HTTP/1.1 101", 12) == 0 &&
+           header_value(head, "Sec-WebSocket-Accept", accept, sizeof(accept)) && strcmp(accept, expected) == 0;
+}
+
+bool ws_server_handshake(ws_conn_t *conn, char *path, size_t path_size)
+{
+    size_t head_len = read_http_head(conn);
+    if (head_len == 0) {
+        return false;
+    }
+    char head[WS_RX_BUF_SIZE + 1];
+    memcpy(head, conn->rx, head_len);
+    head[head_len] = '\0';
+    ws_consume(conn, head_len);
+
+    char key[64], upgrade[32];
+    if (path_size < 64 || sscanf(head, "GET %63s HTTP/1.1", path) != 1 ||
+        !header_value(head, "Upgrade", upgrade, sizeof(upgrade)) || strcasecmp(upgrade, "websocket") != 0 ||
+        !header_value(head, "Sec-WebSocket-Key", key, sizeof(key))) {
+        const char *bad = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+        ws_write(conn, bad, strlen(bad));
+        return false;
+    }
+
+    char accept[32], reply[256];
+    ws_accept_key(key, accept);
+    int len = snprintf(reply, sizeof(reply),
+                       "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+    return ws_write(conn, reply, len);
+}
+
+bool ws_send(ws_conn_t *conn, uint8_t opcode, const void *payload, size_t len, bool mask)
+{
+    uint8_t frame[14 + WS_MAX_PAYLOAD];
+    size_t pos = 0;
+    if (len > WS_MAX_PAYLOAD) {
+        return false;
+    }
+    frame[pos++] = 0x80 | opcode;
+    if (len < 126) {
+        frame[pos++] = (mask ? 0x80 : 0) | len;
+    } else {
+        frame[pos++] = (mask ? 0x80 : 0) | 126;
+        frame[pos++] = len >> 8;
+        frame[pos++] = len;
+    }
+    uint8_t key[4] = { 0 };
+    if (mask) {
+        for (int i = 0; i < 4; ++i) {
+            key[i] = rand();
+            frame[pos++] = key[i];
+        }
+    }
+    const uint8_t *src = payload;
+    for (size_t i = 0; i < len; ++i) {
+        frame[pos++] = src[i] ^ key[i % 4];
+    }
+    return ws_write(conn, frame, pos);
+}
+
+int ws_next_frame(ws_conn_t *conn, ws_frame_t *frame)
+{
+    if (conn->rx_len < 2) {
+        return 0;
+    }
+    const uint8_t *p = conn->rx;
+    bool masked = p[1] & 0x80;
+    size_t len = p[1] & 0x7f;
+    size_t pos = 2;
+    if (!(p[0] & 0x80)) {
+        return -1;  // fragmented frames are not supported
+    }
+    if (len == 126) {
+        if (conn->rx_len < 4) {
+            return 0;
+        }
+        len = p[2] << 8 | p[3];
+        pos = 4;
+    } else if (len == 127) {
+        return -1;
+    }
+    if (len > WS_MAX_PAYLOAD) {
+        return -1;
+    }
+    size_t total = pos + (masked ? 4 : 0) + len;
+    if (conn->rx_len < total) {
+        return 0;
+    }
+    const uint8_t *key = masked ? p + pos : NULL;
+    pos += masked ? 4 : 0;
+    frame->opcode = p[0] & 0x0f;
+    frame->len = len;
+    for (size_t i = 0; i < len; ++i) {
+        frame->payload[i] = p[pos + i] ^ (key ? key[i % 4] : 0);
+    }
+    frame->payload[len] = '\0';
+    ws_consume(conn, total);
+    return 1;
+}
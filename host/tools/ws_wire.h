@@ -0,0 +1,112 @@
+/* Minimal WebSocket plumbing for the host tools
+
+   A connection is a blocking socket, optionally wrapped in OpenSSL, plus a
+   receive buffer that frames are parsed out of. Only what the load generator
+   and the stand-in server need: the opening handshake on both sides, text,
+   binary, ping/pong and close frames, no fragmentation, no extensions.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/ssl.h>
+
+#define WS_OP_TEXT      0x1
+#define WS_OP_BINARY    0x2
+#define WS_OP_CLOSE     0x8
+#define WS_OP_PING      0x9
+#define WS_OP_PONG      0xA
+
+#define WS_RX_BUF_SIZE  4096
+#define WS_MAX_PAYLOAD  1024
+
+typedef struct {
+    int fd;
+    SSL *ssl;                       /* NULL for plain ws:// */
+    size_t rx_len;
+    uint8_t rx[WS_RX_BUF_SIZE];
+} ws_conn_t;
+
+typedef struct {
+    uint8_t opcode;
+    size_t len;
+    uint8_t payload[WS_MAX_PAYLOAD + 1];    /* NUL-terminated for convenience */
+} ws_frame_t;
+
+/**
+ * @brief Monotonic time in microseconds
+ */
+uint64_t ws_now_us(void);
+
+/**
+ * @brief Wraps a connected socket
+ *
+ * @param ctx TLS context, or NULL for plain sockets
+ * @param server accept instead of connect on the TLS side
+ * @return false if the TLS handshake failed
+ */
+bool ws_conn_init(ws_conn_t *conn, int fd, SSL_CTX *ctx, bool server);
+
+/**
+ * @brief Shuts the TLS session down and closes the socket
+ */
+void ws_conn_close(ws_conn_t *conn);
+
+/**
+ * @brief Sends the client handshake and waits for 101 Switching Protocols
+ *
+ * @param host Host header
+ * @param path request path, e.g. "/ws"
+ * @param subprotocol Sec-WebSocket-Protocol to offer, or NULL
+ */
+bool ws_client_handshake(ws_conn_t *conn, const char *host, const char *path, const char *subprotocol);
+
+/**
+ * @brief Reads a client handshake and answers it
+ *
+ * @param path set to the request path, at least 64 bytes
+ * @return false if the request is not a WebSocket upgrade
+ */
+bool ws_server_handshake(ws_conn_t *conn, char *path, size_t path_size);
+
+/**
+ * @brief Computes Sec-WebSocket-Accept for a Sec-WebSocket-Key
+ *
+ * @param out at least 29 bytes
+ */
+void ws_accept_key(const char *key, char *out);
+
+/**
+ * @brief Sends one frame; clients mask their frames, servers do not
+ */
+bool ws_send(ws_conn_t *conn, uint8_t opcode, const void *payload, size_t len, bool mask);
+
+/**
+ * @brief Writes raw bytes, e.g. an HTTP response
+ */
+bool ws_write(ws_conn_t *conn, const void *buf, size_t len);
+
+/**
+ * @brief Drops bytes from the front of the receive buffer
+ */
+void ws_consume(ws_conn_t *conn, size_t len);
+
+/**
+ * @brief Reads whatever the socket has, blocking until at least one byte arrives
+ *
+ * @return false on EOF or error
+ */
+bool ws_fill(ws_conn_t *conn);
+
+/**
+ * @brief Takes the next complete frame out of the receive buffer
+ *
+ * @return 1 if a frame was taken, 0 if more data is needed, -1 on a protocol error
+ */
+int ws_next_frame(ws_conn_t *conn, ws_frame_t *frame);
+
+/**
+ * @brief Whether decrypted data is already buffered, so poll() would not report it
+ */
+bool ws_pending(const ws_conn_t *conn);
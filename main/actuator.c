@@ -0,0 +1,92 @@
+/* Actuator task
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "actuator.h"
+#include "trace.h"
+
+_Static_assert(PROTO_FIELD_MAX <= ACTQ_MAX_TARGETS, "actuator queue has too few targets");
+
+static const char *TAG = "actuator";
+
+static actq_t queue;
+static TaskHandle_t actuator_task_handle;
+static actuator_exec_cb_t exec_cb;
+
+static void actuator_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint8_t field;
+        uint32_t val;
+        while (actq_pop(&queue, &field, &val)) {
+            TRACE_SPAN_BEGIN(span);
+            exec_cb(field, val);
+            TRACE_SPAN_END(span, TRACE_EV_ACTUATE, field);
+        }
+    }
+}
+
+esp_err_t actuator_init(actuator_exec_cb_t exec)
+{
+    exec_cb = exec;
+    if (actuator_task_handle) {
+        return ESP_OK;
+    }
+    actq_init(&queue);
+    if (xTaskCreate(actuator_task, "actuator", CONFIG_MK3_ACTUATOR_TASK_STACK_SIZE, NULL,
+                    CONFIG_MK3_ACTUATOR_TASK_PRIORITY, &actuator_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the actuator task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool actuator_submit(proto_field_t field, uint8_t val)
+{
+    if (actuator_task_handle == NULL) {
+        return false;
+    }
+    switch (actq_push(&queue, field, val)) {
+        case ACTQ_QUEUED:
+            xTaskNotifyGive(actuator_task_handle);
+            return true;
+        case ACTQ_COALESCED:
+            // Already queued, the task picks up the new value when it gets there
+            return true;
+        default:
+            ESP_LOGW(TAG, "Command queue full, dropping %d", field);
+            return false;
+    }
+}
+
+bool actuator_submit_batch(const proto_set_t *sets, size_t count)
+{
+    if (actuator_task_handle == NULL || count > PROTO_FIELD_MAX) {
+        return false;
+    }
+    uint8_t fields[PROTO_FIELD_MAX];
+    uint32_t vals[PROTO_FIELD_MAX];
+    for (size_t i = 0; i < count; ++i) {
+        fields[i] = sets[i].field;
+        vals[i] = sets[i].val;
+    }
+    if (!actq_push_all(&queue, fields, vals, count)) {
+        ESP_LOGW(TAG, "Command queue full, dropping a batch of %d", (int)count);
+        return false;
+    }
+    xTaskNotifyGive(actuator_task_handle);
+    return true;
+}
+
+void actuator_get_stats(actq_stats_t *out)
+{
+    actq_get_stats(&queue, out);
+}
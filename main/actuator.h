@@ -0,0 +1,53 @@
+/* Actuator task
+
+   Network handlers do not drive the hardware themselves: they submit the new
+   value of a field and return, and a dedicated task applies it. Commands for a
+   field that is still waiting are coalesced, so a slider storm costs the
+   hardware one update per field per task wake-up, and never blocks the
+   sockets.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "protocol.h"
+#include "actuator_queue.h"
+
+/**
+ * @brief Applies a value to the hardware, called from the actuator task
+ */
+typedef void (*actuator_exec_cb_t)(proto_field_t field, uint8_t val);
+
+/**
+ * @brief Starts the actuator task, or only replaces the callback if already started
+ *
+ * @param exec called for every command taken off the queue
+ * @return ESP_OK on success
+ */
+esp_err_t actuator_init(actuator_exec_cb_t exec);
+
+/**
+ * @brief Queues a new value for a field, returns immediately
+ *
+ * Single producer: only call this from one task (the httpd task).
+ *
+ * @return false if the command was dropped
+ */
+bool actuator_submit(proto_field_t field, uint8_t val);
+
+/**
+ * @brief Queues new values for several fields, all of them or none
+ *
+ * Single producer, like actuator_submit().
+ *
+ * @param sets distinct fields and their values
+ * @param count number of sets, at most PROTO_FIELD_MAX
+ * @return false if every command was dropped
+ */
+bool actuator_submit_batch(const proto_set_t *sets, size_t count);
+
+/**
+ * @brief Gets the queue depth and coalescing counters
+ */
+void actuator_get_stats(actq_stats_t *out);
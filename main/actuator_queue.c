@@ -0,0 +1,87 @@
+/* Single-producer, single-consumer actuator command queue
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "actuator_queue.h"
+
+void actq_init(actq_t *q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+actq_result_t actq_push(actq_t *q, uint8_t target, uint32_t value)
+{
+    // The value goes first: a consumer that clears the flag after this reads it
+    __atomic_store_n(&q->value[target], value, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&q->pending[target], 1, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&q->stats.submitted, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&q->stats.coalesced, 1, __ATOMIC_RELAXED);
+        return ACTQ_COALESCED;
+    }
+
+    uint32_t head = q->head;
+    uint32_t depth = head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (depth >= ACTQ_RING_SIZE) {
+        // Only reachable if the ring is smaller than the target count
+        __atomic_store_n(&q->pending[target], 0, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&q->stats.rejected, 1, __ATOMIC_RELAXED);
+        return ACTQ_FULL;
+    }
+    q->ring[head % ACTQ_RING_SIZE] = target;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&q->stats.submitted, 1, __ATOMIC_RELAXED);
+    if (depth + 1 > q->stats.max_depth) {
+        __atomic_store_n(&q->stats.max_depth, depth + 1, __ATOMIC_RELAXED);
+    }
+    return ACTQ_QUEUED;
+}
+
+bool actq_push_all(actq_t *q, const uint8_t *targets, const uint32_t *values, size_t count)
+{
+    // The consumer only ever frees slots, so room seen here is still there for the pushes
+    uint32_t depth = q->head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (depth + count > ACTQ_RING_SIZE) {
+        __atomic_fetch_add(&q->stats.rejected, count, __ATOMIC_RELAXED);
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        actq_push(q, targets[i], values[i]);
+    }
+    return true;
+}
+
+bool actq_pop(actq_t *q, uint8_t *target, uint32_t *value)
+{
+    uint32_t tail = q->tail;
+    if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    uint8_t t = q->ring[tail % ACTQ_RING_SIZE];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    /*
+     * The flag is cleared only once the entry is off the ring, so a producer
+     * seeing it clear can requeue the target without it being there twice.
+     * Values submitted until then are coalesced into the one read below.
+     */
+    __atomic_store_n(&q->pending[t], 0, __ATOMIC_SEQ_CST);
+    *target = t;
+    *value = __atomic_load_n(&q->value[t], __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&q->stats.executed, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void actq_get_stats(const actq_t *q, actq_stats_t *out)
+{
+    out->submitted = __atomic_load_n(&q->stats.submitted, __ATOMIC_RELAXED);
+    out->coalesced = __atomic_load_n(&q->stats.coalesced, __ATOMIC_RELAXED);
+    out->rejected = __atomic_load_n(&q->stats.rejected, __ATOMIC_RELAXED);
+    out->executed = __atomic_load_n(&q->stats.executed, __ATOMIC_RELAXED);
+    out->max_depth = __atomic_load_n(&q->stats.max_depth, __ATOMIC_RELAXED);
+    out->depth = __atomic_load_n(&q->head, __ATOMIC_RELAXED) - __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,88 @@
+/* Single-producer, single-consumer actuator command queue
+
+   Each target (an LED, the visor...) has one pending-value slot. Submitting a
+   command overwrites the target's slot and only puts the target on the ring if
+   it was not already pending, so a burst of commands for one target collapses
+   into a single execution of the latest value. A target is on the ring at most
+   once, so a ring with a slot per target never overflows.
+
+   Lock-free: actq_push() must only be called from one task and actq_pop()
+   from one other task. The stats may be read from anywhere. No ESP-IDF
+   dependencies, so it also builds on the host.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACTQ_MAX_TARGETS    4
+#define ACTQ_RING_SIZE      ACTQ_MAX_TARGETS   /* power of two, at least ACTQ_MAX_TARGETS */
+
+typedef enum {
+    ACTQ_QUEUED = 0,    /*!< target put on the ring */
+    ACTQ_COALESCED,     /*!< target was already pending, its value was replaced */
+    ACTQ_FULL,          /*!< ring full, command dropped */
+} actq_result_t;
+
+/**
+ * @brief Queue counters
+ */
+typedef struct {
+    uint32_t submitted;     /*!< commands accepted by actq_push() */
+    uint32_t coalesced;     /*!< accepted commands that replaced a pending value */
+    uint32_t rejected;      /*!< commands dropped because the ring was full */
+    uint32_t executed;      /*!< commands handed out by actq_pop() */
+    uint32_t depth;         /*!< targets currently on the ring */
+    uint32_t max_depth;     /*!< highest depth seen */
+} actq_stats_t;
+
+typedef struct {
+    uint32_t head;                          // next ring slot to write, owned by the producer
+    uint32_t tail;                          // next ring slot to read, owned by the consumer
+    uint8_t ring[ACTQ_RING_SIZE];
+    uint32_t value[ACTQ_MAX_TARGETS];       // latest submitted value per target
+    uint8_t pending[ACTQ_MAX_TARGETS];      // set while the target's value has not been handed out
+    actq_stats_t stats;
+} actq_t;
+
+/**
+ * @brief Empties a queue and clears its counters
+ */
+void actq_init(actq_t *q);
+
+/**
+ * @brief Submits the latest value for a target, producer side
+ *
+ * @param q queue
+ * @param target target index, below ACTQ_MAX_TARGETS
+ * @param value value
+ * @return ACTQ_QUEUED or ACTQ_COALESCED if accepted
+ */
+actq_result_t actq_push(actq_t *q, uint8_t target, uint32_t value);
+
+/**
+ * @brief Submits the latest values for several targets, all of them or none, producer side
+ *
+ * Room is checked for every target before any value is written, counting
+ * each one as needing a ring slot, so the pushes that follow cannot fail.
+ *
+ * @param q queue
+ * @param targets distinct target indexes, below ACTQ_MAX_TARGETS
+ * @param values value of each target
+ * @param count number of targets
+ * @return true if every value was accepted, false if none was
+ */
+bool actq_push_all(actq_t *q, const uint8_t *targets, const uint32_t *values, size_t count);
+
+/**
+ * @brief Takes the next pending target and its latest value, consumer side
+ *
+ * @return false if nothing is pending
+ */
+bool actq_pop(actq_t *q, uint8_t *target, uint32_t *value);
+
+/**
+ * @brief Gets a snapshot of the counters
+ */
+void actq_get_stats(const actq_t *q, actq_stats_t *out);
@@ -0,0 +1,135 @@
+/* Static web asset metadata
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "assets.h"
+
+static const struct {
+    const char *ext;
+    const char *type;
+} CONTENT_TYPES[] = {
+    { ".html", "text/html" },
+    { ".js", "application/javascript" },
+    { ".css", "text/css" },
+    { ".png", "image/png" },
+    { ".ico", "image/x-icon" },
+    { ".svg", "image/svg+xml" },
+    { ".json", "application/json" },
+};
+
+static asset_t *assets;
+static size_t asset_count;
+
+const char *assets_content_type(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (ext) {
+        for (size_t i = 0; i < sizeof(CONTENT_TYPES) / sizeof(CONTENT_TYPES[0]); ++i) {
+            if (strcasecmp(ext, CONTENT_TYPES[i].ext) == 0) {
+                return CONTENT_TYPES[i].type;
+            }
+        }
+    }
+    return "text/plain";
+}
+
+static void assets_free(void)
+{
+    for (size_t i = 0; i < asset_count; ++i) {
+        free((void *)assets[i].path);
+    }
+    free(assets);
+    assets = NULL;
+    asset_count = 0;
+}
+
+static int asset_cmp(const void *a, const void *b)
+{
+    return strcmp(((const asset_t *)a)->path, ((const asset_t *)b)->path);
+}
+
+int assets_load_manifest(const char *manifest_path)
+{
+    FILE *f = fopen(manifest_path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    assets_free();
+
+    char line[160];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char etag[ASSETS_ETAG_MAX_LEN + 1], flags[8], path[128];
+        if (sscanf(line, "%32s %7s %127s", etag, flags, path) != 3) {
+            continue;
+        }
+        if (asset_count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            asset_t *grown = realloc(assets, capacity * sizeof(asset_t));
+            if (grown == NULL) {
+                break;
+            }
+            assets = grown;
+        }
+        asset_t *asset = &assets[asset_count];
+        char *copy = strdup(path);
+        if (copy == NULL) {
+            break;
+        }
+        asset->path = copy;
+        snprintf(asset->etag, sizeof(asset->etag), "\"%s\"", etag);
+        snprintf(asset->gzip_etag, sizeof(asset->gzip_etag), "\"%s-gz\"", etag);
+        asset->content_type = assets_content_type(path);
+        asset->gzip = strchr(flags, 'g') != NULL;
+        asset->immutable = strchr(flags, 'i') != NULL;
+        asset_count++;
+    }
+    fclose(f);
+
+    qsort(assets, asset_count, sizeof(asset_t), asset_cmp);
+    return asset_count;
+}
+
+const asset_t *assets_find(const char *path, size_t len)
+{
+    size_t lo = 0, hi = asset_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = strncmp(assets[mid].path, path, len);
+        if (cmp == 0 && assets[mid].path[len] != '\0') {
+            cmp = 1;
+        }
+        if (cmp == 0) {
+            return &assets[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+bool assets_etag_matches(const char *etag, const char *if_none_match)
+{
+    if (strcmp(if_none_match, "*") == 0) {
+        return true;
+    }
+    // Weak comparison: a W/ prefix does not matter for GET
+    size_t etag_len = strlen(etag);
+    for (const char *p = strstr(if_none_match, etag); p; p = strstr(p + 1, etag)) {
+        char next = p[etag_len];
+        if (next == '\0' || next == ',' || next == ' ') {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,56 @@
+/* Static web asset metadata
+
+   Loads the asset manifest written by front/controls-ui/scripts/compress-dist.js
+   once at start-up, so serving a file needs no per-request work to find its
+   content type, ETag, gzip variant or cache policy.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ASSETS_MANIFEST_NAME    "asset-manifest.txt"
+#define ASSETS_ETAG_MAX_LEN     32
+
+typedef struct {
+    const char *path;                       /*!< URI path, e.g. "/output.html" */
+    char etag[ASSETS_ETAG_MAX_LEN + 3];     /*!< quoted entity tag, ready for the ETag header */
+    char gzip_etag[ASSETS_ETAG_MAX_LEN + 6];    /*!< tag of the gzip variant, whose bytes differ */
+    const char *content_type;               /*!< MIME type derived from the extension */
+    bool gzip;                              /*!< a precompressed "<path>.gz" sibling exists */
+    bool immutable;                         /*!< the name carries a content hash */
+} asset_t;
+
+/**
+ * @brief Loads the manifest, replacing any previously loaded one
+ *
+ * @param manifest_path path of the manifest file
+ * @return number of assets loaded, or -1 if the manifest could not be read
+ */
+int assets_load_manifest(const char *manifest_path);
+
+/**
+ * @brief Looks up an asset by URI path
+ *
+ * @param path URI path without query string
+ * @param len length of path
+ * @return asset, or NULL if it is not in the manifest
+ */
+const asset_t *assets_find(const char *path, size_t len);
+
+/**
+ * @brief Maps a file name to its MIME type by extension
+ *
+ * @param path file name or path
+ * @return MIME type, "text/plain" if unknown
+ */
+const char *assets_content_type(const char *path);
+
+/**
+ * @brief Checks whether an If-None-Match header value matches an ETag
+ *
+ * @param etag quoted tag of the variant being served, asset->etag or asset->gzip_etag
+ * @param if_none_match header value, may list several tags or be "*"
+ * @return true if the client's cached copy is still valid
+ */
+bool assets_etag_matches(const char *etag, const char *if_none_match);
@@ -0,0 +1,42 @@
+/* Preallocated, refcounted broadcast messages
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "broadcast.h"
+
+static broadcast_msg_t pool[BROADCAST_POOL_SIZE];
+static broadcast_stats_t stats;
+
+broadcast_msg_t *broadcast_msg_alloc(void)
+{
+    for (int i = 0; i < BROADCAST_POOL_SIZE; ++i) {
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&pool[i].refcount, &expected, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&stats.published, 1, __ATOMIC_RELAXED);
+            return &pool[i];
+        }
+    }
+    __atomic_fetch_add(&stats.pool_exhausted, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void broadcast_msg_ref(broadcast_msg_t *msg)
+{
+    __atomic_fetch_add(&msg->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void broadcast_msg_unref(broadcast_msg_t *msg)
+{
+    __atomic_fetch_sub(&msg->refcount, 1, __ATOMIC_RELEASE);
+}
+
+void broadcast_get_stats(broadcast_stats_t *out)
+{
+    out->published = __atomic_load_n(&stats.published, __ATOMIC_RELAXED);
+    out->pool_exhausted = __atomic_load_n(&stats.pool_exhausted, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,55 @@
+/* Preallocated, refcounted broadcast messages
+
+   A state change is formatted once into a message taken from a fixed pool and
+   shared by every consumer that fans it out (WebSocket clients and the like).
+   Each consumer holds a reference; the slot returns to the pool when the last
+   one is dropped. Publishing never touches the heap.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "protocol.h"
+
+#define BROADCAST_POOL_SIZE 8
+
+typedef struct {
+    uint32_t refcount;          /*!< accessed atomically, 0 = free slot */
+    proto_update_t update;      /*!< the message in every encoding */
+} broadcast_msg_t;
+
+/**
+ * @brief Broadcast counters
+ */
+typedef struct {
+    uint32_t published;         /*!< messages taken from the pool */
+    uint32_t pool_exhausted;    /*!< messages dropped because every slot was in use */
+} broadcast_stats_t;
+
+/**
+ * @brief Takes a free message from the pool, with one reference held by the caller
+ *
+ * @return message, or NULL if the pool is exhausted
+ */
+broadcast_msg_t *broadcast_msg_alloc(void);
+
+/**
+ * @brief Adds a reference to a message
+ *
+ * @param msg message
+ */
+void broadcast_msg_ref(broadcast_msg_t *msg);
+
+/**
+ * @brief Drops a reference, returning the message to the pool when it was the last one
+ *
+ * @param msg message
+ */
+void broadcast_msg_unref(broadcast_msg_t *msg);
+
+/**
+ * @brief Gets a snapshot of the broadcast counters
+ *
+ * @param stats output
+ */
+void broadcast_get_stats(broadcast_stats_t *stats);
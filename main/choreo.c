@@ -0,0 +1,178 @@
+/* Keyframe choreography
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "choreo.h"
+#include "led.h"
+#include "servo.h"
+
+static const char *TAG = "choreo";
+
+typedef enum {
+    KF_LED,         // a = duty, b = unused, fade_ms
+    KF_VISOR,       // a = state
+    KF_POSE,        // a = top degree, b = bottom degree
+    KF_EFFECT,      // a = led_effect_t, b = level, fade_ms = period
+} keyframe_type_t;
+
+typedef struct {
+    uint16_t at_ms;         // from the start of the sequence
+    uint8_t type;
+    uint8_t a;
+    uint8_t b;
+    uint16_t fade_ms;
+} keyframe_t;
+
+typedef struct {
+    const char *name;
+    const keyframe_t *keyframes;
+    uint8_t count;
+} sequence_t;
+
+#define LED(at, duty, fade)     { .at_ms = (at), .type = KF_LED, .a = (duty), .fade_ms = (fade) }
+#define VISOR(at, state)        { .at_ms = (at), .type = KF_VISOR, .a = (state) }
+#define POSE(at, top, bottom)   { .at_ms = (at), .type = KF_POSE, .a = (top), .b = (bottom) }
+#define EFFECT(at, fx, level, period) \
+    { .at_ms = (at), .type = KF_EFFECT, .a = (fx), .b = (level), .fade_ms = (period) }
+
+/* Keyframes are sorted by time */
+static const keyframe_t SEQ_CLOSE[] = {
+    LED(0, 20, 300),
+    VISOR(300, 0),
+    LED(1600, 255, 120),
+    LED(1800, 180, 600),
+};
+
+static const keyframe_t SEQ_OPEN[] = {
+    LED(0, 0, 200),
+    // Unseal: ease the faceplate just off the closed pose and hold it there before lifting
+    POSE(200, 75, 20),
+    VISOR(800, 1),
+    LED(2500, 255, 900),
+};
+
+static const keyframe_t SEQ_FLARE[] = {
+    LED(0, 255, 60),
+    LED(120, 40, 150),
+    LED(300, 255, 60),
+    LED(420, 180, 400),
+};
+
+static const keyframe_t SEQ_BREATHE[] = {
+    EFFECT(0, LED_EFFECT_BREATHE, 255, 4000),
+};
+
+static const keyframe_t SEQ_DAMAGED[] = {
+    EFFECT(0, LED_EFFECT_FLICKER, 220, 120),
+};
+
+static const keyframe_t SEQ_ALERT[] = {
+    EFFECT(0, LED_EFFECT_PULSE, 255, 1000),
+};
+
+#define SEQUENCE(n, kf) { .name = (n), .keyframes = (kf), .count = sizeof(kf) / sizeof((kf)[0]) }
+
+static const sequence_t SEQUENCES[] = {
+    SEQUENCE("close", SEQ_CLOSE),
+    SEQUENCE("open", SEQ_OPEN),
+    SEQUENCE("flare", SEQ_FLARE),
+    SEQUENCE("breathe", SEQ_BREATHE),
+    SEQUENCE("damaged", SEQ_DAMAGED),
+    SEQUENCE("alert", SEQ_ALERT),
+};
+
+#define SEQUENCE_COUNT (sizeof(SEQUENCES) / sizeof(SEQUENCES[0]))
+
+static TaskHandle_t choreo_task_handle;
+static choreo_state_cb_t state_cb;
+
+static void apply_keyframe(const keyframe_t *kf)
+{
+    switch (kf->type) {
+        case KF_LED:
+            led_set_duty(kf->a, kf->fade_ms);
+            if (state_cb) {
+                state_cb(PROTO_FIELD_LED, kf->a);
+            }
+            break;
+        case KF_VISOR:
+            visor_set_state(kf->a);
+            if (state_cb) {
+                state_cb(PROTO_FIELD_VISOR, kf->a);
+            }
+            break;
+        case KF_POSE:
+            servo_set_pose(kf->a, kf->b);
+            break;
+        case KF_EFFECT:
+            led_set_effect(kf->a, kf->b, kf->fade_ms);
+            break;
+    }
+}
+
+/*
+ * Waits for a trigger, then plays the sequence. Each keyframe is due at a
+ * fixed offset from the start tick, so late keyframes do not push the later
+ * ones back. A new trigger arriving meanwhile preempts the sequence.
+ */
+static void choreo_task(void *arg)
+{
+    uint32_t trigger = 0;
+    while (true) {
+        if (trigger == 0) {
+            xTaskNotifyWait(0, UINT32_MAX, &trigger, portMAX_DELAY);
+            continue;
+        }
+        const sequence_t *seq = &SEQUENCES[trigger - 1];
+        trigger = 0;
+        ESP_LOGI(TAG, "Playing \"%s\"", seq->name);
+
+        TickType_t start = xTaskGetTickCount();
+        for (size_t i = 0; i < seq->count; ++i) {
+            const keyframe_t *kf = &seq->keyframes[i];
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            TickType_t due = pdMS_TO_TICKS(kf->at_ms);
+            if (due > elapsed && xTaskNotifyWait(0, UINT32_MAX, &trigger, due - elapsed) == pdTRUE) {
+                ESP_LOGI(TAG, "\"%s\" preempted", seq->name);
+                break;
+            }
+            apply_keyframe(kf);
+        }
+    }
+}
+
+esp_err_t choreo_init(choreo_state_cb_t cb)
+{
+    state_cb = cb;
+    if (choreo_task_handle) {
+        return ESP_OK;
+    }
+    if (xTaskCreate(choreo_task, "choreo", CONFIG_MK3_CHOREO_TASK_STACK_SIZE, NULL,
+                    CONFIG_MK3_CHOREO_TASK_PRIORITY, &choreo_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the choreography task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool choreo_run(uint8_t id)
+{
+    if (id >= SEQUENCE_COUNT || choreo_task_handle == NULL) {
+        return false;
+    }
+    // Stored as id + 1 so that 0 means no trigger
+    xTaskNotify(choreo_task_handle, id + 1, eSetValueWithOverwrite);
+    return true;
+}
+
+uint8_t choreo_sequence_count(void)
+{
+    return SEQUENCE_COUNT;
+}
@@ -0,0 +1,51 @@
+/* Keyframe choreography
+
+   Plays stored sequences of LED fades and servo moves from a single task, on
+   a timeline anchored at the moment the sequence starts, so effects run with
+   the same timing every time and without a network round trip per step.
+
+   Stored sequences:
+     0  close   eyes dim, visor closes, eyes flare
+     1  open    eyes go dark, visor opens, eyes fade in
+     2  flare   double flash of the eyes
+     3  breathe eyes breathe slowly, until the next LED command
+     4  damaged eyes flicker, until the next LED command
+     5  alert   eyes pulse once a second, until the next LED command
+
+   Starting a sequence preempts the one playing. Direct LED and visor
+   commands are not blocked and interleave with a playing sequence.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "protocol.h"
+
+/**
+ * @brief Reports a persistent field changed by a sequence, e.g. to store and broadcast it
+ *
+ * Called from the choreography task.
+ */
+typedef void (*choreo_state_cb_t)(proto_field_t field, uint8_t val);
+
+/**
+ * @brief Starts the choreography task, or only replaces the callback if already started
+ *
+ * @param state_cb called for every LED or visor keyframe, may be NULL
+ * @return ESP_OK on success
+ */
+esp_err_t choreo_init(choreo_state_cb_t state_cb);
+
+/**
+ * @brief Starts a stored sequence, returns immediately
+ *
+ * @param id sequence number
+ * @return false if there is no such sequence
+ */
+bool choreo_run(uint8_t id);
+
+/**
+ * @brief Gets the number of stored sequences
+ */
+uint8_t choreo_sequence_count(void);
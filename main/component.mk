@@ -3,5 +3,16 @@
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
+ifdef CONFIG_MK3_TLS_PROFILE_ECDSA_P256
+COMPONENT_EMBED_TXTFILES := certs/ecdsa/cacert.pem
+COMPONENT_EMBED_TXTFILES += certs/ecdsa/prvtkey.pem
+else
 COMPONENT_EMBED_TXTFILES := certs/cacert.pem
-COMPONENT_EMBED_TXTFILES += certs/prvtkey.pem
\ No newline at end of file
+COMPONENT_EMBED_TXTFILES += certs/prvtkey.pem
+endif
+
+# TLS hooks, see tls_server.c
+COMPONENT_ADD_LDFLAGS += -Wl,--wrap=esp_tls_server_session_create -Wl,--wrap=mbedtls_ssl_setup
+ifdef CONFIG_MK3_TLS_SESSION_TICKETS
+COMPONENT_ADD_LDFLAGS += -Wl,--wrap=mbedtls_ssl_ticket_parse
+endif
@@ -17,15 +17,16 @@
 #include "mdns.h"
 #include "lwip/apps/netbiosns.h"
 #include "protocol_examples_common.h"
+#include "storage.h"
+#include "www_image.h"
+#include "servo.h"
+#include "led.h"
 
 #define MDNS_INSTANCE "iron man control server"
 
 static const char *TAG = "example";
 
 esp_err_t start_rest_server(const char *base_path);
-void init_servo(void);
-void init_led(void);
-esp_err_t init_nvs();
 
 static void initialise_mdns(void)
 {
@@ -44,6 +45,10 @@ static void initialise_mdns(void)
 
 esp_err_t init_fs(void)
 {
+#if CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+    // Served from mapped flash, no filesystem to mount
+    return www_image_mount("www");
+#else
     esp_vfs_spiffs_conf_t conf = {
         .base_path = CONFIG_EXAMPLE_WEB_MOUNT_POINT,
         .partition_label = NULL,
@@ -68,9 +73,10 @@ esp_err_t init_fs(void)
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
     } else {
-        ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+        ESP_LOGI(TAG, "Partition size: total: %u, used: %u", (unsigned)total, (unsigned)used);
     }
     return ESP_OK;
+#endif
 }
 
 void app_main(void)
@@ -0,0 +1,330 @@
+/* Streaming JSON reader for fixed request schemas
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "json_stream.h"
+
+/* Nesting allowed inside skipped values */
+#define MAX_SKIP_DEPTH 32
+
+enum {
+    ST_OBJECT_START,    // before the opening brace
+    ST_KEY_OR_END,      // after the opening brace
+    ST_KEY_START,       // after a comma
+    ST_KEY,
+    ST_COLON,
+    ST_VALUE,
+    ST_STRING,          // string value, always skipped
+    ST_NUMBER,
+    ST_LITERAL,         // true, false or null
+    ST_NESTED,          // object or array value, always skipped
+    ST_AFTER_VALUE,
+    ST_DONE,
+};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static void end_key(json_stream_t *js)
+{
+    js->field = -1;
+    if (js->key_len > JSON_KEY_MAX_LEN) {
+        return;
+    }
+    js->key[js->key_len] = '\0';
+    for (size_t i = 0; i < js->field_count; ++i) {
+        if (strcmp(js->fields[i].key, js->key) == 0) {
+            js->field = i;
+            return;
+        }
+    }
+}
+
+static json_err_t store_value(json_stream_t *js, int64_t val)
+{
+    const json_field_t *f = &js->fields[js->field];
+    void *member = (char *)js->out + f->offset;
+    if (f->type == JSON_FIELD_BOOL) {
+        if (val != 0 && val != 1) {
+            return JSON_ERR_RANGE;
+        }
+        *(bool *)member = val;
+    } else {
+        if (val < f->min || val > f->max) {
+            return JSON_ERR_RANGE;
+        }
+        *(int32_t *)member = val;
+    }
+    js->seen |= 1u << js->field;
+    return JSON_OK;
+}
+
+static json_err_t commit_number(json_stream_t *js)
+{
+    if (js->digits == 0) {
+        return JSON_ERR_SYNTAX;
+    }
+    if (js->field < 0) {
+        return JSON_OK;
+    }
+    if (!js->integral) {
+        return JSON_ERR_TYPE;
+    }
+    if (js->overflow) {
+        return JSON_ERR_RANGE;
+    }
+    return store_value(js, js->negative ? -js->number : js->number);
+}
+
+static json_err_t commit_literal(json_stream_t *js)
+{
+    js->literal[js->literal_len] = '\0';
+    bool is_true = strcmp(js->literal, "true") == 0;
+    if (!is_true && strcmp(js->literal, "false") != 0 && strcmp(js->literal, "null") != 0) {
+        return JSON_ERR_SYNTAX;
+    }
+    if (js->field < 0) {
+        return JSON_OK;
+    }
+    if (js->fields[js->field].type != JSON_FIELD_BOOL || js->literal[0] == 'n') {
+        return JSON_ERR_TYPE;
+    }
+    return store_value(js, is_true);
+}
+
+// Tracks escapes inside a string, returns true on its closing quote
+static bool string_ends(json_stream_t *js, char c)
+{
+    if (js->escape) {
+        js->escape = false;
+    } else if (c == '\\') {
+        js->escape = true;
+    } else if (c == '"') {
+        return true;
+    }
+    return false;
+}
+
+static json_err_t begin_value(json_stream_t *js, char c)
+{
+    if (c == '"' || c == '{' || c == '[') {
+        if (js->field >= 0) {
+            return JSON_ERR_TYPE;
+        }
+        js->escape = false;
+        js->in_string = false;
+        js->depth = 1;
+        js->state = c == '"' ? ST_STRING : ST_NESTED;
+    } else if (c == '-' || is_digit(c)) {
+        js->negative = c == '-';
+        js->number = js->negative ? 0 : c - '0';
+        js->digits = js->negative ? 0 : 1;
+        js->overflow = false;
+        js->integral = true;
+        js->state = ST_NUMBER;
+    } else if (c >= 'a' && c <= 'z') {
+        js->literal[0] = c;
+        js->literal_len = 1;
+        js->state = ST_LITERAL;
+    } else {
+        return JSON_ERR_SYNTAX;
+    }
+    return JSON_OK;
+}
+
+// Handles one character, clearing *consumed if it belongs to the next token
+static json_err_t step(json_stream_t *js, char c, bool *consumed)
+{
+    switch (js->state) {
+        case ST_OBJECT_START:
+        case ST_KEY_OR_END:
+        case ST_KEY_START:
+        case ST_COLON:
+        case ST_VALUE:
+        case ST_AFTER_VALUE:
+        case ST_DONE:
+            if (is_space(c)) {
+                return JSON_OK;
+            }
+            break;
+        default:
+            break;
+    }
+
+    switch (js->state) {
+        case ST_OBJECT_START:
+            if (c != '{') {
+                return JSON_ERR_SYNTAX;
+            }
+            js->state = ST_KEY_OR_END;
+            return JSON_OK;
+        case ST_KEY_OR_END:
+            if (c == '}') {
+                js->state = ST_DONE;
+                return JSON_OK;
+            }
+            // fall through
+        case ST_KEY_START:
+            if (c != '"') {
+                return JSON_ERR_SYNTAX;
+            }
+            js->key_len = 0;
+            js->escape = false;
+            js->state = ST_KEY;
+            return JSON_OK;
+        case ST_KEY:
+            if ((unsigned char)c < 0x20) {
+                return JSON_ERR_SYNTAX;
+            }
+            if (!js->escape && c == '"') {
+                end_key(js);
+                js->state = ST_COLON;
+            } else if (js->escape || c == '\\') {
+                // Schema keys have no escapes, so an escaped key never matches
+                js->escape = !js->escape;
+                js->key_len = JSON_KEY_MAX_LEN + 1;
+            } else if (js->key_len <= JSON_KEY_MAX_LEN) {
+                js->key[js->key_len++] = c;
+            }
+            return JSON_OK;
+        case ST_COLON:
+            if (c != ':') {
+                return JSON_ERR_SYNTAX;
+            }
+            js->state = ST_VALUE;
+            return JSON_OK;
+        case ST_VALUE:
+            return begin_value(js, c);
+        case ST_STRING:
+            if ((unsigned char)c < 0x20) {
+                return JSON_ERR_SYNTAX;
+            }
+            if (string_ends(js, c)) {
+                js->state = ST_AFTER_VALUE;
+            }
+            return JSON_OK;
+        case ST_NESTED:
+            if (js->in_string) {
+                js->in_string = !string_ends(js, c);
+            } else if (c == '"') {
+                js->in_string = true;
+            } else if (c == '{' || c == '[') {
+                if (++js->depth > MAX_SKIP_DEPTH) {
+                    return JSON_ERR_SYNTAX;
+                }
+            } else if (c == '}' || c == ']') {
+                if (--js->depth == 0) {
+                    js->state = ST_AFTER_VALUE;
+                }
+            }
+            return JSON_OK;
+        case ST_NUMBER:
+            if (is_digit(c)) {
+                if (js->integral && !js->overflow) {
+                    js->number = js->number * 10 + (c - '0');
+                    js->overflow = js->number > (int64_t)INT32_MAX + 1;
+                }
+                js->digits += js->digits < UINT8_MAX;
+                return JSON_OK;
+            }
+            if (c == '.' || c == 'e' || c == 'E' || ((c == '+' || c == '-') && !js->integral)) {
+                js->integral = false;
+                return JSON_OK;
+            }
+            *consumed = false;
+            js->state = ST_AFTER_VALUE;
+            return commit_number(js);
+        case ST_LITERAL:
+            if (c >= 'a' && c <= 'z') {
+                if (js->literal_len >= sizeof(js->literal) - 1) {
+                    return JSON_ERR_SYNTAX;
+                }
+                js->literal[js->literal_len++] = c;
+                return JSON_OK;
+            }
+            *consumed = false;
+            js->state = ST_AFTER_VALUE;
+            return commit_literal(js);
+        case ST_AFTER_VALUE:
+            if (c == ',') {
+                js->state = ST_KEY_START;
+            } else if (c == '}') {
+                js->state = ST_DONE;
+            } else {
+                return JSON_ERR_SYNTAX;
+            }
+            return JSON_OK;
+        case ST_DONE:
+        default:
+            return JSON_ERR_SYNTAX;
+    }
+}
+
+void json_stream_init(json_stream_t *js, const json_field_t *fields, size_t field_count, void *out)
+{
+    memset(js, 0, sizeof(*js));
+    js->fields = fields;
+    js->field_count = field_count;
+    js->out = out;
+    js->field = -1;
+    js->state = ST_OBJECT_START;
+}
+
+json_err_t json_stream_feed(json_stream_t *js, const char *buf, size_t len)
+{
+    size_t i = 0;
+    while (js->err == JSON_OK && i < len) {
+        bool consumed = true;
+        js->err = step(js, buf[i], &consumed);
+        i += consumed;
+    }
+    return js->err;
+}
+
+json_err_t json_stream_finish(json_stream_t *js)
+{
+    if (js->err != JSON_OK) {
+        return js->err;
+    }
+    if (js->state != ST_DONE) {
+        return js->err = JSON_ERR_INCOMPLETE;
+    }
+    for (size_t i = 0; i < js->field_count; ++i) {
+        if (js->fields[i].required && !(js->seen & (1u << i))) {
+            return js->err = JSON_ERR_MISSING;
+        }
+    }
+    return JSON_OK;
+}
+
+const char *json_strerror(json_err_t err)
+{
+    switch (err) {
+        case JSON_OK:
+            return "ok";
+        case JSON_ERR_SYNTAX:
+            return "malformed JSON";
+        case JSON_ERR_TYPE:
+            return "field has the wrong type";
+        case JSON_ERR_RANGE:
+            return "field out of range";
+        case JSON_ERR_MISSING:
+            return "required field missing";
+        case JSON_ERR_INCOMPLETE:
+            return "truncated JSON";
+        default:
+            return "invalid JSON";
+    }
+}
@@ -0,0 +1,99 @@
+/* Streaming JSON reader for fixed request schemas
+
+   Parses a flat JSON object fed in arbitrary chunks, as they come out of
+   httpd_req_recv(), and stores the fields listed in a schema directly into a
+   caller-provided struct. The whole state lives in json_stream_t, so parsing
+   needs no heap and only as much stack as the receive buffer. No ESP-IDF
+   dependencies, so it also builds on the host.
+
+   Schema fields are integers or booleans. Unknown keys are skipped whatever
+   their value, including nested objects and arrays.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest key that can match a schema field; longer keys are skipped */
+#define JSON_KEY_MAX_LEN    31
+
+typedef enum {
+    JSON_OK = 0,
+    JSON_ERR_SYNTAX,        /*!< not a well-formed JSON object */
+    JSON_ERR_TYPE,          /*!< a schema field has a value of the wrong type */
+    JSON_ERR_RANGE,         /*!< a schema field is out of its range */
+    JSON_ERR_MISSING,       /*!< a required schema field is absent */
+    JSON_ERR_INCOMPLETE,    /*!< input ended before the object was closed */
+} json_err_t;
+
+typedef enum {
+    JSON_FIELD_INT,         /*!< stored as int32_t */
+    JSON_FIELD_BOOL,        /*!< stored as bool, accepts true/false and 0/1 */
+} json_field_type_t;
+
+/**
+ * @brief One field of a schema
+ */
+typedef struct {
+    const char *key;        /*!< object key */
+    json_field_type_t type; /*!< value type */
+    size_t offset;          /*!< offsetof() the member receiving the value */
+    int32_t min;            /*!< smallest accepted value, JSON_FIELD_INT only */
+    int32_t max;            /*!< largest accepted value, JSON_FIELD_INT only */
+    bool required;          /*!< fail with JSON_ERR_MISSING if absent */
+} json_field_t;
+
+/**
+ * @brief Parser state, opaque to callers
+ */
+typedef struct {
+    const json_field_t *fields;
+    size_t field_count;
+    void *out;
+    uint32_t seen;
+    uint8_t state;
+    uint8_t depth;
+    bool in_string;
+    bool escape;
+    int8_t field;
+    uint8_t key_len;
+    char key[JSON_KEY_MAX_LEN + 1];
+    bool negative;
+    bool overflow;
+    bool integral;
+    uint8_t digits;
+    int64_t number;
+    char literal[6];
+    uint8_t literal_len;
+    json_err_t err;
+} json_stream_t;
+
+/**
+ * @brief Prepares a parser
+ *
+ * @param js parser state
+ * @param fields schema, at most 32 fields
+ * @param field_count number of fields
+ * @param out struct receiving the values, untouched for absent fields
+ */
+void json_stream_init(json_stream_t *js, const json_field_t *fields, size_t field_count, void *out);
+
+/**
+ * @brief Parses the next chunk of input
+ *
+ * @return JSON_OK, or the first error; further input is then ignored
+ */
+json_err_t json_stream_feed(json_stream_t *js, const char *buf, size_t len);
+
+/**
+ * @brief Ends the input and checks required fields
+ *
+ * @return JSON_OK if a complete object holding every required field was parsed
+ */
+json_err_t json_stream_finish(json_stream_t *js);
+
+/**
+ * @brief Gets a short description of an error, suitable for an HTTP response
+ */
+const char *json_strerror(json_err_t err);
@@ -7,100 +7,101 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <sys/param.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
+#include "lwip/sockets.h"
 #include "keep_alive.h"
+#include "keep_alive_core.h"
+#include "metrics.h"
+
+// Longest sleep when no client is tracked, and retry delay for pings that could not be queued
+#define KEEP_ALIVE_IDLE_DELAY_MS    30000
+#define KEEP_ALIVE_RETRY_MS         1000
 
 typedef enum {
     NO_CLIENT = 0,
     CLIENT_FD_ADD,
     CLIENT_FD_REMOVE,
-    CLIENT_UPDATE,
-    CLIENT_ACTIVE,
     STOP_TASK,
 } client_fd_action_type_t;
 
 typedef struct {
     client_fd_action_type_t type;
     int fd;
-    uint64_t last_seen;
 } client_fd_action_t;
 
 typedef struct wss_keep_alive_storage {
     size_t max_clients;
-    wss_check_client_alive_cb_t check_client_alive_cb;
-    wss_check_client_alive_cb_t client_not_alive_cb;
-    size_t keep_alive_period_ms;
-    size_t not_alive_after_ms;
+    wss_check_clients_alive_cb_t check_clients_alive_cb;
+    wss_client_not_alive_cb_t client_not_alive_cb;
     void * user_ctx;
     QueueHandle_t q;
-    client_fd_action_t clients[];
+    ka_core_t *core;
+    int *ping_fds;
+    int *dead_fds;
 } wss_keep_alive_storage_t;
 
 typedef struct wss_keep_alive_storage* wss_keep_alive_t;
 
 static const char *TAG = "wss_keep_alive";
 
-static uint64_t _tick_get_ms(void)
+static uint32_t _tick_get_ms(void)
 {
     return esp_timer_get_time()/1000;
 }
 
-// Goes over active clients to find out how long we could sleep before checking who's alive
-static uint64_t get_max_delay(wss_keep_alive_t h)
+static void handle_client_action(wss_keep_alive_t h, const client_fd_action_t *client_action, uint32_t now)
 {
-    int64_t check_after_ms = 30000; // max delay, no need to check anyone
-    for (int i=0; i<h->max_clients; ++i) {
-        if (h->clients[i].type == CLIENT_ACTIVE) {
-            uint64_t check_this_client_at = h->clients[i].last_seen + h->keep_alive_period_ms;
-            if (check_this_client_at < check_after_ms + _tick_get_ms()) {
-                check_after_ms = check_this_client_at - _tick_get_ms();
-                if (check_after_ms < 0) {
-                    check_after_ms = 1000; // min delay, some client(s) not responding already
-                }
+    switch (client_action->type) {
+        case CLIENT_FD_ADD:
+            if (!ka_core_add(h->core, client_action->fd, now)) {
+                ESP_LOGE(TAG, "Cannot add new client");
             }
-        }
+            break;
+        case CLIENT_FD_REMOVE:
+            if (!ka_core_remove(h->core, client_action->fd)) {
+                ESP_LOGE(TAG, "Cannot remove client fd:%d", client_action->fd);
+            }
+            break;
+        default:
+            ESP_LOGE(TAG, "Unexpected client action");
+            break;
     }
-    return check_after_ms;
 }
 
-
-static bool update_client(wss_keep_alive_t h, int sockfd, uint64_t timestamp)
+static void handle_due_clients(wss_keep_alive_t h, uint32_t now)
 {
-    for (int i=0; i<h->max_clients; ++i) {
-        if (h->clients[i].type == CLIENT_ACTIVE && h->clients[i].fd == sockfd) {
-            h->clients[i].last_seen = timestamp;
-            return true;
-        }
-    }
-    return false;
-}
+    size_t ping_count, dead_count;
+    ka_core_collect_due(h->core, now, h->ping_fds, &ping_count, h->dead_fds, &dead_count);
 
-static bool remove_client(wss_keep_alive_t h, int sockfd)
-{
-    for (int i=0; i<h->max_clients; ++i) {
-        if (h->clients[i].type == CLIENT_ACTIVE && h->clients[i].fd == sockfd) {
-            h->clients[i].type = NO_CLIENT;
-            h->clients[i].fd = -1;
-            return true;
+    for (size_t i = 0; i < dead_count; ++i) {
+        ESP_LOGE(TAG, "Client (fd=%d) not alive!", h->dead_fds[i]);
+        h->client_not_alive_cb(h, h->dead_fds[i]);
+    }
+    if (ping_count > 0) {
+        ESP_LOGD(TAG, "Haven't seen %u client(s) for a while", (unsigned)ping_count);
+        if (!h->check_clients_alive_cb(h, h->ping_fds, ping_count)) {
+            for (size_t i = 0; i < ping_count; ++i) {
+                ka_core_defer(h->core, h->ping_fds[i], now + KEEP_ALIVE_RETRY_MS);
+            }
         }
     }
-    return false;
 }
-static bool add_new_client(wss_keep_alive_t h,int sockfd)
+
+static esp_err_t send_client_action(wss_keep_alive_t h, client_fd_action_type_t type, int fd)
 {
-    for (int i=0; i<h->max_clients; ++i) {
-        if (h->clients[i].type == NO_CLIENT) {
-            h->clients[i].type = CLIENT_ACTIVE;
-            h->clients[i].fd = sockfd;
-            h->clients[i].last_seen = _tick_get_ms();
-            return true; // success
-        }
+    client_fd_action_t client_fd_action = { .fd = fd, .type = type };
+    if (xQueueSendToBack(h->q, &client_fd_action, 0) == pdTRUE) {
+        return ESP_OK;
     }
-    return false;
+    ESP_LOGE(TAG, "Queue full, cannot %s client fd:%d", type == CLIENT_FD_ADD ? "add" : "remove", fd);
+    metrics_inc(METRIC_KEEP_ALIVE_QUEUE_FULL);
+    return ESP_FAIL;
 }
 
 static void keep_alive_task(void* arg)
@@ -109,49 +110,19 @@ static void keep_alive_task(void* arg)
     bool run_task = true;
     client_fd_action_t client_action;
     while (run_task) {
-        if (xQueueReceive(keep_alive_storage->q, (void *) &client_action,
-                get_max_delay(keep_alive_storage) / portTICK_PERIOD_MS) == pdTRUE) {
-            switch (client_action.type) {
-                case CLIENT_FD_ADD:
-                    if (!add_new_client(keep_alive_storage, client_action.fd)) {
-                        ESP_LOGE(TAG, "Cannot add new client");
-                    }
-                    break;
-                case CLIENT_FD_REMOVE:
-                    if (!remove_client(keep_alive_storage, client_action.fd)) {
-                        ESP_LOGE(TAG, "Cannot remove client fd:%d", client_action.fd);
-                    }
-                    break;
-                case CLIENT_UPDATE:
-                    if (!update_client(keep_alive_storage, client_action.fd, client_action.last_seen)) {
-                        ESP_LOGE(TAG, "Cannot find client fd:%d", client_action.fd);
-                    }
-                    break;
-                case STOP_TASK:
-                    run_task = false;
-                    break;
-                default:
-                    ESP_LOGE(TAG, "Unexpected client action");
-                    break;
-            }
-        } else {
-                // timeout: check if PING message needed
-                for (int i=0; i<keep_alive_storage->max_clients; ++i) {
-                    if (keep_alive_storage->clients[i].type == CLIENT_ACTIVE) {
-                        if (keep_alive_storage->clients[i].last_seen + keep_alive_storage->keep_alive_period_ms <= _tick_get_ms()) {
-                            ESP_LOGD(TAG, "Haven't seen the client (fd=%d) for a while", keep_alive_storage->clients[i].fd);
-                            if (keep_alive_storage->clients[i].last_seen + keep_alive_storage->not_alive_after_ms <= _tick_get_ms()) {
-                                ESP_LOGE(TAG, "Client (fd=%d) not alive!",  keep_alive_storage->clients[i].fd);
-                                keep_alive_storage->client_not_alive_cb(keep_alive_storage, keep_alive_storage->clients[i].fd);
-                            } else {
-                                keep_alive_storage->check_client_alive_cb(keep_alive_storage, keep_alive_storage->clients[i].fd);
-                            }
-                        }
-                    }
-                }
+        uint32_t delay_ms = MIN(ka_core_next_deadline_in(keep_alive_storage->core, _tick_get_ms()),
+                                KEEP_ALIVE_IDLE_DELAY_MS);
+        if (xQueueReceive(keep_alive_storage->q, (void *) &client_action, pdMS_TO_TICKS(delay_ms)) == pdTRUE) {
+            if (client_action.type == STOP_TASK) {
+                run_task = false;
+                break;
             }
+            handle_client_action(keep_alive_storage, &client_action, _tick_get_ms());
+        }
+        handle_due_clients(keep_alive_storage, _tick_get_ms());
     }
     vQueueDelete(keep_alive_storage->q);
+    ka_core_destroy(keep_alive_storage->core);
     free(keep_alive_storage);
 
     vTaskDelete(NULL);
@@ -159,20 +130,38 @@ static void keep_alive_task(void* arg)
 
 wss_keep_alive_t wss_keep_alive_start(wss_keep_alive_config_t *config)
 {
-    size_t queue_size = config->max_clients/2;
-    size_t client_list_size = config->max_clients + queue_size;
+    // Room for every client to be added and removed while the task is busy, plus the stop request
+    size_t queue_size = 2 * config->max_clients + 1;
     wss_keep_alive_t keep_alive_storage = calloc(1,
-            sizeof(wss_keep_alive_storage_t) + client_list_size* sizeof(client_fd_action_t));
+            sizeof(wss_keep_alive_storage_t) + 2 * config->max_clients * sizeof(int));
     if (keep_alive_storage == NULL) {
         return false;
     }
-    keep_alive_storage->check_client_alive_cb = config->check_client_alive_cb;
+    ka_core_config_t core_config = {
+        .max_clients = config->max_clients,
+        .fd_base = LWIP_SOCKET_OFFSET,
+        .fd_count = CONFIG_LWIP_MAX_SOCKETS,
+        .keep_alive_period_ms = config->keep_alive_period_ms,
+        .not_alive_after_ms = config->not_alive_after_ms,
+    };
+    keep_alive_storage->core = ka_core_create(&core_config);
+    if (keep_alive_storage->core == NULL) {
+        free(keep_alive_storage);
+        return false;
+    }
+    keep_alive_storage->ping_fds = (int *)(keep_alive_storage + 1);
+    keep_alive_storage->dead_fds = keep_alive_storage->ping_fds + config->max_clients;
+    keep_alive_storage->check_clients_alive_cb = config->check_clients_alive_cb;
     keep_alive_storage->client_not_alive_cb = config->client_not_alive_cb;
     keep_alive_storage->max_clients = config->max_clients;
-    keep_alive_storage->not_alive_after_ms = config->not_alive_after_ms;
-    keep_alive_storage->keep_alive_period_ms = config->keep_alive_period_ms;
     keep_alive_storage->user_ctx = config->user_ctx;
-    keep_alive_storage->q =  xQueueCreate(queue_size, sizeof(client_fd_action_t));
+    keep_alive_storage->q = xQueueCreate(queue_size, sizeof(client_fd_action_t));
+    if (keep_alive_storage->q == NULL) {
+        ESP_LOGE(TAG, "Cannot create the client queue");
+        ka_core_destroy(keep_alive_storage->core);
+        free(keep_alive_storage);
+        return false;
+    }
     if (xTaskCreate(keep_alive_task, "keep_alive_task", config->task_stack_size,
                     keep_alive_storage, config->task_prio, NULL) != pdTRUE) {
         wss_keep_alive_stop(keep_alive_storage);
@@ -190,31 +179,21 @@ void wss_keep_alive_stop(wss_keep_alive_t h)
 
 esp_err_t wss_keep_alive_add_client(wss_keep_alive_t h, int fd)
 {
-    client_fd_action_t client_fd_action = { .fd = fd, .type = CLIENT_FD_ADD};
-    if (xQueueSendToBack(h->q, &client_fd_action, 0) == pdTRUE) {
-        return ESP_OK;
-    }
-    return ESP_FAIL;
+    return send_client_action(h, CLIENT_FD_ADD, fd);
 }
 
 esp_err_t wss_keep_alive_remove_client(wss_keep_alive_t h, int fd)
 {
-    client_fd_action_t client_fd_action = { .fd = fd, .type = CLIENT_FD_REMOVE};
-    if (xQueueSendToBack(h->q, &client_fd_action, 0) == pdTRUE) {
-        return ESP_OK;
-    }
-    return ESP_FAIL;
+    return send_client_action(h, CLIENT_FD_REMOVE, fd);
 }
 
 esp_err_t wss_keep_alive_client_is_active(wss_keep_alive_t h, int fd)
 {
-    client_fd_action_t client_fd_action = { .fd = fd, .type = CLIENT_UPDATE,
-                                            .last_seen = _tick_get_ms()};
-    if (xQueueSendToBack(h->q, &client_fd_action, 0) == pdTRUE) {
+    // Lock-free: only stamps the client's slot, the task picks it up at its next deadline
+    if (ka_core_touch(h->core, fd, _tick_get_ms())) {
         return ESP_OK;
     }
     return ESP_FAIL;
-
 }
 
 void wss_keep_alive_set_user_ctx(wss_keep_alive_t h, void *ctx)
@@ -19,7 +19,7 @@
 
 struct wss_keep_alive_storage;
 typedef struct wss_keep_alive_storage* wss_keep_alive_t;
-typedef bool (*wss_check_client_alive_cb_t)(wss_keep_alive_t h, int fd);
+typedef bool (*wss_check_clients_alive_cb_t)(wss_keep_alive_t h, const int *fds, size_t count);
 typedef bool (*wss_client_not_alive_cb_t)(wss_keep_alive_t h, int fd);
 
 /**
@@ -31,7 +31,7 @@ typedef struct {
     size_t task_prio;                                        /*!< priority of the created task */
     size_t keep_alive_period_ms;                             /*!< check every client after this time */
     size_t not_alive_after_ms;                               /*!< consider client not alive after this time */
-    wss_check_client_alive_cb_t check_client_alive_cb;       /*!< callback function to check if client is alive */
+    wss_check_clients_alive_cb_t check_clients_alive_cb;     /*!< callback function to check if a batch of clients is alive */
     wss_client_not_alive_cb_t client_not_alive_cb;           /*!< callback function to notify that the client is not alive */
     void *user_ctx;                                          /*!< user context available in the keep-alive handle */
 } wss_keep_alive_config_t;
@@ -57,6 +57,9 @@ esp_err_t wss_keep_alive_remove_client(wss_keep_alive_t h, int fd);
 /**
  * @brief Notify that this client is alive
  *
+ * Lock-free and cheap enough to call for every received frame; does not wake
+ * the keep-alive task.
+ *
  * @param h keep-alive handle
  * @param fd socket file descriptor for this client
  * @return ESP_OK on success
@@ -0,0 +1,232 @@
+/* Keep-alive bookkeeping without the FreeRTOS task around it
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdlib.h>
+#include "keep_alive_core.h"
+
+typedef struct {
+    uint32_t last_seen;     // written by any task, accessed atomically
+    uint32_t deadline;
+    int32_t heap_pos;       // -1 when not scheduled
+    bool used;
+} ka_slot_t;
+
+struct ka_core {
+    ka_core_config_t config;
+    size_t count;
+    size_t heap_len;
+    uint16_t *heap;         // slot indices, ordered by deadline
+    ka_slot_t slots[];      // indexed by fd - fd_base
+};
+
+static inline bool time_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static inline bool heap_less(const ka_core_t *core, size_t a, size_t b)
+{
+    return time_before(core->slots[core->heap[a]].deadline, core->slots[core->heap[b]].deadline);
+}
+
+static inline void heap_swap(ka_core_t *core, size_t a, size_t b)
+{
+    uint16_t tmp = core->heap[a];
+    core->heap[a] = core->heap[b];
+    core->heap[b] = tmp;
+    core->slots[core->heap[a]].heap_pos = a;
+    core->slots[core->heap[b]].heap_pos = b;
+}
+
+static void heap_sift_up(ka_core_t *core, size_t pos)
+{
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (!heap_less(core, pos, parent)) {
+            break;
+        }
+        heap_swap(core, pos, parent);
+        pos = parent;
+    }
+}
+
+static void heap_sift_down(ka_core_t *core, size_t pos)
+{
+    while (true) {
+        size_t left = 2 * pos + 1;
+        size_t smallest = pos;
+        if (left < core->heap_len && heap_less(core, left, smallest)) {
+            smallest = left;
+        }
+        if (left + 1 < core->heap_len && heap_less(core, left + 1, smallest)) {
+            smallest = left + 1;
+        }
+        if (smallest == pos) {
+            break;
+        }
+        heap_swap(core, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static void heap_push(ka_core_t *core, uint16_t idx)
+{
+    size_t pos = core->heap_len++;
+    core->heap[pos] = idx;
+    core->slots[idx].heap_pos = pos;
+    heap_sift_up(core, pos);
+}
+
+static void heap_remove(ka_core_t *core, size_t pos)
+{
+    size_t last = --core->heap_len;
+    core->slots[core->heap[pos]].heap_pos = -1;
+    if (pos != last) {
+        core->heap[pos] = core->heap[last];
+        core->slots[core->heap[pos]].heap_pos = pos;
+        heap_sift_up(core, pos);
+        heap_sift_down(core, core->slots[core->heap[pos]].heap_pos);
+    }
+}
+
+// Reorders a slot after its deadline moved in either direction
+static void heap_update(ka_core_t *core, size_t pos)
+{
+    heap_sift_up(core, pos);
+    heap_sift_down(core, pos);
+}
+
+static ka_slot_t *slot_for_fd(ka_core_t *core, int fd)
+{
+    if (fd < core->config.fd_base || (size_t)(fd - core->config.fd_base) >= core->config.fd_count) {
+        return NULL;
+    }
+    return &core->slots[fd - core->config.fd_base];
+}
+
+ka_core_t *ka_core_create(const ka_core_config_t *config)
+{
+    ka_core_t *core = calloc(1, sizeof(ka_core_t) + config->fd_count * sizeof(ka_slot_t));
+    if (core == NULL) {
+        return NULL;
+    }
+    core->heap = calloc(config->max_clients, sizeof(uint16_t));
+    if (core->heap == NULL) {
+        free(core);
+        return NULL;
+    }
+    core->config = *config;
+    for (size_t i = 0; i < config->fd_count; ++i) {
+        core->slots[i].heap_pos = -1;
+    }
+    return core;
+}
+
+void ka_core_destroy(ka_core_t *core)
+{
+    if (core) {
+        free(core->heap);
+        free(core);
+    }
+}
+
+bool ka_core_add(ka_core_t *core, int fd, uint32_t now)
+{
+    ka_slot_t *slot = slot_for_fd(core, fd);
+    if (slot == NULL || slot->used || core->count >= core->config.max_clients) {
+        return false;
+    }
+    slot->used = true;
+    __atomic_store_n(&slot->last_seen, now, __ATOMIC_RELAXED);
+    slot->deadline = now + core->config.keep_alive_period_ms;
+    core->count++;
+    heap_push(core, slot - core->slots);
+    return true;
+}
+
+bool ka_core_remove(ka_core_t *core, int fd)
+{
+    ka_slot_t *slot = slot_for_fd(core, fd);
+    if (slot == NULL || !slot->used) {
+        return false;
+    }
+    if (slot->heap_pos >= 0) {
+        heap_remove(core, slot->heap_pos);
+    }
+    slot->used = false;
+    core->count--;
+    return true;
+}
+
+bool ka_core_touch(ka_core_t *core, int fd, uint32_t now)
+{
+    ka_slot_t *slot = slot_for_fd(core, fd);
+    if (slot == NULL) {
+        return false;
+    }
+    // A store into a free slot is harmless, ka_core_add() overwrites it
+    __atomic_store_n(&slot->last_seen, now, __ATOMIC_RELAXED);
+    return slot->used;
+}
+
+bool ka_core_defer(ka_core_t *core, int fd, uint32_t when)
+{
+    ka_slot_t *slot = slot_for_fd(core, fd);
+    if (slot == NULL || !slot->used || slot->heap_pos < 0) {
+        return false;
+    }
+    slot->deadline = when;
+    heap_update(core, slot->heap_pos);
+    return true;
+}
+
+uint32_t ka_core_next_deadline_in(const ka_core_t *core, uint32_t now)
+{
+    if (core->heap_len == 0) {
+        return KA_CORE_NO_DEADLINE;
+    }
+    uint32_t deadline = core->slots[core->heap[0]].deadline;
+    return time_before(now, deadline) ? deadline - now : 0;
+}
+
+void ka_core_collect_due(ka_core_t *core, uint32_t now,
+                         int *ping_fds, size_t *ping_count,
+                         int *dead_fds, size_t *dead_count)
+{
+    *ping_count = 0;
+    *dead_count = 0;
+    while (core->heap_len > 0) {
+        uint16_t idx = core->heap[0];
+        ka_slot_t *slot = &core->slots[idx];
+        if (time_before(now, slot->deadline)) {
+            break;
+        }
+        int fd = core->config.fd_base + idx;
+        uint32_t last_seen = __atomic_load_n(&slot->last_seen, __ATOMIC_RELAXED);
+        // Another task may have stamped a time taken after ours
+        uint32_t silent = time_before(now, last_seen) ? 0 : now - last_seen;
+        if (silent >= core->config.not_alive_after_ms) {
+            dead_fds[(*dead_count)++] = fd;
+            heap_remove(core, 0);
+            continue;
+        }
+        if (silent >= core->config.keep_alive_period_ms) {
+            ping_fds[(*ping_count)++] = fd;
+            slot->deadline = last_seen + core->config.not_alive_after_ms;
+        } else {
+            // Seen since it was scheduled, just move its deadline
+            slot->deadline = now - silent + core->config.keep_alive_period_ms;
+        }
+        heap_sift_down(core, 0);
+    }
+}
+
+size_t ka_core_count(const ka_core_t *core)
+{
+    return core->count;
+}
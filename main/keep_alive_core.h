@@ -0,0 +1,101 @@
+/* Keep-alive bookkeeping without the FreeRTOS task around it
+
+   Clients live in a table indexed directly by socket fd, and their next check
+   times are kept in a binary min-heap, so add/remove are O(log n), marking a
+   client as seen is O(1), and finding the next deadline is O(1). No ESP-IDF
+   dependencies, so it also builds on the host.
+
+   ka_core_touch() only does an atomic store and may be called from any task;
+   every other function must be called from the task owning the core.
+
+   Times are 32-bit millisecond ticks; comparisons are wrap-around safe.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define KA_CORE_NO_DEADLINE UINT32_MAX
+
+typedef struct ka_core ka_core_t;
+
+/**
+ * @brief Core configuration
+ */
+typedef struct {
+    size_t max_clients;             /*!< max number of tracked clients */
+    int fd_base;                    /*!< lowest socket fd that can be tracked */
+    size_t fd_count;                /*!< number of socket fds from fd_base on */
+    uint32_t keep_alive_period_ms;  /*!< check a client after it was silent for this long */
+    uint32_t not_alive_after_ms;    /*!< consider a client not alive after this long */
+} ka_core_config_t;
+
+/**
+ * @brief Allocates a core
+ *
+ * @param config configuration
+ * @return core, or NULL if out of memory
+ */
+ka_core_t *ka_core_create(const ka_core_config_t *config);
+
+/**
+ * @brief Frees a core
+ *
+ * @param core core
+ */
+void ka_core_destroy(ka_core_t *core);
+
+/**
+ * @brief Starts tracking a client
+ *
+ * @return false if the fd is out of range, already tracked or the table is full
+ */
+bool ka_core_add(ka_core_t *core, int fd, uint32_t now);
+
+/**
+ * @brief Stops tracking a client
+ *
+ * @return false if the fd was not tracked
+ */
+bool ka_core_remove(ka_core_t *core, int fd);
+
+/**
+ * @brief Records that a client was seen, O(1): its deadline is moved lazily when it comes up
+ *
+ * Lock-free, safe to call from any task.
+ *
+ * @return false if the fd was not tracked
+ */
+bool ka_core_touch(ka_core_t *core, int fd, uint32_t now);
+
+/**
+ * @brief Pushes the next check of a client out to the given time
+ *
+ * @return false if the fd was not tracked
+ */
+bool ka_core_defer(ka_core_t *core, int fd, uint32_t when);
+
+/**
+ * @brief Gets the time until the earliest deadline
+ *
+ * @return milliseconds (0 if already due), or KA_CORE_NO_DEADLINE if no client is tracked
+ */
+uint32_t ka_core_next_deadline_in(const ka_core_t *core, uint32_t now);
+
+/**
+ * @brief Collects every client whose deadline has passed
+ *
+ * Clients silent for keep_alive_period_ms go to ping_fds and are checked again
+ * once not_alive_after_ms has passed. Clients silent for not_alive_after_ms go
+ * to dead_fds and are not reported again; they stay tracked until removed.
+ * Both arrays must hold max_clients entries.
+ */
+void ka_core_collect_due(ka_core_t *core, uint32_t now,
+                         int *ping_fds, size_t *ping_count,
+                         int *dead_fds, size_t *dead_count);
+
+/**
+ * @brief Gets the number of tracked clients
+ */
+size_t ka_core_count(const ka_core_t *core);
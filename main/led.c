@@ -1,13 +1,72 @@
 #include <stdio.h>
 #include "driver/ledc.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "led.h"
 
 #define LEDC_LS_TIMER LEDC_TIMER_1
 #define LEDC_LS_MODE LEDC_LOW_SPEED_MODE
 #define LEDC_LS_CH3_GPIO (5)
 #define LEDC_LS_CH3_CHANNEL LEDC_CHANNEL_3
-#define LEDC_TEST_DUTY         (4000)
-#define LEDC_TEST_FADE_TIME    (1000)
+
+/* 5 kHz * 2^13 stays within the 80 MHz APB clock */
+#define LED_FREQ_HZ (5000)
+#define LED_DUTY_RESOLUTION LEDC_TIMER_13_BIT
+#define LED_DUTY_MAX ((1 << 13) - 1)
+
+/*
+ * Perceptual brightness (0-255) to duty, following the CIE 1931 lightness
+ * curve. Evaluated entirely by the compiler, so there is no runtime math.
+ */
+#define CIE_L(i) ((i) * 100.0 / 255)
+#define CIE_C(i) ((CIE_L(i) + 16) / 116)
+#define CIE_Y(i) (CIE_L(i) <= 8 ? CIE_L(i) / 903.3 : CIE_C(i) * CIE_C(i) * CIE_C(i))
+#define GAMMA(i) ((uint16_t)(CIE_Y(i) * LED_DUTY_MAX + 0.5))
+#define GAMMA4(i) GAMMA(i), GAMMA((i) + 1), GAMMA((i) + 2), GAMMA((i) + 3)
+#define GAMMA16(i) GAMMA4(i), GAMMA4((i) + 4), GAMMA4((i) + 8), GAMMA4((i) + 12)
+#define GAMMA64(i) GAMMA16(i), GAMMA16((i) + 16), GAMMA16((i) + 32), GAMMA16((i) + 48)
+
+static const uint16_t GAMMA_LUT[256] = {
+    GAMMA64(0), GAMMA64(64), GAMMA64(128), GAMMA64(192)
+};
+
+/*
+ * The hardware fades linearly in duty, so a perceptually even fade is split
+ * into a few linear segments between points of the curve. The CPU only wakes
+ * up to start a segment; a segment waits inside the driver for the previous
+ * one to finish, which the fade-end interrupt signals.
+ */
+#define FADE_SEGMENT_MIN_MS (60)
+#define FADE_SEGMENTS_MAX (4)
+
+/*
+ * Flicker is a fixed loop of single linear fades rather than random steps:
+ * how far each one dips below the level (in 64ths of it) and how long it
+ * takes (in quarters of the period). Fades are long and uneven enough to read
+ * as a flame, so the task wakes about once per period and draws no random
+ * numbers; the LEDC only runs one linear fade at a time, so every change of
+ * direction still costs one wake-up.
+ */
+static const struct {
+    uint8_t depth;
+    uint8_t quarters;
+} FLICKER_PATTERN[] = {
+    { 0, 6 }, { 10, 2 }, { 2, 5 }, { 24, 2 }, { 0, 8 }, { 6, 3 }, { 16, 2 }, { 4, 7 },
+    { 26, 2 }, { 0, 5 }, { 12, 3 }, { 2, 8 }, { 20, 2 }, { 8, 4 }, { 0, 6 }, { 14, 3 },
+};
+
+typedef struct {
+    led_effect_t effect;
+    uint8_t level;
+    uint16_t time_ms;       // fade time, or effect period
+} led_cmd_t;
+
+static TaskHandle_t led_task_handle;
+static portMUX_TYPE cmd_lock = portMUX_INITIALIZER_UNLOCKED;
+static led_cmd_t pending_cmd;
+static bool cmd_pending;
+static uint8_t current_level;
 
 /*
     * Prepare individual configuration
@@ -31,6 +90,112 @@ ledc_channel_config_t ledc_channel = {
     .timer_sel  = LEDC_LS_TIMER
 };
 
+static inline bool interrupted(void)
+{
+    return __atomic_load_n(&cmd_pending, __ATOMIC_ACQUIRE);
+}
+
+static bool take_cmd(led_cmd_t *cmd)
+{
+    portENTER_CRITICAL(&cmd_lock);
+    bool taken = cmd_pending;
+    if (taken) {
+        *cmd = pending_cmd;
+        cmd_pending = false;
+    }
+    portEXIT_CRITICAL(&cmd_lock);
+    return taken;
+}
+
+static void post_cmd(const led_cmd_t *cmd)
+{
+    portENTER_CRITICAL(&cmd_lock);
+    // Latest wins, a slider drag only ever leaves one fade to run
+    pending_cmd = *cmd;
+    cmd_pending = true;
+    portEXIT_CRITICAL(&cmd_lock);
+    if (led_task_handle) {
+        xTaskNotifyGive(led_task_handle);
+    }
+}
+
+/* Starts one linear hardware fade to a level, returns false if a new command arrived */
+static bool fade_segment(uint8_t level, uint32_t time_ms)
+{
+    uint32_t duty = GAMMA_LUT[level];
+    if (time_ms == 0) {
+        ledc_set_duty(ledc_channel.speed_mode, ledc_channel.channel, duty);
+        ledc_update_duty(ledc_channel.speed_mode, ledc_channel.channel);
+    } else {
+        // Blocks until the previous segment has finished
+        ledc_set_fade_with_time(ledc_channel.speed_mode, ledc_channel.channel, duty, time_ms);
+        ledc_fade_start(ledc_channel.speed_mode, ledc_channel.channel, LEDC_FADE_NO_WAIT);
+    }
+    current_level = level;
+    return !interrupted();
+}
+
+/* Fade along the gamma curve, returns false if a new command cut it short */
+static bool fade_to(uint8_t level, uint32_t time_ms)
+{
+    int from = current_level;
+    int segments = time_ms / FADE_SEGMENT_MIN_MS;
+    segments = segments < 1 ? 1 : segments > FADE_SEGMENTS_MAX ? FADE_SEGMENTS_MAX : segments;
+
+    for (int k = 1; k <= segments; ++k) {
+        if (!fade_segment(from + (level - from) * k / segments, time_ms / segments)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Hold the current level, returns false if a new command arrived */
+static bool hold(uint32_t time_ms)
+{
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(time_ms));
+    return !interrupted();
+}
+
+static void run_effect(const led_cmd_t *cmd)
+{
+    uint32_t period = cmd->time_ms ? cmd->time_ms : 1;
+    switch (cmd->effect) {
+        case LED_EFFECT_NONE:
+            fade_to(cmd->level, cmd->time_ms);
+            break;
+        case LED_EFFECT_BREATHE:
+            while (fade_to(cmd->level, period / 2) && fade_to(cmd->level / 8, period / 2)) {
+            }
+            break;
+        case LED_EFFECT_PULSE:
+            while (fade_to(cmd->level, period / 10) && fade_to(0, period / 2) && hold(period * 2 / 5)) {
+            }
+            break;
+        case LED_EFFECT_FLICKER:
+            // Dips are shallow, a linear fade is close enough to the curve
+            for (size_t i = 0;; i = (i + 1) % (sizeof(FLICKER_PATTERN) / sizeof(FLICKER_PATTERN[0]))) {
+                uint8_t level = cmd->level - cmd->level * FLICKER_PATTERN[i].depth / 64;
+                if (!fade_segment(level, period * FLICKER_PATTERN[i].quarters / 4)) {
+                    break;
+                }
+            }
+            break;
+    }
+}
+
+static void led_task(void *arg)
+{
+    led_cmd_t cmd;
+    while (true) {
+        if (take_cmd(&cmd)) {
+            run_effect(&cmd);
+        } else {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
 void init_led(void) {
     ESP_LOGI("led", "Initializing LED...");
     /*
@@ -38,8 +203,8 @@ void init_led(void) {
      * that will be used by LED Controller
      */
     ledc_timer_config_t ledc_timer = {
-        .duty_resolution = LEDC_TIMER_8_BIT, // resolution of PWM duty
-        .freq_hz = 5000,                      // frequency of PWM signal
+        .duty_resolution = LED_DUTY_RESOLUTION, // resolution of PWM duty
+        .freq_hz = LED_FREQ_HZ,               // frequency of PWM signal
         .speed_mode = LEDC_LS_MODE,           // timer mode
         .timer_num = LEDC_LS_TIMER,            // timer index
         .clk_cfg = LEDC_AUTO_CLK,              // Auto select the source clock
@@ -52,11 +217,20 @@ void init_led(void) {
 
     // Initialize fade service.
     ledc_fade_func_install(0);
+
+    xTaskCreate(led_task, "led", CONFIG_MK3_LED_TASK_STACK_SIZE, NULL, CONFIG_MK3_LED_TASK_PRIORITY, &led_task_handle);
 }
 
-void led_set_duty(uint8_t duty, int time) {
-    ESP_LOGI("led", "Fading LED to duty %d over %d time", duty, time);
+void led_set_duty(uint8_t duty, uint16_t time_ms) {
+    ESP_LOGI("led", "Fading LED to duty %d over %d ms", duty, time_ms);
 
-    ledc_set_fade_with_time(ledc_channel.speed_mode, ledc_channel.channel, duty, time);
-    ledc_fade_start(ledc_channel.speed_mode, ledc_channel.channel, LEDC_FADE_NO_WAIT);
-}
\ No newline at end of file
+    const led_cmd_t cmd = { .effect = LED_EFFECT_NONE, .level = duty, .time_ms = time_ms };
+    post_cmd(&cmd);
+}
+
+void led_set_effect(led_effect_t effect, uint8_t level, uint16_t period_ms) {
+    ESP_LOGI("led", "Starting LED effect %d at level %d, period %d ms", effect, level, period_ms);
+
+    const led_cmd_t cmd = { .effect = effect, .level = level, .time_ms = period_ms };
+    post_cmd(&cmd);
+}
@@ -0,0 +1,39 @@
+/* Eye LED
+
+   Brightness is given on a perceptual 0-255 scale and mapped to a 13-bit duty
+   through a gamma table built at compile time. Fades and effects are played
+   by a small task as hardware fades of the LEDC peripheral, so the calls
+   below return immediately and the CPU only wakes once per fade segment.
+*/
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    LED_EFFECT_NONE = 0,    /*!< fade once to the level and stay */
+    LED_EFFECT_BREATHE,     /*!< slow fade between the level and an eighth of it */
+    LED_EFFECT_FLICKER,     /*!< irregular dips below the level, from a fixed pattern */
+    LED_EFFECT_PULSE,       /*!< quick flash to the level, slow decay, pause */
+} led_effect_t;
+
+/**
+ * @brief Configures the LEDC timer, channel and fade service
+ */
+void init_led(void);
+
+/**
+ * @brief Fades the LED to a brightness, stopping any effect
+ *
+ * @param duty brightness, 0-255
+ * @param time_ms fade duration
+ */
+void led_set_duty(uint8_t duty, uint16_t time_ms);
+
+/**
+ * @brief Starts a looping effect, until the next call to led_set_duty() or led_set_effect()
+ *
+ * @param effect effect
+ * @param level peak brightness, 0-255
+ * @param period_ms duration of one cycle (for flicker, the average length of one fade)
+ */
+void led_set_effect(led_effect_t effect, uint8_t level, uint16_t period_ms);
@@ -0,0 +1,150 @@
+/* Firmware metrics in Prometheus text format
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+
+#define PREFIX "mk3_"
+
+typedef struct {
+    uint32_t buckets[METRICS_LATENCY_BUCKETS];  // not cumulative, summed when rendering
+    uint32_t sum_us;
+    uint32_t errors;
+} histogram_t;
+
+static const uint32_t LATENCY_BOUNDS_US[METRICS_LATENCY_BUCKETS - 1] = METRICS_LATENCY_BOUNDS_US;
+
+static const char *const HANDLER_NAMES[METRIC_HANDLER_MAX] = {
+    [METRIC_HANDLER_WS] = "ws",
+    [METRIC_HANDLER_FILE] = "file",
+    [METRIC_HANDLER_LIGHT_POST] = "light_brightness_post",
+    [METRIC_HANDLER_VISOR_POST] = "visor_state_post",
+    [METRIC_HANDLER_SYSTEM_INFO] = "system_info",
+    [METRIC_HANDLER_METRICS] = "metrics",
+    [METRIC_HANDLER_EVENTS] = "events",
+    [METRIC_HANDLER_STATE] = "state",
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} COUNTERS[METRIC_COUNTER_MAX] = {
+    [METRIC_WS_FRAMES_RECEIVED] = { "ws_frames_received_total", "WebSocket frames received" },
+    [METRIC_WS_FRAMES_SENT] = { "ws_frames_sent_total", "WebSocket frames sent" },
+    [METRIC_WS_FRAMES_DROPPED] = { "ws_frames_dropped_total", "WebSocket frames that could not be sent" },
+    [METRIC_QUEUE_WORK_FAILURES] = { "httpd_queue_work_failures_total", "Failed httpd_queue_work calls" },
+    [METRIC_KEEP_ALIVE_PINGS] = { "keep_alive_pings_total", "Keep-alive pings sent" },
+    [METRIC_KEEP_ALIVE_TIMEOUTS] = { "keep_alive_timeouts_total", "Clients closed for not answering pings" },
+    [METRIC_KEEP_ALIVE_QUEUE_FULL] = { "keep_alive_queue_full_total", "Client adds and removes lost to a full keep-alive queue" },
+    [METRIC_SSE_EVENTS_SENT] = { "sse_events_sent_total", "Server-Sent Events sent" },
+    [METRIC_SSE_EVENTS_DROPPED] = { "sse_events_dropped_total", "Server-Sent Events that could not be sent" },
+    [METRIC_SSE_HEARTBEATS] = { "sse_heartbeats_total", "Heartbeats sent to event streams" },
+    [METRIC_STATE_POLLS_CHANGED] = { "state_polls_changed_total", "Long-polls of the state answered with a change" },
+    [METRIC_STATE_POLLS_EXPIRED] = { "state_polls_expired_total", "Long-polls of the state that timed out" },
+    [METRIC_VISOR_MOVES_DONE] = { "visor_moves_done_total", "Visor moves that reached their pose" },
+    [METRIC_VISOR_MOVES_PREEMPTED] = { "visor_moves_preempted_total", "Visor moves cut short by a newer one" },
+};
+
+static uint32_t counters[METRIC_COUNTER_MAX];
+static histogram_t histograms[METRIC_HANDLER_MAX];
+
+void metrics_add(metrics_counter_t counter, uint32_t n)
+{
+    __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(metrics_handler_t handler, uint32_t us, bool ok)
+{
+    histogram_t *h = &histograms[handler];
+    size_t bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && us > LATENCY_BOUNDS_US[bucket]) {
+        bucket++;
+    }
+    __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+    if (!ok) {
+        __atomic_fetch_add(&h->errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_reset(void)
+{
+    memset(counters, 0, sizeof(counters));
+    memset(histograms, 0, sizeof(histograms));
+}
+
+// Formats one line; every caller stays well below the buffer size
+__attribute__((format(printf, 3, 4)))
+static void emit(metrics_write_cb_t write, void *ctx, const char *fmt, ...)
+{
+    char line[128];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len > 0) {
+        write(ctx, line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+static void render_histograms(metrics_write_cb_t write, void *ctx)
+{
+    emit(write, ctx, "# HELP " PREFIX "http_handler_duration_seconds Time spent in URI handlers\n");
+    emit(write, ctx, "# TYPE " PREFIX "http_handler_duration_seconds histogram\n");
+    for (int i = 0; i < METRIC_HANDLER_MAX; ++i) {
+        const histogram_t *h = &histograms[i];
+        uint32_t cumulative = 0;
+        for (int b = 0; b < METRICS_LATENCY_BUCKETS; ++b) {
+            cumulative += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            if (b < METRICS_LATENCY_BUCKETS - 1) {
+                uint32_t us = LATENCY_BOUNDS_US[b];
+                emit(write, ctx, PREFIX "http_handler_duration_seconds_bucket{handler=\"%s\",le=\"%u.%06u\"} %u\n",
+                     HANDLER_NAMES[i], (unsigned)(us / 1000000), (unsigned)(us % 1000000), (unsigned)cumulative);
+            } else {
+                emit(write, ctx, PREFIX "http_handler_duration_seconds_bucket{handler=\"%s\",le=\"+Inf\"} %u\n",
+                     HANDLER_NAMES[i], (unsigned)cumulative);
+            }
+        }
+        uint32_t sum_us = __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+        emit(write, ctx, PREFIX "http_handler_duration_seconds_sum{handler=\"%s\"} %u.%06u\n",
+             HANDLER_NAMES[i], (unsigned)(sum_us / 1000000), (unsigned)(sum_us % 1000000));
+        emit(write, ctx, PREFIX "http_handler_duration_seconds_count{handler=\"%s\"} %u\n",
+             HANDLER_NAMES[i], (unsigned)cumulative);
+    }
+
+    emit(write, ctx, "# HELP " PREFIX "http_handler_errors_total URI handler calls that failed\n");
+    emit(write, ctx, "# TYPE " PREFIX "http_handler_errors_total counter\n");
+    for (int i = 0; i < METRIC_HANDLER_MAX; ++i) {
+        emit(write, ctx, PREFIX "http_handler_errors_total{handler=\"%s\"} %u\n",
+             HANDLER_NAMES[i], (unsigned)__atomic_load_n(&histograms[i].errors, __ATOMIC_RELAXED));
+    }
+}
+
+void metrics_render(metrics_write_cb_t write, void *ctx, const metrics_gauge_t *gauges, size_t gauge_count)
+{
+    render_histograms(write, ctx);
+    for (int i = 0; i < METRIC_COUNTER_MAX; ++i) {
+        emit(write, ctx, "# HELP " PREFIX "%s %s\n", COUNTERS[i].name, COUNTERS[i].help);
+        emit(write, ctx, "# TYPE " PREFIX "%s counter\n", COUNTERS[i].name);
+        emit(write, ctx, PREFIX "%s %u\n", COUNTERS[i].name, (unsigned)__atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+    }
+    for (size_t i = 0; i < gauge_count; ++i) {
+        const metrics_gauge_t *g = &gauges[i];
+        if (g->help) {
+            emit(write, ctx, "# HELP " PREFIX "%s %s\n", g->name, g->help);
+            emit(write, ctx, "# TYPE " PREFIX "%s %s\n", g->name, g->counter ? "counter" : "gauge");
+        }
+        if (g->label) {
+            emit(write, ctx, PREFIX "%s{%s} %u\n", g->name, g->label, (unsigned)g->value);
+        } else {
+            emit(write, ctx, PREFIX "%s %u\n", g->name, (unsigned)g->value);
+        }
+    }
+}
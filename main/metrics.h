@@ -0,0 +1,100 @@
+/* Firmware metrics in Prometheus text format
+
+   A fixed set of counters and per-handler latency histograms, all plain
+   32-bit words updated with relaxed atomic adds: no locks, no allocation, a
+   few cycles per event, so they stay enabled in production. Gauges (heap,
+   stacks...) are sampled by the caller at scrape time and passed to
+   metrics_render(). No ESP-IDF dependencies, so it also builds on the host.
+
+   Counters are 32 bits wide and wrap, which Prometheus treats as a reset.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    METRIC_HANDLER_WS = 0,
+    METRIC_HANDLER_FILE,
+    METRIC_HANDLER_LIGHT_POST,
+    METRIC_HANDLER_VISOR_POST,
+    METRIC_HANDLER_SYSTEM_INFO,
+    METRIC_HANDLER_METRICS,
+    METRIC_HANDLER_EVENTS,
+    METRIC_HANDLER_STATE,
+    METRIC_HANDLER_MAX,
+} metrics_handler_t;
+
+typedef enum {
+    METRIC_WS_FRAMES_RECEIVED = 0,
+    METRIC_WS_FRAMES_SENT,
+    METRIC_WS_FRAMES_DROPPED,       /*!< failed sends and broadcasts without a free message */
+    METRIC_QUEUE_WORK_FAILURES,     /*!< httpd_queue_work() errors */
+    METRIC_KEEP_ALIVE_PINGS,
+    METRIC_KEEP_ALIVE_TIMEOUTS,
+    METRIC_KEEP_ALIVE_QUEUE_FULL,   /*!< client adds and removes the keep-alive task never got */
+    METRIC_SSE_EVENTS_SENT,
+    METRIC_SSE_EVENTS_DROPPED,      /*!< failed sends, the stream is closed */
+    METRIC_SSE_HEARTBEATS,
+    METRIC_STATE_POLLS_CHANGED,     /*!< parked state requests answered with a change */
+    METRIC_STATE_POLLS_EXPIRED,     /*!< parked state requests answered with 304 */
+    METRIC_VISOR_MOVES_DONE,        /*!< visor moves that reached their pose */
+    METRIC_VISOR_MOVES_PREEMPTED,   /*!< visor moves cut short by a newer one */
+    METRIC_COUNTER_MAX,
+} metrics_counter_t;
+
+/* Upper bounds of the latency buckets, in microseconds; one more bucket takes the rest */
+#define METRICS_LATENCY_BOUNDS_US \
+    { 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 }
+#define METRICS_LATENCY_BUCKETS 12
+
+/**
+ * @brief A value sampled at scrape time
+ */
+typedef struct {
+    const char *name;       /*!< metric name */
+    const char *help;       /*!< HELP text, or NULL to continue the previous metric's family */
+    const char *label;      /*!< label set without braces, e.g. "task=\"httpd\"", or NULL */
+    bool counter;           /*!< TYPE counter instead of gauge */
+    uint32_t value;
+} metrics_gauge_t;
+
+/**
+ * @brief Receives the rendered text piece by piece
+ */
+typedef void (*metrics_write_cb_t)(void *ctx, const char *text, size_t len);
+
+/**
+ * @brief Adds to a counter, lock-free, from any task
+ */
+void metrics_add(metrics_counter_t counter, uint32_t n);
+
+static inline void metrics_inc(metrics_counter_t counter)
+{
+    metrics_add(counter, 1);
+}
+
+/**
+ * @brief Records one request served by a handler, lock-free, from any task
+ *
+ * @param handler handler
+ * @param us time spent in the handler
+ * @param ok false if the handler failed
+ */
+void metrics_observe(metrics_handler_t handler, uint32_t us, bool ok);
+
+/**
+ * @brief Renders every counter, histogram and the given gauges
+ *
+ * @param write output callback
+ * @param ctx passed to write
+ * @param gauges sampled values
+ * @param gauge_count number of gauges
+ */
+void metrics_render(metrics_write_cb_t write, void *ctx, const metrics_gauge_t *gauges, size_t gauge_count);
+
+/**
+ * @brief Clears every counter and histogram
+ */
+void metrics_reset(void);
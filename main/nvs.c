@@ -1,87 +1,343 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "esp_crc.h"
 #include "esp_log.h"
+#include "storage.h"
+#include "trace.h"
 
 static const char *NVS_TAG = "esp-nvs";
 static const char *STORAGE_NAME = "storage";
-static const char *LED_NAME = "led";
-static const char *VISOR_NAME = "visor";
 
-// Low level read API
-static esp_err_t nvs_read(const char *name, uint8_t *val, esp_err_t *read_err) {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(STORAGE_NAME, NVS_READWRITE, &handle);
+typedef enum {
+    FIELD_LED = 0,
+    FIELD_VISOR,
+    FIELD_MAX,
+} state_field_t;
 
-    ESP_LOGD(NVS_TAG, "Opening Non-Volatile Storage, read-only..");
-    if(err != ESP_OK) {
-        ESP_LOGE(NVS_TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        // return err;
-    } else {
-        ESP_LOGD(NVS_TAG, "Opened! Reading value..");
+static const char *const FIELD_NAMES[FIELD_MAX] = {
+    [FIELD_LED] = "led",
+    [FIELD_VISOR] = "visor",
+};
 
-        err = nvs_get_u8(handle, name, val);   
-        switch (err) {
-            case ESP_OK:
-                ESP_LOGI(NVS_TAG, "Read value %s successfully!", name);
-                break;
-            case ESP_ERR_NVS_NOT_FOUND:
-                *read_err = err;
-                ESP_LOGI(NVS_TAG, "The value is not initialized yet!");
-                break;
-            default :
-                *read_err = err;
-                ESP_LOGE(NVS_TAG, "Error (%s) reading!", esp_err_to_name(err));
+static const uint8_t FIELD_DEFAULTS[FIELD_MAX] = {
+    [FIELD_LED] = 0,
+    [FIELD_VISOR] = 0,
+};
+
+// RAM shadow of the persisted state, guarded by shadow_lock
+static uint8_t shadow[FIELD_MAX];
+static uint32_t dirty_mask;
+// Bumped on every change; changed_at holds the generation of each field's last change
+static uint32_t generation;
+static uint32_t changed_at[FIELD_MAX];
+static storage_stats_t stats;
+static portMUX_TYPE shadow_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Serializes flushes between the flusher task and explicit/shutdown flushes
+static SemaphoreHandle_t flush_lock;
+static TaskHandle_t flush_task;
+
+/*
+ * The whole state is one blob, so a boot costs one read and a flush one write
+ * however many settings there are. The blob is a header followed by the values
+ * in state_field_t order. New fields are only ever appended: bump
+ * STATE_BLOB_VERSION and add the step from the previous version to
+ * STATE_MIGRATIONS.
+ */
+#define STATE_BLOB_KEY "state"
+#define STATE_BLOB_VERSION 1
+/* Room for the values of newer firmware, which an older one keeps what it knows of */
+#define STATE_BLOB_MAX_SIZE 256
+
+typedef struct __attribute__((packed)) {
+    uint32_t crc;           // esp_crc32_le of everything after it
+    uint16_t version;       // layout of the values
+    uint16_t length;        // bytes of values that follow
+} state_blob_header_t;
+
+typedef struct __attribute__((packed)) {
+    state_blob_header_t header;
+    uint8_t values[STATE_BLOB_MAX_SIZE - sizeof(state_blob_header_t)];
+} state_blob_t;
+
+_Static_assert(FIELD_MAX <= sizeof(((state_blob_t *)0)->values), "state does not fit STATE_BLOB_MAX_SIZE");
+
+static uint32_t state_blob_crc(const state_blob_t *blob) {
+    const uint8_t *start = (const uint8_t *)&blob->header.version;
+    return esp_crc32_le(0, start, sizeof(blob->header) - sizeof(blob->header.crc) + blob->header.length);
+}
+
+// Version 0 is the layout before the blob: one u8 key per field, named after it
+static void migrate_from_keys(nvs_handle_t handle, state_blob_t *blob) {
+    for (int i = 0; i < FIELD_MAX; ++i) {
+        esp_err_t err = nvs_get_u8(handle, FIELD_NAMES[i], &blob->values[i]);
+        if (err == ESP_OK) {
+            ESP_LOGI(NVS_TAG, "Migrated %s = %d", FIELD_NAMES[i], blob->values[i]);
+        } else {
+            blob->values[i] = FIELD_DEFAULTS[i];
         }
     }
+    blob->header.length = FIELD_MAX;
+}
+
+// STATE_MIGRATIONS[v] upgrades a blob from version v to v + 1
+static void (*const STATE_MIGRATIONS[STATE_BLOB_VERSION])(nvs_handle_t handle, state_blob_t *blob) = {
+    [0] = migrate_from_keys,
+};
 
-    ESP_LOGD(NVS_TAG, "Committing NVS updates...");
-    err = nvs_commit(handle);
+/*
+ * Low level read API, loads every field with a single read. Returns true if
+ * the stored state must be rewritten: missing, corrupt or in an older layout.
+ * State that only failed to load is left alone, as is a blob of newer
+ * firmware, whose extra fields are kept until the next flush.
+ */
+static bool nvs_load(uint8_t *values) {
+    nvs_handle_t handle;
+    memcpy(values, FIELD_DEFAULTS, sizeof(FIELD_DEFAULTS));
+
+    esp_err_t err = nvs_open(STORAGE_NAME, NVS_READWRITE, &handle);
     if (err != ESP_OK) {
-        ESP_LOGE(NVS_TAG, "Read commit failed!");
-    } else {
-        ESP_LOGD(NVS_TAG, "Read commit successfully!");
+        ESP_LOGE(NVS_TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return false;
     }
 
-    nvs_close(handle);
+    static state_blob_t blob_buf;
+    state_blob_t *blob = &blob_buf;
+    size_t length = sizeof(blob_buf);
+    err = nvs_get_blob(handle, STATE_BLOB_KEY, blob, &length);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        // Newer firmware stored more than fits: read it whole, the CRC covers all of it
+        blob = malloc(length);
+        err = blob ? nvs_get_blob(handle, STATE_BLOB_KEY, blob, &length) : ESP_ERR_NO_MEM;
+    }
 
-    return err;
+    bool rewrite = false;
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        blob->header.version = 0;
+        blob->header.length = 0;
+        err = ESP_OK;
+    } else if (err != ESP_OK) {
+        ESP_LOGE(NVS_TAG, "Error (%s) reading the state, using defaults", esp_err_to_name(err));
+    } else if (length < sizeof(blob->header) || length != sizeof(blob->header) + blob->header.length ||
+               blob->header.crc != state_blob_crc(blob)) {
+        ESP_LOGE(NVS_TAG, "Stored state is corrupt, using defaults");
+        err = ESP_ERR_INVALID_CRC;
+        rewrite = true;
+    }
+
+    if (err == ESP_OK) {
+        rewrite = blob->header.version < STATE_BLOB_VERSION;
+        while (blob->header.version < STATE_BLOB_VERSION) {
+            ESP_LOGI(NVS_TAG, "Migrating state from version %d", blob->header.version);
+            STATE_MIGRATIONS[blob->header.version](handle, blob);
+            blob->header.version++;
+        }
+        if (blob->header.version > STATE_BLOB_VERSION) {
+            ESP_LOGW(NVS_TAG, "State version %d is newer than %d, keeping the fields known here",
+                     blob->header.version, STATE_BLOB_VERSION);
+        }
+        memcpy(values, blob->values, MIN(blob->header.length, FIELD_MAX));
+        for (int i = 0; i < FIELD_MAX; ++i) {
+            ESP_LOGI(NVS_TAG, "Read value %s = %d", FIELD_NAMES[i], values[i]);
+        }
+    }
+
+    if (blob != &blob_buf) {
+        free(blob);
+    }
+    nvs_close(handle);
+    return rewrite;
 }
 
-// Low level write API
-static esp_err_t nvs_write(const char *name, uint8_t val) {
+// Low level write API, writes the whole state and commits once
+static esp_err_t nvs_store(const uint8_t *values) {
     nvs_handle_t handle;
     esp_err_t err = nvs_open(STORAGE_NAME, NVS_READWRITE, &handle);
-
-    ESP_LOGD(NVS_TAG, "Opening Non-Volatile Storage, read-write..");
-    if(err != ESP_OK) {
+    if (err != ESP_OK) {
         ESP_LOGE(NVS_TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
         return err;
-    } else {
-        ESP_LOGD(NVS_TAG, "Opened! Reading value..");
+    }
 
-        err = nvs_set_u8(handle, name, val);   
+    state_blob_t blob;
+    blob.header.version = STATE_BLOB_VERSION;
+    blob.header.length = FIELD_MAX;
+    memcpy(blob.values, values, FIELD_MAX);
+    blob.header.crc = state_blob_crc(&blob);
+    err = nvs_set_blob(handle, STATE_BLOB_KEY, &blob, sizeof(blob.header) + FIELD_MAX);
+    if (err != ESP_OK) {
+        ESP_LOGE(NVS_TAG, "Write state failed (%s)!", esp_err_to_name(err));
+    }
+
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
         if (err != ESP_OK) {
-            ESP_LOGE(NVS_TAG, "Write failed!");
+            ESP_LOGE(NVS_TAG, "Write commit failed (%s)!", esp_err_to_name(err));
         } else {
-            ESP_LOGI(NVS_TAG, "Write value %s successfully!", name);
+            ESP_LOGD(NVS_TAG, "Write commit successfully!");
         }
     }
 
-    ESP_LOGD(NVS_TAG, "Committing NVS updates...");
-    err = nvs_commit(handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(NVS_TAG, "Write commit failed!");
-    } else {
-        ESP_LOGD(NVS_TAG, "Write commit successfully!");
-    }
+    nvs_close(handle);
+    return err;
+}
 
+// Drops the per-field keys of version 0 once the blob holds their values
+static void nvs_erase_legacy_keys(void) {
+    nvs_handle_t handle;
+    if (nvs_open(STORAGE_NAME, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    bool erased = false;
+    for (int i = 0; i < FIELD_MAX; ++i) {
+        erased |= nvs_erase_key(handle, FIELD_NAMES[i]) == ESP_OK;
+    }
+    if (erased) {
+        nvs_commit(handle);
+    }
     nvs_close(handle);
+}
+
+esp_err_t storage_flush(void) {
+    if (flush_lock) {
+        xSemaphoreTake(flush_lock, portMAX_DELAY);
+    }
+
+    uint8_t values[FIELD_MAX];
+    portENTER_CRITICAL(&shadow_lock);
+    uint32_t mask = dirty_mask;
+    dirty_mask = 0;
+    memcpy(values, shadow, sizeof(values));
+    portEXIT_CRITICAL(&shadow_lock);
 
+    esp_err_t err = ESP_OK;
+    if (mask) {
+        err = nvs_store(values);
+        portENTER_CRITICAL(&shadow_lock);
+        if (err == ESP_OK) {
+            stats.commits++;
+        } else {
+            // Keep the values dirty so the next flush retries them
+            dirty_mask |= mask;
+            stats.flush_errors++;
+        }
+        portEXIT_CRITICAL(&shadow_lock);
+    }
+
+    if (flush_lock) {
+        xSemaphoreGive(flush_lock);
+    }
     return err;
 }
 
-esp_err_t init_nvs() {
+static void storage_shutdown_handler(void) {
+    storage_flush();
+}
+
+/*
+ * Waits for the first write, then keeps absorbing writes until either they go
+ * idle for CONFIG_MK3_STATE_FLUSH_IDLE_MS or CONFIG_MK3_STATE_FLUSH_WINDOW_MS
+ * has passed since the first one, and commits everything in one go.
+ */
+static void storage_flush_task(void *arg) {
+    const TickType_t window = pdMS_TO_TICKS(CONFIG_MK3_STATE_FLUSH_WINDOW_MS);
+    const TickType_t idle = pdMS_TO_TICKS(CONFIG_MK3_STATE_FLUSH_IDLE_MS);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        TickType_t first_write = xTaskGetTickCount();
+
+        while (true) {
+            TickType_t elapsed = xTaskGetTickCount() - first_write;
+            if (elapsed >= window) {
+                break;
+            }
+            TickType_t wait = MIN(idle, window - elapsed);
+            if (ulTaskNotifyTake(pdTRUE, wait) == 0) {
+                break; // writes went idle
+            }
+        }
+        storage_flush();
+    }
+}
+
+static uint32_t storage_set(state_field_t field, uint8_t val) {
+    TRACE_SPAN_BEGIN(span);
+    uint32_t gen = 0;
+    portENTER_CRITICAL(&shadow_lock);
+    stats.writes++;
+    if (shadow[field] != val) {
+        shadow[field] = val;
+        dirty_mask |= 1 << field;
+        gen = ++generation;
+        changed_at[field] = gen;
+    } else {
+        stats.writes_unchanged++;
+    }
+    portEXIT_CRITICAL(&shadow_lock);
+
+    if (gen == 0) {
+        TRACE_SPAN_END(span, TRACE_EV_NVS_WRITE, field);
+        return 0;
+    }
+    if (flush_task) {
+        xTaskNotifyGive(flush_task);
+    } else {
+        // No background flusher, fall back to write-through
+        storage_flush();
+    }
+    TRACE_SPAN_END(span, TRACE_EV_NVS_WRITE, field);
+    return gen;
+}
+
+// Same as storage_set() for several fields; negative values are left alone
+static uint32_t storage_set_many(const int *values) {
+    TRACE_SPAN_BEGIN(span);
+    uint32_t changed = 0;
+    uint32_t gen = 0;
+    portENTER_CRITICAL(&shadow_lock);
+    for (int i = 0; i < FIELD_MAX; ++i) {
+        if (values[i] < 0) {
+            continue;
+        }
+        stats.writes++;
+        if (shadow[i] != values[i]) {
+            shadow[i] = values[i];
+            changed |= 1 << i;
+        } else {
+            stats.writes_unchanged++;
+        }
+    }
+    if (changed) {
+        dirty_mask |= changed;
+        gen = ++generation;
+        for (int i = 0; i < FIELD_MAX; ++i) {
+            if (changed & (1 << i)) {
+                changed_at[i] = gen;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&shadow_lock);
+
+    if (gen != 0) {
+        if (flush_task) {
+            xTaskNotifyGive(flush_task);
+        } else {
+            storage_flush();
+        }
+    }
+    TRACE_SPAN_END(span, TRACE_EV_NVS_WRITE, FIELD_MAX);
+    return gen;
+}
+
+esp_err_t init_nvs(void) {
     // Initialize NVS
     ESP_LOGI(NVS_TAG, "Initializing NVS..");
     esp_err_t err = nvs_flash_init();
@@ -91,46 +347,82 @@ esp_err_t init_nvs() {
         ESP_ERROR_CHECK(nvs_flash_erase());
         err = nvs_flash_init();
     }
+    if (err != ESP_OK) {
+        return err;
+    }
 
-    // Check if any values are initialized, if not then write them:
-    uint8_t led, visor;
-    uint8_t defaultLed = 0;
-    uint8_t defaultVisor = 0;
-    esp_err_t read_err;
-    err = nvs_read(LED_NAME, &led, &read_err);
-    if (read_err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGI(NVS_TAG, "LED value not initalized, initializing..");
-        nvs_write(LED_NAME, defaultLed);
+    // Generations are not persisted: start each boot at a random point so that a
+    // generation remembered by a client from a previous boot is almost surely
+    // either ahead of the current one or older than every field.
+    generation = (esp_random() & 0x3fffffff) + 1;
+    for (int i = 0; i < FIELD_MAX; ++i) {
+        changed_at[i] = generation;
     }
-    err = nvs_read(VISOR_NAME, &visor, &read_err);
-    if(read_err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGI(NVS_TAG, "Visor value not initialized, initializing..");
-        nvs_write(VISOR_NAME, defaultVisor);
+
+    // Load everything into the RAM shadow, rewriting it if missing or in an older layout
+    if (nvs_load(shadow)) {
+        ESP_LOGI(NVS_TAG, "Initializing stored state..");
+        dirty_mask = (1 << FIELD_MAX) - 1;
+        if (storage_flush() == ESP_OK) {
+            nvs_erase_legacy_keys();
+        }
     }
 
-    return err;
+    flush_lock = xSemaphoreCreateMutex();
+    if (flush_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(storage_flush_task, "nvs_flush_task", CONFIG_MK3_STATE_FLUSH_TASK_STACK_SIZE,
+                    NULL, tskIDLE_PRIORITY + 1, &flush_task) != pdPASS) {
+        ESP_LOGW(NVS_TAG, "Cannot start flusher task, writing through");
+        flush_task = NULL;
+    }
+    // Note: the brownout detector resets the chip without running shutdown
+    // handlers, so at most one dirty window of changes can be lost there.
+    esp_register_shutdown_handler(storage_shutdown_handler);
+
+    return ESP_OK;
 }
 
-uint8_t read_led() {
-    uint8_t val = 0; // default to 0
-    esp_err_t read_err;
-    nvs_read(LED_NAME, &val, &read_err);
+uint8_t read_led(void) {
+    return shadow[FIELD_LED];
+}
 
-    return val;
+uint8_t read_visor(void) {
+    return shadow[FIELD_VISOR];
 }
 
-uint8_t read_visor() {
-    uint8_t val = 0;
-    esp_err_t read_err;
-    nvs_read(VISOR_NAME, &val, &read_err);
+uint32_t write_led(uint8_t val) {
+    return storage_set(FIELD_LED, val);
+}
 
-    return val;
+uint32_t write_visor(uint8_t val) {
+    return storage_set(FIELD_VISOR, val);
 }
 
-void write_led(uint8_t val) {
-    nvs_write(LED_NAME, val);
+uint32_t write_scene(int led, int visor) {
+    const int values[FIELD_MAX] = {
+        [FIELD_LED] = led,
+        [FIELD_VISOR] = visor,
+    };
+    return storage_set_many(values);
 }
 
-void write_visor(uint8_t val) {
-    nvs_write(VISOR_NAME, val);
-}
\ No newline at end of file
+uint32_t storage_generation(void) {
+    return __atomic_load_n(&generation, __ATOMIC_RELAXED);
+}
+
+uint32_t read_led_generation(void) {
+    return __atomic_load_n(&changed_at[FIELD_LED], __ATOMIC_RELAXED);
+}
+
+uint32_t read_visor_generation(void) {
+    return __atomic_load_n(&changed_at[FIELD_VISOR], __ATOMIC_RELAXED);
+}
+
+void storage_get_stats(storage_stats_t *out) {
+    portENTER_CRITICAL(&shadow_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&shadow_lock);
+    out->commits_avoided = out->writes > out->commits ? out->writes - out->commits : 0;
+}
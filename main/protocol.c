@@ -0,0 +1,603 @@
+/* WebSocket control protocol
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "protocol.h"
+
+static const char FIELD_TYPES[PROTO_FIELD_MAX] = {
+    [PROTO_FIELD_LED] = PROTO_TEXT_TYPE_LED,
+    [PROTO_FIELD_VISOR] = PROTO_TEXT_TYPE_VISOR,
+};
+
+static const uint8_t FIELD_MAX_VALUES[PROTO_FIELD_MAX] = {
+    [PROTO_FIELD_LED] = 255,
+    [PROTO_FIELD_VISOR] = 1,
+};
+
+static const uint8_t FIELD_IDS[PROTO_FIELD_MAX] = {
+    [PROTO_FIELD_LED] = PROTO_BIN_FIELD_LED,
+    [PROTO_FIELD_VISOR] = PROTO_BIN_FIELD_VISOR,
+};
+
+static int field_from_type(uint8_t type)
+{
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if (FIELD_TYPES[i] == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int field_from_id(uint8_t id)
+{
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if (FIELD_IDS[i] == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Parses 1 to 3 decimal digits, rejecting anything else
+static proto_err_t parse_u8(const uint8_t *str, size_t len, uint8_t *out)
+{
+    if (len == 0 || len > 3) {
+        return PROTO_ERR_INVALID;
+    }
+    unsigned val = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] < '0' || str[i] > '9') {
+            return PROTO_ERR_INVALID;
+        }
+        val = val * 10 + (str[i] - '0');
+    }
+    if (val > UINT8_MAX) {
+        return PROTO_ERR_RANGE;
+    }
+    *out = (uint8_t)val;
+    return PROTO_OK;
+}
+
+// Parses 1 to 10 decimal digits into a 32-bit value, rejecting anything else
+static proto_err_t parse_u32(const uint8_t *str, size_t len, uint32_t *out)
+{
+    if (len == 0 || len > 10) {
+        return PROTO_ERR_INVALID;
+    }
+    uint64_t val = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] < '0' || str[i] > '9') {
+            return PROTO_ERR_INVALID;
+        }
+        val = val * 10 + (str[i] - '0');
+    }
+    if (val > UINT32_MAX) {
+        return PROTO_ERR_RANGE;
+    }
+    *out = (uint32_t)val;
+    return PROTO_OK;
+}
+
+static size_t format_u32(uint32_t val, char *out)
+{
+    char digits[10];
+    size_t count = 0;
+    do {
+        digits[count++] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+static size_t put_generation(uint8_t *out, uint32_t gen)
+{
+    out[0] = PROTO_BIN_FIELD_GENERATION;
+    out[1] = gen;
+    out[2] = gen >> 8;
+    out[3] = gen >> 16;
+    out[4] = gen >> 24;
+    return 5;
+}
+
+size_t proto_format_field(proto_field_t field, uint8_t val, uint32_t gen, char *out)
+{
+    size_t len = 0;
+    out[len++] = FIELD_TYPES[field];
+    len += format_u32(val, out + len);
+    out[len++] = PROTO_TEXT_GENERATION;
+    len += format_u32(gen, out + len);
+    out[len] = '\0';
+    return len;
+}
+
+void proto_format_batch(const proto_set_t *sets, size_t count, uint32_t gen, proto_update_t *update)
+{
+    size_t text_len = 0;
+    size_t binary_len = 0;
+    update->topics = 0;
+    update->generation = gen;
+    update->binary[binary_len++] = PROTO_BIN_OP_STATE;
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            update->text[text_len++] = PROTO_TEXT_BATCH_SEP;
+        }
+        text_len += proto_format_field(sets[i].field, sets[i].val, gen, update->text + text_len);
+        update->binary[binary_len++] = FIELD_IDS[sets[i].field];
+        update->binary[binary_len++] = sets[i].val;
+        update->topics |= PROTO_TOPIC(sets[i].field);
+    }
+    update->text_len = text_len;
+    update->binary_len = binary_len + put_generation(update->binary + binary_len, gen);
+}
+
+void proto_format_update(proto_field_t field, uint8_t val, uint32_t gen, proto_update_t *update)
+{
+    update->topics = PROTO_TOPIC(field);
+    update->generation = gen;
+    update->text_len = proto_format_field(field, val, gen, update->text);
+    update->binary[0] = PROTO_BIN_OP_STATE;
+    update->binary[1] = FIELD_IDS[field];
+    update->binary[2] = val;
+    update->binary_len = 3 + put_generation(update->binary + 3, gen);
+}
+
+size_t proto_format_event(const proto_update_t *update, char *out)
+{
+    size_t len = 0;
+    memcpy(out + len, "id: ", 4);
+    len += 4;
+    len += format_u32(update->generation, out + len);
+    memcpy(out + len, "\ndata: ", 7);
+    len += 7;
+    memcpy(out + len, update->text, update->text_len);
+    len += update->text_len;
+    memcpy(out + len, "\n\n", 3);
+    return len + 2;
+}
+
+static void reply_field(const proto_ops_t *ops, void *conn, proto_field_t field)
+{
+    char buf[PROTO_TEXT_MAX_LEN];
+    size_t len = proto_format_field(field, ops->load(field), ops->changed_at(field), buf);
+    ops->reply(conn, PROTO_ENC_TEXT, (const uint8_t *)buf, len);
+}
+
+/*
+ * A generation ahead of the current one was seen before a reboot, and
+ * generations restart elsewhere on every boot, so everything is stale then.
+ */
+static bool changed_since(const proto_ops_t *ops, proto_field_t field, uint32_t since, uint32_t current)
+{
+    return since >= current ? since > current : ops->changed_at(field) > since;
+}
+
+size_t proto_fields_since(const proto_ops_t *ops, uint32_t since, proto_field_t *fields)
+{
+    uint32_t current = ops->generation();
+    size_t count = 0;
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if (!changed_since(ops, i, since, current)) {
+            continue;
+        }
+        // Insertion sort, there are only a few fields
+        uint32_t gen = ops->changed_at(i);
+        size_t pos = count++;
+        while (pos > 0 && ops->changed_at(fields[pos - 1]) > gen) {
+            fields[pos] = fields[pos - 1];
+            pos--;
+        }
+        fields[pos] = i;
+    }
+    return count;
+}
+
+static bool admitted(const proto_ops_t *ops, void *conn, proto_class_t cls)
+{
+    return ops->admit == NULL || ops->admit(conn, cls);
+}
+
+static proto_err_t reply_busy(const proto_ops_t *ops, void *conn, proto_encoding_t enc, uint8_t op)
+{
+    if (enc == PROTO_ENC_BINARY) {
+        const uint8_t busy[] = { PROTO_BIN_OP_BUSY, op };
+        ops->reply(conn, enc, busy, sizeof(busy));
+    } else {
+        ops->reply(conn, enc, (const uint8_t *)PROTO_TEXT_BUSY, strlen(PROTO_TEXT_BUSY));
+    }
+    return PROTO_ERR_BUSY;
+}
+
+// Validates, applies, persists and broadcasts a new value
+static proto_err_t apply_set(const proto_ops_t *ops, proto_field_t field, uint8_t val)
+{
+    if (val > FIELD_MAX_VALUES[field]) {
+        return PROTO_ERR_RANGE;
+    }
+    // Actuated even if unchanged, it also ends whatever an effect is doing
+    if (!ops->actuate(field, val)) {
+        return PROTO_ERR_BUSY;
+    }
+    uint32_t gen = ops->store(field, val);
+    if (gen == 0) {
+        return PROTO_OK;
+    }
+
+    proto_update_t update;
+    proto_format_update(field, val, gen, &update);
+    ops->broadcast(&update);
+    return PROTO_OK;
+}
+
+/*
+ * Checks a whole batch before touching anything, then applies, persists and
+ * broadcasts it as one change. The actuators take every member or none.
+ */
+static proto_err_t apply_batch(const proto_ops_t *ops, const proto_set_t *sets, size_t count)
+{
+    if (count == 1) {
+        return apply_set(ops, sets[0].field, sets[0].val);
+    }
+    if (ops->store_batch == NULL || ops->actuate_batch == NULL) {
+        return PROTO_ERR_INVALID;
+    }
+    uint32_t fields = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (fields & PROTO_TOPIC(sets[i].field)) {
+            return PROTO_ERR_INVALID;
+        }
+        fields |= PROTO_TOPIC(sets[i].field);
+        if (sets[i].val > FIELD_MAX_VALUES[sets[i].field]) {
+            return PROTO_ERR_RANGE;
+        }
+    }
+    if (!ops->actuate_batch(sets, count)) {
+        return PROTO_ERR_BUSY;
+    }
+    uint32_t gen = ops->store_batch(sets, count);
+    if (gen != 0) {
+        // Sets to the value already stored are not broadcast
+        proto_set_t changed[PROTO_FIELD_MAX];
+        size_t changed_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (ops->changed_at(sets[i].field) == gen) {
+                changed[changed_count++] = sets[i];
+            }
+        }
+        if (changed_count) {
+            proto_update_t update;
+            proto_format_batch(changed, changed_count, gen, &update);
+            ops->broadcast(&update);
+        }
+    }
+    return PROTO_OK;
+}
+
+proto_err_t proto_apply_set(const proto_ops_t *ops, proto_field_t field, uint8_t val)
+{
+    if (field >= PROTO_FIELD_MAX) {
+        return PROTO_ERR_INVALID;
+    }
+    return apply_set(ops, field, val);
+}
+
+// Sends the fields changed after a generation, then the current generation
+static void reply_since(const proto_ops_t *ops, void *conn, uint32_t since)
+{
+    uint32_t current = ops->generation();
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if (changed_since(ops, i, since, current)) {
+            reply_field(ops, conn, i);
+        }
+    }
+    char buf[PROTO_TEXT_MAX_LEN];
+    size_t len = 0;
+    buf[len++] = PROTO_TEXT_GENERATION;
+    len += format_u32(current, buf + len);
+    ops->reply(conn, PROTO_ENC_TEXT, (const uint8_t *)buf, len);
+}
+
+static proto_err_t handle_get(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    // If we're only getting a generic "GET" command, send everything
+    if (len == 1) {
+        reply_since(ops, conn, 0);
+        return PROTO_OK;
+    }
+    if (payload[1] == PROTO_TEXT_GENERATION) {
+        uint32_t since;
+        proto_err_t err = parse_u32(payload + 2, len - 2, &since);
+        if (err != PROTO_OK) {
+            return err;
+        }
+        reply_since(ops, conn, since);
+        return PROTO_OK;
+    }
+    int field = field_from_type(payload[1]);
+    if (field < 0) {
+        return PROTO_ERR_INVALID;
+    }
+    reply_field(ops, conn, field);
+    return PROTO_OK;
+}
+
+// Parses one "s<type><n>" member of a set command
+static proto_err_t parse_set(const uint8_t *cmd, size_t len, proto_set_t *set)
+{
+    if (len < 3 || cmd[0] != PROTO_TEXT_SET_STATE) {
+        return PROTO_ERR_INVALID;
+    }
+    int field = field_from_type(cmd[1]);
+    if (field < 0) {
+        return PROTO_ERR_INVALID;
+    }
+    set->field = field;
+    return parse_u8(cmd + 2, len - 2, &set->val);
+}
+
+static proto_err_t handle_set(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    proto_set_t sets[PROTO_FIELD_MAX];
+    size_t count = 0;
+    const uint8_t *cmd = payload;
+    const uint8_t *end = payload + len;
+    while (true) {
+        const uint8_t *sep = memchr(cmd, PROTO_TEXT_BATCH_SEP, end - cmd);
+        if (count == PROTO_FIELD_MAX) {
+            return PROTO_ERR_INVALID;
+        }
+        proto_err_t err = parse_set(cmd, (sep ? sep : end) - cmd, &sets[count++]);
+        if (err != PROTO_OK) {
+            return err;
+        }
+        if (sep == NULL) {
+            break;
+        }
+        cmd = sep + 1;
+    }
+    proto_err_t err = apply_batch(ops, sets, count);
+    if (err == PROTO_ERR_BUSY) {
+        return reply_busy(ops, conn, PROTO_ENC_TEXT, payload[0]);
+    }
+    if (err != PROTO_OK) {
+        return err;
+    }
+    // "ok" and the type of every field set
+    char ack[2 + PROTO_FIELD_MAX];
+    ack[0] = 'o';
+    ack[1] = 'k';
+    for (size_t i = 0; i < count; ++i) {
+        ack[2 + i] = FIELD_TYPES[sets[i].field];
+    }
+    ops->reply(conn, PROTO_ENC_TEXT, (const uint8_t *)ack, 2 + count);
+    return PROTO_OK;
+}
+
+static proto_err_t handle_run(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    uint8_t id;
+    proto_err_t err = parse_u8(payload + 1, len - 1, &id);
+    if (err != PROTO_OK) {
+        return err;
+    }
+    if (!ops->run_sequence(id)) {
+        return PROTO_ERR_RANGE;
+    }
+    ops->reply(conn, PROTO_ENC_TEXT, (const uint8_t *)"okc", 3);
+    return PROTO_OK;
+}
+
+static proto_err_t handle_subscribe(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (ops->subscribe == NULL) {
+        return PROTO_ERR_INVALID;
+    }
+    uint32_t topics = 0;
+    for (size_t i = 1; i < len; ++i) {
+        int field = field_from_type(payload[i]);
+        if (field < 0) {
+            return PROTO_ERR_INVALID;
+        }
+        topics |= PROTO_TOPIC(field);
+    }
+    if (!ops->subscribe(conn, topics)) {
+        return PROTO_ERR_INVALID;
+    }
+    ops->reply(conn, PROTO_ENC_TEXT, (const uint8_t *)"okt", 3);
+    return PROTO_OK;
+}
+
+proto_err_t proto_handle_text(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (len == 0) {
+        return PROTO_ERR_INVALID;
+    }
+    proto_class_t cls;
+    switch (payload[0]) {
+        case PROTO_TEXT_GET_STATE:
+        case PROTO_TEXT_SUBSCRIBE:
+            cls = PROTO_CLASS_GET;
+            break;
+        case PROTO_TEXT_SET_STATE:
+        case PROTO_TEXT_RUN_SEQUENCE:
+            cls = PROTO_CLASS_SET;
+            break;
+        default:
+            return PROTO_ERR_INVALID;
+    }
+    if (!admitted(ops, conn, cls)) {
+        return reply_busy(ops, conn, PROTO_ENC_TEXT, payload[0]);
+    }
+    switch (payload[0]) {
+        case PROTO_TEXT_GET_STATE:
+            return handle_get(ops, conn, payload, len);
+        case PROTO_TEXT_SET_STATE:
+            return handle_set(ops, conn, payload, len);
+        case PROTO_TEXT_SUBSCRIBE:
+            return handle_subscribe(ops, conn, payload, len);
+        default:
+            return handle_run(ops, conn, payload, len);
+    }
+}
+
+static proto_err_t handle_binary_get(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    uint8_t buf[PROTO_BIN_MAX_LEN];
+    size_t buf_len = 0;
+    buf[buf_len++] = PROTO_BIN_OP_STATE;
+
+    if (len == 1) {
+        for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+            buf[buf_len++] = FIELD_IDS[i];
+            buf[buf_len++] = ops->load(i);
+        }
+    } else {
+        if (len - 1 > PROTO_FIELD_MAX) {
+            return PROTO_ERR_INVALID;
+        }
+        for (size_t i = 1; i < len; ++i) {
+            int field = field_from_id(payload[i]);
+            if (field < 0) {
+                return PROTO_ERR_INVALID;
+            }
+            buf[buf_len++] = payload[i];
+            buf[buf_len++] = ops->load(field);
+        }
+    }
+    buf_len += put_generation(buf + buf_len, ops->generation());
+    ops->reply(conn, PROTO_ENC_BINARY, buf, buf_len);
+    return PROTO_OK;
+}
+
+static proto_err_t handle_binary_sync(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (len != 5) {
+        return PROTO_ERR_INVALID;
+    }
+    uint32_t since = payload[1] | payload[2] << 8 | payload[3] << 16 | (uint32_t)payload[4] << 24;
+    uint32_t current = ops->generation();
+
+    uint8_t buf[PROTO_BIN_MAX_LEN];
+    size_t buf_len = 0;
+    buf[buf_len++] = PROTO_BIN_OP_STATE;
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if (changed_since(ops, i, since, current)) {
+            buf[buf_len++] = FIELD_IDS[i];
+            buf[buf_len++] = ops->load(i);
+        }
+    }
+    buf_len += put_generation(buf + buf_len, current);
+    ops->reply(conn, PROTO_ENC_BINARY, buf, buf_len);
+    return PROTO_OK;
+}
+
+static proto_err_t handle_binary_set(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (len < 2) {
+        return PROTO_ERR_INVALID;
+    }
+    proto_set_t sets[PROTO_FIELD_MAX];
+    size_t count = 0;
+    for (size_t i = 1; i < len; i += 1 + PROTO_BIN_FIELD_WIDTH(payload[i])) {
+        int field = field_from_id(payload[i]);
+        if (field < 0 || count == PROTO_FIELD_MAX || i + 1 + PROTO_BIN_FIELD_WIDTH(payload[i]) > len) {
+            return PROTO_ERR_INVALID;
+        }
+        sets[count++] = (proto_set_t) { field, payload[i + 1] };
+    }
+    proto_err_t err = apply_batch(ops, sets, count);
+    if (err == PROTO_ERR_BUSY) {
+        return reply_busy(ops, conn, PROTO_ENC_BINARY, payload[0]);
+    }
+    if (err != PROTO_OK) {
+        return err;
+    }
+    uint8_t ack[1 + PROTO_FIELD_MAX];
+    ack[0] = PROTO_BIN_OP_ACK;
+    for (size_t i = 0; i < count; ++i) {
+        ack[1 + i] = FIELD_IDS[sets[i].field];
+    }
+    ops->reply(conn, PROTO_ENC_BINARY, ack, 1 + count);
+    return PROTO_OK;
+}
+
+static proto_err_t handle_binary_run(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (len != 2) {
+        return PROTO_ERR_INVALID;
+    }
+    if (!ops->run_sequence(payload[1])) {
+        return PROTO_ERR_RANGE;
+    }
+    const uint8_t ack[] = { PROTO_BIN_OP_RUN_ACK, payload[1] };
+    ops->reply(conn, PROTO_ENC_BINARY, ack, sizeof(ack));
+    return PROTO_OK;
+}
+
+static proto_err_t handle_binary_subscribe(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (ops->subscribe == NULL || len - 1 > PROTO_FIELD_MAX) {
+        return PROTO_ERR_INVALID;
+    }
+    uint32_t topics = 0;
+    for (size_t i = 1; i < len; ++i) {
+        int field = field_from_id(payload[i]);
+        if (field < 0) {
+            return PROTO_ERR_INVALID;
+        }
+        topics |= PROTO_TOPIC(field);
+    }
+    if (!ops->subscribe(conn, topics)) {
+        return PROTO_ERR_INVALID;
+    }
+    // Echoes the IDs, so the ack fits the same bound as the command
+    uint8_t ack[1 + PROTO_FIELD_MAX];
+    ack[0] = PROTO_BIN_OP_SUB_ACK;
+    memcpy(ack + 1, payload + 1, len - 1);
+    ops->reply(conn, PROTO_ENC_BINARY, ack, len);
+    return PROTO_OK;
+}
+
+proto_err_t proto_handle_binary(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len)
+{
+    if (len == 0) {
+        return PROTO_ERR_INVALID;
+    }
+    proto_class_t cls;
+    switch (payload[0]) {
+        case PROTO_BIN_OP_GET:
+        case PROTO_BIN_OP_SYNC:
+        case PROTO_BIN_OP_SUBSCRIBE:
+            cls = PROTO_CLASS_GET;
+            break;
+        case PROTO_BIN_OP_SET:
+        case PROTO_BIN_OP_RUN:
+            cls = PROTO_CLASS_SET;
+            break;
+        default:
+            return PROTO_ERR_INVALID;
+    }
+    if (!admitted(ops, conn, cls)) {
+        return reply_busy(ops, conn, PROTO_ENC_BINARY, payload[0]);
+    }
+    switch (payload[0]) {
+        case PROTO_BIN_OP_GET:
+            return handle_binary_get(ops, conn, payload, len);
+        case PROTO_BIN_OP_SYNC:
+            return handle_binary_sync(ops, conn, payload, len);
+        case PROTO_BIN_OP_SET:
+            return handle_binary_set(ops, conn, payload, len);
+        case PROTO_BIN_OP_SUBSCRIBE:
+            return handle_binary_subscribe(ops, conn, payload, len);
+        default:
+            return handle_binary_run(ops, conn, payload, len);
+    }
+}
@@ -0,0 +1,274 @@
+/* WebSocket control protocol
+
+   Parsing and dispatch of the commands received on /ws. This module has
+   no ESP-IDF dependencies: storage, actuators and the transport are reached
+   only through the callbacks in proto_ops_t, so it also builds on the host.
+
+   Every change of a value bumps the state generation by one, and every value
+   sent is stamped with the generation at which it last changed. A client that
+   sees a gap in the generations, or reconnects, asks for what changed since
+   the last generation it saw instead of the whole state.
+
+   Text commands:
+     g          get all values, answered with one frame per field ("l<n>@<gen>",
+                "v<n>@<gen>") followed by the current generation ("@<gen>")
+     g@<gen>    same, but only the fields changed after the given generation
+     gl / gv    get a single value
+     sl<n>      set LED brightness (0-255), answered with "okl"
+     sv<n>      set visor state (0 = down, 1 = up), answered with "okv"
+     sl<n>;sv<n>
+                several sets in one frame, at most one per field, answered
+                with one ack ("oklv")
+     c<n>       run stored sequence n (see choreo.h), answered with "okc"
+     t<types>   subscribe to the updates of the listed fields only ("tl", "tlv";
+                "t" for none), answered with "okt"
+   Every change is broadcast to the clients subscribed to its field (all of
+   them unless they sent a subscribe command) as "l<n>@<gen>" / "v<n>@<gen>";
+   a set to the value already stored is acknowledged but not broadcast. Sets
+   are acknowledged once ops->actuate accepted them, not when the hardware is
+   done. A command refused by ops->admit or ops->actuate is answered with "busy".
+
+   A batch of sets is checked as a whole before anything is applied, so a
+   malformed or out of range member changes nothing. Its changes are stored
+   as one change, sharing one generation, and broadcast as one update:
+   "l<n>@<gen>;v<n>@<gen>" in text, one STATE frame in binary, to the clients
+   subscribed to any of the fields. The members are handed to the actuators
+   together through ops->actuate_batch: if it refuses the batch, nothing is
+   applied, stored or broadcast, and the batch is answered with "busy", so a
+   client can simply send it again.
+
+   Binary commands, used by clients that negotiate PROTO_BIN_SUBPROTOCOL:
+     [GET]                      snapshot of every field in one STATE frame
+     [GET, id...]               snapshot of the listed fields
+     [SET, id, value]           set a field, answered with [ACK, id]
+     [SET, (id, value)...]      batch of sets, answered with [ACK, id...]
+     [RUN, n]                   run stored sequence n, answered with [RUN_ACK, n]
+     [SYNC, gen]                snapshot of the fields changed after gen
+     [SUBSCRIBE, id...]         subscribe to the listed fields only, answered
+                                with [SUB_ACK, id...]
+   Server frames:
+     [STATE, (id, value)..., GENERATION, gen]
+                                snapshot, or a single-field update on broadcast
+     [ACK, id...]
+     [RUN_ACK, n]
+     [BUSY, op]                 command refused, try again later
+     [SUB_ACK, id...]
+   Server-Sent Events, for read-only clients of /api/v1/events:
+     id: <gen>
+     data: l<n>@<gen>           one event per field update, with the text frame
+                                as data and the generation as event ID
+   A stream resumed with Last-Event-ID starts with the fields changed after
+   that generation, otherwise with every field.
+
+   Bits 7..6 of a field ID give the width of its value minus one (values are
+   little endian), so a receiver can skip fields it does not know. The
+   GENERATION pseudo-field is 4 bytes wide.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROTO_TEXT_GET_STATE    'g'
+#define PROTO_TEXT_SET_STATE    's'
+#define PROTO_TEXT_RUN_SEQUENCE 'c'
+#define PROTO_TEXT_SUBSCRIBE    't'
+#define PROTO_TEXT_TYPE_LED     'l'
+#define PROTO_TEXT_TYPE_VISOR   'v'
+#define PROTO_TEXT_GENERATION   '@'
+#define PROTO_TEXT_BUSY         "busy"
+
+/* Longest text frame produced by this module for one field, including the terminating NUL */
+#define PROTO_TEXT_MAX_LEN      16
+
+#define PROTO_TEXT_BATCH_SEP    ';'
+
+#define PROTO_BIN_SUBPROTOCOL   "mk3.bin.v1"
+
+#define PROTO_BIN_OP_GET        0x01
+#define PROTO_BIN_OP_SET        0x02
+#define PROTO_BIN_OP_RUN        0x03
+#define PROTO_BIN_OP_SYNC       0x04
+#define PROTO_BIN_OP_SUBSCRIBE  0x05
+#define PROTO_BIN_OP_STATE      0x81
+#define PROTO_BIN_OP_ACK        0x82
+#define PROTO_BIN_OP_RUN_ACK    0x83
+#define PROTO_BIN_OP_BUSY       0x84
+#define PROTO_BIN_OP_SUB_ACK    0x85
+
+#define PROTO_BIN_FIELD_LED     0x01
+#define PROTO_BIN_FIELD_VISOR   0x02
+#define PROTO_BIN_FIELD_GENERATION  0xC1
+#define PROTO_BIN_FIELD_WIDTH(id)   (((id) >> 6) + 1)
+
+typedef enum {
+    PROTO_OK = 0,
+    PROTO_ERR_INVALID = -1,     /*!< malformed or unknown command */
+    PROTO_ERR_RANGE = -2,       /*!< value out of range for the field */
+    PROTO_ERR_BUSY = -3,        /*!< command could not be queued, nothing was changed */
+} proto_err_t;
+
+typedef enum {
+    PROTO_FIELD_LED = 0,
+    PROTO_FIELD_VISOR,
+    PROTO_FIELD_MAX,
+} proto_field_t;
+
+/* Broadcast topics, one per field, as a mask */
+#define PROTO_TOPIC(field)      (1u << (field))
+#define PROTO_TOPIC_ALL         (PROTO_TOPIC(PROTO_FIELD_MAX) - 1)
+
+/* Commands are rate limited per class */
+typedef enum {
+    PROTO_CLASS_GET = 0,        /*!< reads */
+    PROTO_CLASS_SET,            /*!< sets and sequence runs */
+    PROTO_CLASS_MAX,
+} proto_class_t;
+
+/* Longest update produced by this module: every field, separated by PROTO_TEXT_BATCH_SEP */
+#define PROTO_UPDATE_TEXT_MAX_LEN   (PROTO_FIELD_MAX * PROTO_TEXT_MAX_LEN)
+
+/* Longest Server-Sent Event produced by this module, including the terminating NUL */
+#define PROTO_EVENT_MAX_LEN     (sizeof("id: 4294967295\ndata: \n\n") + PROTO_UPDATE_TEXT_MAX_LEN)
+
+/* Bound on the length of the commands accepted: a resync from any generation, a batch setting every field */
+#define PROTO_COMMAND_MAX_LEN   (sizeof("g@4294967295") + PROTO_FIELD_MAX * sizeof("sl255;"))
+
+/* Largest binary frame produced by this module: a snapshot of every field */
+#define PROTO_BIN_MAX_LEN       (1 + 2 * PROTO_FIELD_MAX + 5)
+
+typedef enum {
+    PROTO_ENC_TEXT = 0,
+    PROTO_ENC_BINARY,
+} proto_encoding_t;
+
+/**
+ * @brief One set of a batch
+ */
+typedef struct {
+    proto_field_t field;
+    uint8_t val;
+} proto_set_t;
+
+/**
+ * @brief An update of one or more fields, preformatted in every encoding so broadcasts can pick per client
+ */
+typedef struct {
+    uint32_t topics;                    /*!< PROTO_TOPIC mask of the fields updated, picks the recipients */
+    uint32_t generation;                /*!< generation at which the values changed */
+    char text[PROTO_UPDATE_TEXT_MAX_LEN];   /*!< NUL-terminated text frame */
+    uint8_t text_len;
+    uint8_t binary[PROTO_BIN_MAX_LEN];  /*!< binary STATE frame */
+    uint8_t binary_len;
+} proto_update_t;
+
+/**
+ * @brief Callbacks used by the protocol to reach the rest of the firmware
+ */
+typedef struct {
+    uint8_t (*load)(proto_field_t field);                           /*!< read the current value */
+    uint32_t (*store)(proto_field_t field, uint8_t val);            /*!< persist a new value, returns its generation, 0 if unchanged */
+    uint32_t (*store_batch)(const proto_set_t *sets, size_t count); /*!< persist several values as one change, returns the
+                                                                         generation of the changed ones, 0 if none changed;
+                                                                         may be NULL if batches are not supported */
+    uint32_t (*changed_at)(proto_field_t field);                    /*!< generation of the field's last change */
+    uint32_t (*generation)(void);                                   /*!< current generation */
+    bool (*actuate)(proto_field_t field, uint8_t val);              /*!< queue a hardware update, false if refused */
+    bool (*actuate_batch)(const proto_set_t *sets, size_t count);   /*!< queue the updates of every member, or of none and
+                                                                         return false; may be NULL if batches are not supported */
+    void (*reply)(void *conn, proto_encoding_t enc,
+                  const uint8_t *msg, size_t len);                  /*!< send to the requesting client */
+    void (*broadcast)(const proto_update_t *update);                /*!< send to every client subscribed to one of the fields */
+    bool (*run_sequence)(uint8_t id);                               /*!< start a stored sequence, false if unknown */
+    bool (*admit)(void *conn, proto_class_t cls);                   /*!< admission control, false to refuse; may be NULL */
+    bool (*subscribe)(void *conn, uint32_t topics);                 /*!< replace the client's PROTO_TOPIC mask;
+                                                                         may be NULL if every client gets every update */
+} proto_ops_t;
+
+/**
+ * @brief Parses and executes one text frame
+ *
+ * @param ops protocol callbacks
+ * @param conn opaque connection handle, passed back to ops->reply
+ * @param payload frame payload, not necessarily NUL-terminated
+ * @param len payload length
+ * @return PROTO_OK on success
+ */
+proto_err_t proto_handle_text(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len);
+
+/**
+ * @brief Parses and executes one binary frame
+ *
+ * @param ops protocol callbacks
+ * @param conn opaque connection handle, passed back to ops->reply
+ * @param payload frame payload
+ * @param len payload length
+ * @return PROTO_OK on success
+ */
+proto_err_t proto_handle_binary(const proto_ops_t *ops, void *conn, const uint8_t *payload, size_t len);
+
+/**
+ * @brief Applies a set coming from outside the WebSocket protocol, such as a REST call
+ *
+ * Validated, actuated, persisted and broadcast exactly like a set command,
+ * so every client sees the change whatever its origin.
+ *
+ * @param ops protocol callbacks
+ * @param field field to set
+ * @param val new value
+ * @return PROTO_OK, PROTO_ERR_RANGE if val is out of range, PROTO_ERR_BUSY if the actuator refused it
+ */
+proto_err_t proto_apply_set(const proto_ops_t *ops, proto_field_t field, uint8_t val);
+
+/**
+ * @brief Formats a field update ("l<n>@<gen>" / "v<n>@<gen>")
+ *
+ * @param field field to format
+ * @param val value
+ * @param gen generation at which the value changed
+ * @param out output buffer of at least PROTO_TEXT_MAX_LEN bytes
+ * @return length of the formatted string, excluding the NUL
+ */
+size_t proto_format_field(proto_field_t field, uint8_t val, uint32_t gen, char *out);
+
+/**
+ * @brief Formats a field update in every encoding
+ *
+ * @param field field to format
+ * @param val value
+ * @param gen generation at which the value changed
+ * @param update output
+ */
+void proto_format_update(proto_field_t field, uint8_t val, uint32_t gen, proto_update_t *update);
+
+/**
+ * @brief Formats an update of several fields that changed together in every encoding
+ *
+ * @param sets fields and values, at most one per field
+ * @param count number of sets, at least one
+ * @param gen generation at which the values changed
+ * @param update output
+ */
+void proto_format_batch(const proto_set_t *sets, size_t count, uint32_t gen, proto_update_t *update);
+
+/**
+ * @brief Formats a field update as a Server-Sent Event
+ *
+ * @param update update, from proto_format_update()
+ * @param out output buffer of at least PROTO_EVENT_MAX_LEN bytes
+ * @return length of the formatted event, excluding the NUL
+ */
+size_t proto_format_event(const proto_update_t *update, char *out);
+
+/**
+ * @brief Lists the fields changed after a generation, oldest change first
+ *
+ * Sending them in this order leaves a client at the newest generation sent.
+ *
+ * @param ops protocol callbacks
+ * @param since last generation the client saw, 0 for every field
+ * @param fields output, room for PROTO_FIELD_MAX fields
+ * @return number of fields
+ */
+size_t proto_fields_since(const proto_ops_t *ops, uint32_t since, proto_field_t *fields);
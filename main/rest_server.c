@@ -8,12 +8,16 @@
 */
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <esp_wifi.h>
-#include <esp_event.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <nvs_flash.h>
 #include <sys/param.h>
 #include "esp_netif.h"
@@ -23,32 +27,76 @@
 #include <esp_https_server.h>
 #include "esp_vfs.h"
 #include "keep_alive.h"
+#include "storage.h"
+#include "protocol.h"
+#include "broadcast.h"
+#include "ws_registry.h"
+#include "assets.h"
+#include "www_image.h"
+#include "json_stream.h"
+#include "tls_server.h"
+#include "servo.h"
+#include "led.h"
+#include "choreo.h"
+#include "actuator.h"
+#include "token_bucket.h"
+#include "metrics.h"
+#include "trace.h"
 #include "cJSON.h"
 
-void visor_set_state(int state);
-void led_set_duty(uint8_t duty, int time);
-uint8_t read_led();
-uint8_t read_visor();
-void write_led(uint8_t val);
-void write_visor(uint8_t val);
 
 #if !CONFIG_HTTPD_WS_SUPPORT
 #error This firmware cannot be used unless HTTPD_WS_SUPPORT is enabled in esp-http-server component configuration
 #endif
 
-#define TEXT_GET_STATE      'g' 
-#define TEXT_SET_STATE      's'
-#define TEXT_TYPE_LED       'l'
-#define TEXT_TYPE_VISOR     'v'
+_Static_assert(CONFIG_MK3_HTTPD_MAX_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS - 3,
+               "httpd needs 3 of the LWIP_MAX_SOCKETS sockets for itself");
 
 httpd_handle_t server = NULL;
 
-struct async_resp_arg {
+/* Every open connection and its subscriptions; changed on the httpd task only */
+static ws_client_t ws_client_slots[CONFIG_MK3_HTTPD_MAX_SOCKETS];
+static ws_registry_t ws_clients;
+
+/* Wakes up the httpd task to send heartbeats to the event streams */
+static esp_timer_handle_t sse_heartbeat_timer;
+
+/* Requests for the state held open until it changes; httpd task only, the count may be read from any task */
+static struct {
+    size_t count;
+    struct {
+        int fd;
+        uint32_t generation;    /* generation the client already has */
+        int64_t deadline_us;
+    } polls[CONFIG_MK3_HTTPD_MAX_SOCKETS];
+} state_polls;
+
+/* Wakes up the httpd task when the earliest parked request for the state expires */
+static esp_timer_handle_t state_poll_timer;
+
+/* Pings for one keep-alive round, sent by a single work item */
+static struct {
     httpd_handle_t hd;
-    int fd;
-    char msg[5]; // constant msg size
+    size_t count;
+    int fds[CONFIG_MK3_HTTPD_MAX_SOCKETS];
+} ping_batch;
+static uint32_t ping_batch_busy;
+
+/* Per-connection state of a WebSocket client, kept as the httpd session context */
+typedef struct {
+    token_bucket_t buckets[PROTO_CLASS_MAX];    /* admission control per command class */
+} ws_session_t;
+
+static const token_bucket_config_t ws_rate_limits[PROTO_CLASS_MAX] = {
+    [PROTO_CLASS_GET] = { CONFIG_MK3_WS_GET_RATE, CONFIG_MK3_WS_GET_BURST },
+    [PROTO_CLASS_SET] = { CONFIG_MK3_WS_SET_RATE, CONFIG_MK3_WS_SET_BURST },
 };
-static const size_t max_clients = 4;
+
+/* Commands admitted and refused per class, over all clients; httpd task only */
+static struct {
+    uint32_t admitted[PROTO_CLASS_MAX];
+    uint32_t limited[PROTO_CLASS_MAX];
+} ws_rate_stats;
 
 static const char *REST_TAG = "esp-rest";
 #define REST_CHECK(a, str, goto_tag, ...)                                              \
@@ -63,184 +111,515 @@ static const char *REST_TAG = "esp-rest";
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
 #define SCRATCH_BUFSIZE (10240)
+/* POST bodies are parsed as they arrive, through a small stack buffer */
+#define JSON_RECV_BUFSIZE (64)
+#define JSON_BODY_MAX (1024)
+/* Commands and control frames (up to 125 bytes), plus a NUL for logging */
+#define WS_FRAME_BUFSIZE (MAX(PROTO_COMMAND_MAX_LEN, 125) + 1)
 
 typedef struct rest_server_context {
     char base_path[ESP_VFS_PATH_MAX + 1];
+#if !CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+    /* Files are sent straight from flash in the mmap deploy mode */
     char scratch[SCRATCH_BUFSIZE];
+#endif
 } rest_server_context_t;
 
-#define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
+typedef struct {
+    int32_t led;
+} light_brightness_req_t;
+
+static const json_field_t LIGHT_BRIGHTNESS_FIELDS[] = {
+    { "led", JSON_FIELD_INT, offsetof(light_brightness_req_t, led), 0, 255, true },
+};
+
+typedef struct {
+    bool open;
+} visor_state_req_t;
+
+static const json_field_t VISOR_STATE_FIELDS[] = {
+    { "isVisorOpen", JSON_FIELD_BOOL, offsetof(visor_state_req_t, open), 0, 1, true },
+};
 
-static void send_text(httpd_req_t *req, char *text) {
+/* {"led":255,"isVisorOpen":false,"generation":4294967295} */
+#define STATE_JSON_MAX_LEN (64)
+
+/* Hashed names change with their content, everything else must be revalidated */
+#define CACHE_CONTROL_IMMUTABLE "public, max-age=31536000, immutable"
+#define CACHE_CONTROL_REVALIDATE "no-cache"
+
+static void send_frame(httpd_req_t *req, httpd_ws_type_t type, const uint8_t *payload, size_t len) {
     httpd_ws_frame_t ws_pkt;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.payload = (uint8_t*)text;
-    ws_pkt.len = strlen(text);
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-
-    httpd_ws_send_frame(req, &ws_pkt);
+    ws_pkt.payload = (uint8_t*)payload;
+    ws_pkt.len = len;
+    ws_pkt.type = type;
+
+    TRACE_SPAN_BEGIN(span);
+    esp_err_t ret = httpd_ws_send_frame(req, &ws_pkt);
+    TRACE_SPAN_END(span, TRACE_EV_WS_SEND, httpd_req_to_sockfd(req));
+    if (ret == ESP_OK) {
+        metrics_inc(METRIC_WS_FRAMES_SENT);
+    } else {
+        metrics_inc(METRIC_WS_FRAMES_DROPPED);
+    }
 }
 
-static void send_ping(void *arg)
+static void send_pings(void *arg)
 {
-    struct async_resp_arg *resp_arg = arg;
-    httpd_handle_t hd = resp_arg->hd;
-    int fd = resp_arg->fd;
     httpd_ws_frame_t ws_pkt;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
     ws_pkt.payload = NULL;
     ws_pkt.len = 0;
     ws_pkt.type = HTTPD_WS_TYPE_PING;
 
-    httpd_ws_send_frame_async(hd, fd, &ws_pkt);
-    free(resp_arg);
-}
-
-/* Set HTTP response content type according to file extension */
-static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepath)
-{
-    const char *type = "text/plain";
-    if (CHECK_FILE_EXTENSION(filepath, ".html")) {
-        type = "text/html";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".js")) {
-        type = "application/javascript";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".css")) {
-        type = "text/css";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".png")) {
-        type = "image/png";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".ico")) {
-        type = "image/x-icon";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".svg")) {
-        type = "text/xml";
+    for (size_t i = 0; i < ping_batch.count; ++i) {
+        httpd_ws_send_frame_async(ping_batch.hd, ping_batch.fds[i], &ws_pkt);
     }
-    return httpd_resp_set_type(req, type);
+    metrics_add(METRIC_KEEP_ALIVE_PINGS, ping_batch.count);
+    __atomic_store_n(&ping_batch_busy, 0, __ATOMIC_RELEASE);
 }
 
 esp_err_t wss_open_fd(httpd_handle_t hd, int sockfd)
 {
     ESP_LOGI(REST_TAG, "New client connected %d", sockfd);
+    if (!ws_registry_add(&ws_clients, sockfd)) {
+        ESP_LOGE(REST_TAG, "No room for client %d", sockfd);
+        return ESP_FAIL;
+    }
     wss_keep_alive_t h = httpd_get_global_user_ctx(hd);
-    return wss_keep_alive_add_client(h, sockfd);
+    esp_err_t ret = wss_keep_alive_add_client(h, sockfd);
+    if (ret != ESP_OK) {
+        ws_registry_remove(&ws_clients, sockfd);
+    }
+    return ret;
 }
 
+static void state_poll_forget(int sockfd);
+
 void wss_close_fd(httpd_handle_t hd, int sockfd)
 {
     ESP_LOGI(REST_TAG, "Client disconnected %d", sockfd);
+    ws_registry_remove(&ws_clients, sockfd);
+    state_poll_forget(sockfd);
     wss_keep_alive_t h = httpd_get_global_user_ctx(hd);
     wss_keep_alive_remove_client(h, sockfd);
 }
 
-static void send_text_with_custom_arg(void *arg) {
-    struct async_resp_arg *resp_arg = (struct async_resp_arg *) arg;
-    httpd_handle_t hd = resp_arg->hd;
-    int fd = resp_arg->fd;
-    httpd_ws_frame_t ws_pkt;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    char payload[5];
-    memcpy(payload, resp_arg->msg, sizeof(payload));
-    payload[4] = '\0';
-    ws_pkt.payload = (uint8_t *)payload;
-    ws_pkt.len = strlen(payload);
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+static ws_session_t *ws_session_get(httpd_req_t *req)
+{
+    if (req->sess_ctx == NULL) {
+        ws_session_t *session = calloc(1, sizeof(ws_session_t));
+        if (session == NULL) {
+            return NULL;
+        }
+        uint32_t now_ms = esp_timer_get_time() / 1000;
+        for (int i = 0; i < PROTO_CLASS_MAX; ++i) {
+            token_bucket_init(&session->buckets[i], &ws_rate_limits[i], now_ms);
+        }
+        req->sess_ctx = session;
+        req->free_ctx = free;
+    }
+    return req->sess_ctx;
+}
+
+// Writes to an event stream; no keep-alive watches them, so a failure closes it
+static bool sse_send(int sockfd, const char *buf, size_t len)
+{
+    if (httpd_socket_send(server, sockfd, buf, len, 0) == (int)len) {
+        return true;
+    }
+    ESP_LOGW(REST_TAG, "Event stream fd %d failed, closing", sockfd);
+    httpd_sess_trigger_close(server, sockfd);
+    return false;
+}
+
+// Runs on the httpd thread
+static void sse_send_heartbeats(void *arg)
+{
+    for (size_t i = 0; i < ws_clients.count; ++i) {
+        const ws_client_t *client = &ws_clients.clients[i];
+        if (client->kind == WS_CLIENT_EVENTS && sse_send(client->fd, ":\n\n", 3)) {
+            metrics_inc(METRIC_SSE_HEARTBEATS);
+        }
+    }
+}
 
-    httpd_ws_send_frame_async(hd, fd, &ws_pkt);
-    free(resp_arg);
+// Runs on the esp_timer task
+static void sse_heartbeat_tick(void *arg)
+{
+    if (server == NULL || ws_registry_count(&ws_clients, WS_CLIENT_EVENTS) == 0) {
+        return;
+    }
+    if (httpd_queue_work(server, sse_send_heartbeats, NULL) != ESP_OK) {
+        metrics_inc(METRIC_QUEUE_WORK_FAILURES);
+    }
 }
 
-// Get all clients and send async message
-static void wss_broadcast(char *msg) {
-    if(!server) {
+// The current state as JSON, with the generation its ETag is made of
+static size_t format_state(char *out, size_t size, uint32_t *gen)
+{
+    // Read first: a change landing in between is reported again on the next request, never lost
+    *gen = storage_generation();
+    return snprintf(out, size, "{\"led\":%d,\"isVisorOpen\":%s,\"generation\":%u}",
+                    read_led(), read_visor() ? "true" : "false", (unsigned)*gen);
+}
+
+// Points the timer at the earliest deadline of the parked requests
+static void state_polls_arm(void)
+{
+    esp_timer_stop(state_poll_timer);
+    if (state_polls.count == 0) {
         return;
     }
+    int64_t earliest = state_polls.polls[0].deadline_us;
+    for (size_t i = 1; i < state_polls.count; ++i) {
+        earliest = MIN(earliest, state_polls.polls[i].deadline_us);
+    }
+    esp_timer_start_once(state_poll_timer, MAX(earliest - esp_timer_get_time(), 0));
+}
 
-    ESP_LOGD(REST_TAG, "Broadcasting string: %s", msg);
-
-    size_t clients = max_clients;
-    int client_fds[max_clients];
-    if (httpd_get_client_list(server, &clients, client_fds) == ESP_OK) {
-        for (size_t i=0; i < clients; ++i) {
-            int sock = client_fds[i];
-            if (httpd_ws_get_fd_info(server, sock) == HTTPD_WS_CLIENT_WEBSOCKET) {
-                ESP_LOGI(REST_TAG, "Active client (fd=%d) -> sending async message", sock);
-                struct async_resp_arg *resp_arg = malloc(sizeof(struct async_resp_arg));
-                memcpy(resp_arg->msg, msg, sizeof(&msg));
-                resp_arg->hd = server;
-                resp_arg->fd = sock;
-                if (httpd_queue_work(resp_arg->hd, send_text_with_custom_arg, resp_arg) != ESP_OK) {
-                    ESP_LOGE(REST_TAG, "httpd_queue_work failed!");
-                    break;
-                }
-            }
-        }
+static void state_poll_remove(size_t index)
+{
+    state_polls.polls[index] = state_polls.polls[state_polls.count - 1];
+    __atomic_store_n(&state_polls.count, state_polls.count - 1, __ATOMIC_SEQ_CST);
+}
+
+// Answers a parked request outside of its handler: the new state, or 304 if it has not changed
+static void state_poll_answer(size_t index)
+{
+    int fd = state_polls.polls[index].fd;
+    uint32_t known = state_polls.polls[index].generation;
+    state_poll_remove(index);
+
+    char body[STATE_JSON_MAX_LEN];
+    uint32_t gen;
+    size_t body_len = format_state(body, sizeof(body), &gen);
+    char resp[160 + STATE_JSON_MAX_LEN];
+    int len;
+    if (gen != known) {
+        len = snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                       "Cache-Control: no-cache\r\nETag: \"%u\"\r\nContent-Length: %u\r\n\r\n%s",
+                       (unsigned)gen, (unsigned)body_len, body);
+        metrics_inc(METRIC_STATE_POLLS_CHANGED);
     } else {
-        ESP_LOGE(REST_TAG, "httpd_get_client_list failed!");
+        len = snprintf(resp, sizeof(resp), "HTTP/1.1 304 Not Modified\r\n"
+                       "Cache-Control: no-cache\r\nETag: \"%u\"\r\n\r\n", (unsigned)gen);
+        metrics_inc(METRIC_STATE_POLLS_EXPIRED);
+    }
+    if (httpd_socket_send(server, fd, resp, len, 0) != len) {
+        ESP_LOGW(REST_TAG, "State request on fd %d failed, closing", fd);
+        httpd_sess_trigger_close(server, fd);
         return;
     }
+    // Back to an ordinary idle connection
+    wss_keep_alive_add_client(httpd_get_global_user_ctx(server), fd);
 }
 
-esp_err_t wss_handle_text_message(httpd_req_t *req, httpd_ws_frame_t *frame) {
-   if (frame->len == 0 ) {
-       ESP_LOGE(REST_TAG, "Invalid WebSocket message");
-       // Invalid frame
-       return ESP_FAIL;
-   }
-    switch(frame->payload[0]) {
-        case TEXT_GET_STATE: {
-            // If we're only getting a generic "GET" command, send everything
-            uint8_t led_state = read_led();
-            uint8_t visor_state = read_visor();
-            char led_buffer[5], visor_buffer[5];
-            // Format strings
-            snprintf(led_buffer, 5, "l%hhu", led_state);
-            snprintf(visor_buffer, 5, "v%hhu", visor_state);
-            if (frame->len == 1) {
-                ESP_LOGI(REST_TAG, "Received GET_ALL_STATE message");
-                send_text(req, led_buffer);
-                send_text(req, visor_buffer);
-            } else {
-                if (frame->payload[1] == TEXT_TYPE_LED) {
-                    ESP_LOGI(REST_TAG, "Received GET_LED_STATE message");
-                    send_text(req, led_buffer);
-                } else if (frame->payload[1] == TEXT_TYPE_VISOR) {
-                    ESP_LOGI(REST_TAG, "Received GET_VISOR_STATE message");
-                    send_text(req, visor_buffer);
-                }
-            }
+/*
+ * Holds a request open without a task: httpd keeps the session idle once the
+ * handler returns without answering, until a change or the deadline answers it.
+ * Returns false if there is no room left.
+ */
+static bool state_poll_park(int fd, uint32_t gen, uint32_t wait_s)
+{
+    if (state_polls.count == sizeof(state_polls.polls) / sizeof(state_polls.polls[0])) {
+        return false;
+    }
+    // A WebSocket ping in front of the response would corrupt it
+    wss_keep_alive_remove_client(httpd_get_global_user_ctx(server), fd);
+    state_polls.polls[state_polls.count].fd = fd;
+    state_polls.polls[state_polls.count].generation = gen;
+    state_polls.polls[state_polls.count].deadline_us = esp_timer_get_time() + wait_s * 1000000LL;
+    __atomic_store_n(&state_polls.count, state_polls.count + 1, __ATOMIC_SEQ_CST);
+    // A change stored before the count went up did not queue a broadcast for it
+    if (storage_generation() != gen) {
+        state_poll_answer(state_polls.count - 1);
+    }
+    state_polls_arm();
+    return true;
+}
+
+// Runs on the httpd thread: answers the parked requests that have missed a change
+static void state_polls_release(void)
+{
+    uint32_t gen = storage_generation();
+    for (size_t i = 0; i < state_polls.count;) {
+        if (state_polls.polls[i].generation != gen) {
+            state_poll_answer(i);
+        } else {
+            i++;
         }
-        break;
-        case TEXT_SET_STATE: {
-            if (frame->len == 1) {
-                // Invalid set command
-                ESP_LOGE(REST_TAG, "Invalid SET_STATE message");
-                return ESP_FAIL;
-            } else {
-                char set_val_str[4]; 
-                char buffer[5];
-                memcpy(set_val_str, frame->payload + 2, sizeof(set_val_str));
-                set_val_str[3] = '\0'; // Manual null terminator just in case
-                uint8_t set_val_int = atoi(set_val_str);
-                if (frame->payload[1] == TEXT_TYPE_LED) {
-                    ESP_LOGI(REST_TAG, "Received SET_LED message: %d", set_val_int);
-                    write_led(set_val_int);
-                    led_set_duty(set_val_int, 500); // fade in 500s period.
-                    snprintf(buffer, 5, "l%hhu", set_val_int);
-                    buffer[4] = '\0';
-                    wss_broadcast(buffer);
-                    send_text(req, "okl");
-                } else if (frame->payload[1] == TEXT_TYPE_VISOR) {
-                    ESP_LOGI(REST_TAG, "Received SET_VISOR message: %d", set_val_int);
-                    write_visor(set_val_int);
-                    visor_set_state(set_val_int);
-                    snprintf(buffer, 5, "v%hhu", set_val_int);
-                    buffer[4] = '\0';
-                    wss_broadcast(buffer);
-                    send_text(req, "okv");
-                }
+    }
+    state_polls_arm();
+}
+
+// Runs on the httpd thread
+static void state_polls_expire(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    for (size_t i = 0; i < state_polls.count;) {
+        if (state_polls.polls[i].deadline_us <= now) {
+            state_poll_answer(i);
+        } else {
+            i++;
+        }
+    }
+    state_polls_arm();
+}
+
+// Runs on the esp_timer task
+static void state_poll_tick(void *arg)
+{
+    if (server == NULL) {
+        return;
+    }
+    if (httpd_queue_work(server, state_polls_expire, NULL) != ESP_OK) {
+        metrics_inc(METRIC_QUEUE_WORK_FAILURES);
+    }
+}
+
+// Runs on the httpd thread, when a connection closes
+static void state_poll_forget(int sockfd)
+{
+    for (size_t i = 0; i < state_polls.count; ++i) {
+        if (state_polls.polls[i].fd == sockfd) {
+            state_poll_remove(i);
+            state_polls_arm();
+            return;
+        }
+    }
+}
+
+// Runs on the httpd thread: sends one shared message to the clients subscribed to its field
+static void wss_broadcast_fanout(void *arg)
+{
+    broadcast_msg_t *msg = arg;
+    // Formatted for the first event stream, then shared by the others
+    char event[PROTO_EVENT_MAX_LEN];
+    size_t event_len = 0;
+    for (size_t i = 0; i < ws_clients.count; ++i) {
+        const ws_client_t *client = &ws_clients.clients[i];
+        if (!ws_client_wants(client, msg->update.topics)) {
+            continue;
+        }
+        if (client->kind == WS_CLIENT_EVENTS) {
+            if (event_len == 0) {
+                event_len = proto_format_event(&msg->update, event);
             }
+            TRACE_SPAN_BEGIN(span);
+            bool sent = sse_send(client->fd, event, event_len);
+            TRACE_SPAN_END(span, TRACE_EV_WS_SEND, client->fd);
+            metrics_inc(sent ? METRIC_SSE_EVENTS_SENT : METRIC_SSE_EVENTS_DROPPED);
+            continue;
+        }
+        httpd_ws_frame_t ws_pkt;
+        memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+        if (client->encoding == PROTO_ENC_BINARY) {
+            ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+            ws_pkt.payload = msg->update.binary;
+            ws_pkt.len = msg->update.binary_len;
+        } else {
+            ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+            ws_pkt.payload = (uint8_t *)msg->update.text;
+            ws_pkt.len = msg->update.text_len;
+        }
+        // A failing client must not starve the others
+        TRACE_SPAN_BEGIN(span);
+        esp_err_t ret = httpd_ws_send_frame_async(server, client->fd, &ws_pkt);
+        TRACE_SPAN_END(span, TRACE_EV_WS_SEND, client->fd);
+        if (ret == ESP_OK) {
+            metrics_inc(METRIC_WS_FRAMES_SENT);
+        } else {
+            metrics_inc(METRIC_WS_FRAMES_DROPPED);
+            ESP_LOGW(REST_TAG, "Broadcast to fd %d failed", client->fd);
         }
-        break;
     }
+    if (state_polls.count) {
+        state_polls_release();
+    }
+    broadcast_msg_unref(msg);
+}
+
+// Publish a state change to the subscribed clients, in the encoding each client negotiated
+// or as a Server-Sent Event, and to the requests parked on /api/v1/state
+static void wss_broadcast(const proto_update_t *update) {
+    if (!server) {
+        return;
+    }
+    if (__atomic_load_n(&state_polls.count, __ATOMIC_SEQ_CST) == 0 &&
+        !ws_registry_has_subscribers(&ws_clients, update->topics)) {
+        return;
+    }
+
+    ESP_LOGD(REST_TAG, "Broadcasting string: %s", update->text);
+
+    TRACE_SPAN_BEGIN(span);
+    broadcast_msg_t *msg = broadcast_msg_alloc();
+    if (msg == NULL) {
+        metrics_inc(METRIC_WS_FRAMES_DROPPED);
+        ESP_LOGE(REST_TAG, "Broadcast pool exhausted, dropping update");
+        return;
+    }
+    msg->update = *update;
+    if (httpd_queue_work(server, wss_broadcast_fanout, msg) != ESP_OK) {
+        metrics_inc(METRIC_QUEUE_WORK_FAILURES);
+        ESP_LOGE(REST_TAG, "httpd_queue_work failed!");
+        broadcast_msg_unref(msg);
+    }
+    TRACE_SPAN_END(span, TRACE_EV_BROADCAST, update->text[0]);
+}
+
+static uint8_t proto_load(proto_field_t field)
+{
+    return field == PROTO_FIELD_LED ? read_led() : read_visor();
+}
+
+static uint32_t proto_store(proto_field_t field, uint8_t val)
+{
+    return field == PROTO_FIELD_LED ? write_led(val) : write_visor(val);
+}
+
+static uint32_t proto_store_batch(const proto_set_t *sets, size_t count)
+{
+    int values[PROTO_FIELD_MAX] = { -1, -1 };
+    for (size_t i = 0; i < count; ++i) {
+        values[sets[i].field] = sets[i].val;
+    }
+    return write_scene(values[PROTO_FIELD_LED], values[PROTO_FIELD_VISOR]);
+}
 
+static uint32_t proto_changed_at(proto_field_t field)
+{
+    return field == PROTO_FIELD_LED ? read_led_generation() : read_visor_generation();
+}
+
+// Runs on the actuator task
+static void actuate_now(proto_field_t field, uint8_t val)
+{
+    if (field == PROTO_FIELD_LED) {
+        ESP_LOGI(REST_TAG, "Received SET_LED message: %d", val);
+        led_set_duty(val, 500); // fade in 500ms period.
+    } else {
+        ESP_LOGI(REST_TAG, "Received SET_VISOR message: %d", val);
+        uint32_t move_id = visor_set_state(val);
+        ESP_LOGD(REST_TAG, "Visor move %u started", (unsigned)move_id);
+    }
+}
+
+// Runs on the esp_timer task, or on the task whose move preempted this one
+static void visor_move_ended(uint32_t move_id, servo_move_result_t result, void *arg)
+{
+    if (result == SERVO_MOVE_DONE) {
+        ESP_LOGI(REST_TAG, "Visor move %u arrived", (unsigned)move_id);
+        metrics_inc(METRIC_VISOR_MOVES_DONE);
+    } else {
+        ESP_LOGI(REST_TAG, "Visor move %u preempted", (unsigned)move_id);
+        metrics_inc(METRIC_VISOR_MOVES_PREEMPTED);
+    }
+}
+
+static bool proto_actuate(proto_field_t field, uint8_t val)
+{
+    return actuator_submit(field, val);
+}
+
+static bool proto_actuate_batch(const proto_set_t *sets, size_t count)
+{
+    return actuator_submit_batch(sets, count);
+}
+
+static void proto_reply(void *conn, proto_encoding_t enc, const uint8_t *msg, size_t len)
+{
+    send_frame((httpd_req_t *)conn, enc == PROTO_ENC_BINARY ? HTTPD_WS_TYPE_BINARY : HTTPD_WS_TYPE_TEXT, msg, len);
+}
+
+static void proto_broadcast(const proto_update_t *update)
+{
+    wss_broadcast(update);
+}
+
+static bool proto_run_sequence(uint8_t id)
+{
+    ESP_LOGI(REST_TAG, "Received RUN_SEQUENCE message: %d", id);
+    return choreo_run(id);
+}
+
+static bool proto_admit(void *conn, proto_class_t cls)
+{
+    httpd_req_t *req = conn;
+    ws_session_t *session = ws_session_get(req);
+    if (session && !token_bucket_take(&session->buckets[cls], &ws_rate_limits[cls], esp_timer_get_time() / 1000)) {
+        ws_rate_stats.limited[cls]++;
+        ESP_LOGD(REST_TAG, "Client (fd=%d) over its rate limit", httpd_req_to_sockfd(req));
+        return false;
+    }
+    ws_rate_stats.admitted[cls]++;
+    return true;
+}
+
+static bool proto_subscribe(void *conn, uint32_t topics)
+{
+    int sockfd = httpd_req_to_sockfd(conn);
+    ESP_LOGD(REST_TAG, "Client (fd=%d) subscribed to topics 0x%x", sockfd, (unsigned)topics);
+    return ws_registry_subscribe(&ws_clients, sockfd, topics);
+}
+
+// Keeps the stored state and the clients in sync with what a sequence does
+static void choreo_state_changed(proto_field_t field, uint8_t val)
+{
+    uint32_t gen = proto_store(field, val);
+    if (gen == 0) {
+        return;
+    }
+    proto_update_t update;
+    proto_format_update(field, val, gen, &update);
+    wss_broadcast(&update);
+}
+
+static const proto_ops_t proto_ops = {
+    .load = proto_load,
+    .store = proto_store,
+    .store_batch = proto_store_batch,
+    .changed_at = proto_changed_at,
+    .generation = storage_generation,
+    .actuate = proto_actuate,
+    .actuate_batch = proto_actuate_batch,
+    .reply = proto_reply,
+    .broadcast = proto_broadcast,
+    .run_sequence = proto_run_sequence,
+    .admit = proto_admit,
+    .subscribe = proto_subscribe,
+};
+
+esp_err_t wss_handle_text_message(httpd_req_t *req, httpd_ws_frame_t *frame) {
+    TRACE_SPAN_BEGIN(span);
+    proto_err_t err = proto_handle_text(&proto_ops, req, frame->payload, frame->len);
+    TRACE_SPAN_END(span, TRACE_EV_WS_PARSE, frame->len);
+    if (err == PROTO_ERR_BUSY) {
+        // Already answered with "busy", keep the connection
+        return ESP_OK;
+    }
+    if (err != PROTO_OK) {
+        ESP_LOGE(REST_TAG, "Invalid WebSocket message (%d)", err);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t wss_handle_binary_message(httpd_req_t *req, httpd_ws_frame_t *frame) {
+    // Clients that skipped negotiation still get binary broadcasts once they speak binary
+    ws_registry_upgrade(&ws_clients, httpd_req_to_sockfd(req), WS_CLIENT_WEBSOCKET, PROTO_ENC_BINARY);
+    TRACE_SPAN_BEGIN(span);
+    proto_err_t err = proto_handle_binary(&proto_ops, req, frame->payload, frame->len);
+    TRACE_SPAN_END(span, TRACE_EV_WS_PARSE, frame->len);
+    if (err == PROTO_ERR_BUSY) {
+        return ESP_OK;
+    }
+    if (err != PROTO_OK) {
+        ESP_LOGE(REST_TAG, "Invalid binary WebSocket message (%d)", err);
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
@@ -249,36 +628,57 @@ esp_err_t wss_handle_text_message(httpd_req_t *req, httpd_ws_frame_t *frame) {
  * ================================================== 
  */
 
-static void stop_rest_server(httpd_handle_t server)
-{
-    // Stop keep alive thread
-    wss_keep_alive_stop(httpd_get_global_user_ctx(server));
-    // Stop the httpd server
-    httpd_ssl_stop(server);
-}
-
 /* Handle WS messages */
 static esp_err_t ws_handler(httpd_req_t *req)
 {
-    uint8_t buf[128] = { 0 };
+    if (req->method == HTTP_GET) {
+        // Handshake done, pick the encoding from the negotiated subprotocol
+        char subprotocol[64];
+        int sockfd = httpd_req_to_sockfd(req);
+        proto_encoding_t encoding = PROTO_ENC_TEXT;
+        if (httpd_req_get_hdr_value_str(req, "Sec-WebSocket-Protocol",
+                                        subprotocol, sizeof(subprotocol)) == ESP_OK &&
+            strstr(subprotocol, PROTO_BIN_SUBPROTOCOL) != NULL) {
+            ESP_LOGI(REST_TAG, "Client (fd=%d) negotiated %s", sockfd, PROTO_BIN_SUBPROTOCOL);
+            encoding = PROTO_ENC_BINARY;
+        }
+        if (!ws_registry_upgrade(&ws_clients, sockfd, WS_CLIENT_WEBSOCKET, encoding)) {
+            ESP_LOGW(REST_TAG, "Client (fd=%d) refused, %d WebSocket clients already", sockfd,
+                     CONFIG_MK3_WS_MAX_CLIENTS);
+            return ESP_FAIL;
+        }
+        return ESP_OK;
+    }
+
+    uint8_t buf[WS_FRAME_BUFSIZE] = { 0 };
     httpd_ws_frame_t ws_pkt;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.payload = buf;
 
-    // First receive the full ws message
-    esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 128);
+    // Get the length first, so a frame no command fits in is told apart from a receive error
+    esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
+    if (ret == ESP_OK && ws_pkt.len >= sizeof(buf)) {
+        ESP_LOGE(REST_TAG, "Frame of %u bytes too long", (unsigned)ws_pkt.len);
+        return ESP_FAIL;
+    }
+    // Then receive the full ws message
+    ws_pkt.payload = buf;
+    if (ret == ESP_OK) {
+        ret = httpd_ws_recv_frame(req, &ws_pkt, sizeof(buf) - 1);
+    }
     if (ret != ESP_OK) {
         ESP_LOGE(REST_TAG, "httpd_ws_recv_frame failed with %d", ret);
         return ret;
     }
 
-    // If it was a PONG, update the keep-alive
+    metrics_inc(METRIC_WS_FRAMES_RECEIVED);
+    // Any frame is proof of life, so busy clients never get pinged
+    wss_keep_alive_client_is_active(httpd_get_global_user_ctx(req->handle), httpd_req_to_sockfd(req));
+
     if (ws_pkt.type == HTTPD_WS_TYPE_PONG) {
         ESP_LOGD(REST_TAG, "Received PONG message");
-        return wss_keep_alive_client_is_active(httpd_get_global_user_ctx(req->handle),
-                httpd_req_to_sockfd(req));
+        return ESP_OK;
 
-    // If it was a TEXT message, just echo it back
+    // If it was a TEXT message, handle the command
     } else if (ws_pkt.type == HTTPD_WS_TYPE_TEXT) {
         ESP_LOGI(REST_TAG, "Received packet with message: %s", ws_pkt.payload);
         ret = wss_handle_text_message(req, &ws_pkt);
@@ -289,24 +689,116 @@ static esp_err_t ws_handler(httpd_req_t *req)
         ESP_LOGI(REST_TAG, "ws_handler: httpd_handle_t=%p, sockfd=%d, client_info:%d", req->handle,
                  httpd_req_to_sockfd(req), httpd_ws_get_fd_info(req->handle, httpd_req_to_sockfd(req)));
         return ret;
+    } else if (ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+        ret = wss_handle_binary_message(req, &ws_pkt);
+        if (ret != ESP_OK) {
+            ESP_LOGE(REST_TAG, "httpd_ws_send_frame failed with %d", ret);
+        }
+        return ret;
     }
     return ESP_OK;
 }
 
 
+/* Get the path of the requested file, without query string */
+static const char *request_path(httpd_req_t *req, size_t *len)
+{
+    size_t uri_len = strcspn(req->uri, "?");
+    if (uri_len == 0 || req->uri[uri_len - 1] == '/') {
+        *len = strlen("/output.html");
+        return "/output.html";
+    }
+    *len = uri_len;
+    return req->uri;
+}
+
+/* Set caching headers of a known asset, returns true if a 304 was sent instead of the file */
+static bool send_asset_headers(httpd_req_t *req, const asset_t *asset, bool *gzip)
+{
+    char hdr[128];
+
+    *gzip = false;
+    if (asset->gzip) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        *gzip = httpd_req_get_hdr_value_str(req, "Accept-Encoding", hdr, sizeof(hdr)) == ESP_OK &&
+                strstr(hdr, "gzip") != NULL;
+    }
+    // Each variant has its own tag, so a cached copy is only revalidated against the same bytes
+    const char *etag = *gzip ? asset->gzip_etag : asset->etag;
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->immutable ? CACHE_CONTROL_IMMUTABLE : CACHE_CONTROL_REVALIDATE);
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", hdr, sizeof(hdr)) == ESP_OK &&
+        assets_etag_matches(etag, hdr)) {
+        ESP_LOGD(REST_TAG, "Not modified : %s", asset->path);
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return true;
+    }
+    if (*gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+    httpd_resp_set_type(req, asset->content_type);
+    return false;
+}
+
+#if CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+/* Send HTTP response with the contents of the requested file, straight from mapped flash */
+static esp_err_t rest_common_get_handler(httpd_req_t *req)
+{
+    size_t uri_len;
+    const char *uri = request_path(req, &uri_len);
+    const www_file_t *file = www_image_find(uri, uri_len);
+    if (file == NULL) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        return ESP_FAIL;
+    }
+
+    bool gzip;
+    if (send_asset_headers(req, &file->asset, &gzip)) {
+        return ESP_OK;
+    }
+    size_t size;
+    const uint8_t *data = www_image_data(file, gzip, &size);
+    /* A single send with Content-Length, the TLS layer reads the flash mapping directly */
+    return httpd_resp_send(req, (const char *)data, size);
+}
+#else
 /* Send HTTP response with the contents of the requested file */
 static esp_err_t rest_common_get_handler(httpd_req_t *req)
 {
     char filepath[FILE_PATH_MAX];
 
     rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+    size_t uri_len;
+    const char *uri = request_path(req, &uri_len);
+    const asset_t *asset = assets_find(uri, uri_len);
+    bool gzip = false;
+    if (asset && send_asset_headers(req, asset, &gzip)) {
+        return ESP_OK;
+    }
+
     strlcpy(filepath, rest_context->base_path, sizeof(filepath));
-    if (req->uri[strlen(req->uri) - 1] == '/') {
-        strlcat(filepath, "/output.html", sizeof(filepath));
-    } else {
-        strlcat(filepath, req->uri, sizeof(filepath));
+    size_t base_len = strlen(filepath);
+    if (base_len + uri_len >= sizeof(filepath)) {
+        httpd_resp_send_err(req, HTTPD_414_URI_TOO_LONG, "URI too long");
+        return ESP_FAIL;
+    }
+    memcpy(filepath + base_len, uri, uri_len);
+    filepath[base_len + uri_len] = '\0';
+    if (asset == NULL) {
+        httpd_resp_set_type(req, assets_content_type(filepath));
     }
+    if (gzip) {
+        strlcat(filepath, ".gz", sizeof(filepath));
+    }
+
     int fd = open(filepath, O_RDONLY, 0);
+    if (fd == -1 && (errno == ENOENT || asset == NULL)) {
+        // Every unknown path lands here through the wildcard handler
+        ESP_LOGD(REST_TAG, "No such file : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        return ESP_FAIL;
+    }
     if (fd == -1) {
         ESP_LOGE(REST_TAG, "Failed to open file : %s", filepath);
         /* Respond with 500 Internal Server Error */
@@ -314,8 +806,6 @@ static esp_err_t rest_common_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    set_content_type_from_file(req, filepath);
-
     char *chunk = rest_context->scratch;
     ssize_t read_bytes;
     do {
@@ -343,34 +833,56 @@ static esp_err_t rest_common_get_handler(httpd_req_t *req)
     httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
 }
+#endif
 
-/* Simple handler for light brightness control */
-static esp_err_t light_brightness_post_handler(httpd_req_t *req)
+/* Receive a JSON body and parse it against a fixed schema as it arrives, answering 400 on bad input */
+static esp_err_t recv_json(httpd_req_t *req, const json_field_t *fields, size_t field_count, void *out)
 {
-    int total_len = req->content_len;
-    int cur_len = 0;
-    char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
-    int received = 0;
-    if (total_len >= SCRATCH_BUFSIZE) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
+    char buf[JSON_RECV_BUFSIZE];
+    if (req->content_len > JSON_BODY_MAX) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "content too long");
         return ESP_FAIL;
     }
-    while (cur_len < total_len) {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
+
+    json_stream_t js;
+    json_stream_init(&js, fields, field_count, out);
+    size_t remaining = req->content_len;
+    json_err_t err = JSON_OK;
+    while (remaining > 0 && err == JSON_OK) {
+        int received = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)));
+        if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
         if (received <= 0) {
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
             return ESP_FAIL;
         }
-        cur_len += received;
+        err = json_stream_feed(&js, buf, received);
+        remaining -= received;
+    }
+    err = json_stream_finish(&js);
+    if (err != JSON_OK) {
+        ESP_LOGW(REST_TAG, "Rejected %s body: %s", req->uri, json_strerror(err));
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, json_strerror(err));
+        return ESP_FAIL;
     }
-    buf[total_len] = '\0';
+    return ESP_OK;
+}
 
-    cJSON *root = cJSON_Parse(buf);
-    int led = cJSON_GetObjectItem(root, "led")->valueint;
-    ESP_LOGI(REST_TAG, "Light control: %d", led);
-    cJSON_Delete(root);
+/* Simple handler for light brightness control */
+static esp_err_t light_brightness_post_handler(httpd_req_t *req)
+{
+    light_brightness_req_t body;
+    if (recv_json(req, LIGHT_BRIGHTNESS_FIELDS, sizeof(LIGHT_BRIGHTNESS_FIELDS) / sizeof(LIGHT_BRIGHTNESS_FIELDS[0]),
+                  &body) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(REST_TAG, "Light control: %d", body.led);
+    if (proto_apply_set(&proto_ops, PROTO_FIELD_LED, body.led) != PROTO_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Actuator busy");
+        return ESP_FAIL;
+    }
     httpd_resp_sendstr(req, "Post control value successfully");
     return ESP_OK;
 }
@@ -378,32 +890,51 @@ static esp_err_t light_brightness_post_handler(httpd_req_t *req)
 /* Simple handler for visor state control */
 static esp_err_t visor_state_post_handler(httpd_req_t *req)
 {
-    int total_len = req->content_len;
-    int cur_len = 0;
-    char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
-    int received = 0;
-    if (total_len >= SCRATCH_BUFSIZE) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
+    visor_state_req_t body;
+    if (recv_json(req, VISOR_STATE_FIELDS, sizeof(VISOR_STATE_FIELDS) / sizeof(VISOR_STATE_FIELDS[0]),
+                  &body) != ESP_OK) {
         return ESP_FAIL;
     }
-    while (cur_len < total_len) {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
-        if (received <= 0) {
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
-            return ESP_FAIL;
+    ESP_LOGI(REST_TAG, "Visor state: = %d", body.open);
+    if (proto_apply_set(&proto_ops, PROTO_FIELD_VISOR, body.open) != PROTO_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Actuator busy");
+        return ESP_FAIL;
+    }
+    httpd_resp_sendstr(req, "Post control value successfully");
+    return ESP_OK;
+}
+
+/* Handler for the current state, revalidated with its ETag and long-polled with ?wait=<s> */
+static esp_err_t state_get_handler(httpd_req_t *req)
+{
+    char body[STATE_JSON_MAX_LEN];
+    uint32_t gen;
+    size_t body_len = format_state(body, sizeof(body), &gen);
+    char etag[16];
+    snprintf(etag, sizeof(etag), "\"%u\"", (unsigned)gen);
+
+    char hdr[64];
+    bool unchanged = httpd_req_get_hdr_value_str(req, "If-None-Match", hdr, sizeof(hdr)) == ESP_OK &&
+                     strstr(hdr, etag) != NULL;
+    char query[32], wait[8];
+    if (unchanged && httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "wait", wait, sizeof(wait)) == ESP_OK) {
+        uint32_t wait_s = MIN(strtoul(wait, NULL, 10), CONFIG_MK3_STATE_WAIT_MAX_S);
+        if (wait_s > 0 && state_poll_park(httpd_req_to_sockfd(req), gen, wait_s)) {
+            // Answered later by state_poll_answer()
+            return ESP_OK;
         }
-        cur_len += received;
     }
-    buf[total_len] = '\0';
 
-    cJSON *root = cJSON_Parse(buf);
-    int state = cJSON_GetObjectItem(root, "isVisorOpen")->valueint;
-    ESP_LOGI(REST_TAG, "Visor state: = %d", state);
-    visor_set_state(state);
-    cJSON_Delete(root);
-    httpd_resp_sendstr(req, "Post control value successfully");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", CACHE_CONTROL_REVALIDATE);
+    if (unchanged) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    httpd_resp_send(req, body, body_len);
     return ESP_OK;
 }
 
@@ -416,12 +947,190 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     esp_chip_info(&chip_info);
     cJSON_AddStringToObject(root, "version", IDF_VER);
     cJSON_AddNumberToObject(root, "cores", chip_info.cores);
+
+    tls_server_stats_t tls_stats;
+    tls_server_get_stats(&tls_stats);
+    cJSON *tls = cJSON_AddObjectToObject(root, "tls");
+    cJSON_AddNumberToObject(tls, "full", tls_stats.full);
+    cJSON_AddNumberToObject(tls, "resumed", tls_stats.resumed);
+    cJSON_AddNumberToObject(tls, "failed", tls_stats.failed);
+    cJSON_AddNumberToObject(tls, "fullAvgUs", tls_stats.full ? tls_stats.full_us / tls_stats.full : 0);
+    cJSON_AddNumberToObject(tls, "resumedAvgUs", tls_stats.resumed ? tls_stats.resumed_us / tls_stats.resumed : 0);
+    cJSON_AddNumberToObject(tls, "fullMaxUs", tls_stats.full_max_us);
+    cJSON_AddNumberToObject(tls, "resumedMaxUs", tls_stats.resumed_max_us);
+
+    actq_stats_t act_stats;
+    actuator_get_stats(&act_stats);
+    cJSON *act = cJSON_AddObjectToObject(root, "actuator");
+    cJSON_AddNumberToObject(act, "submitted", act_stats.submitted);
+    cJSON_AddNumberToObject(act, "coalesced", act_stats.coalesced);
+    cJSON_AddNumberToObject(act, "rejected", act_stats.rejected);
+    cJSON_AddNumberToObject(act, "executed", act_stats.executed);
+    cJSON_AddNumberToObject(act, "depth", act_stats.depth);
+    cJSON_AddNumberToObject(act, "maxDepth", act_stats.max_depth);
+
+    cJSON *rate = cJSON_AddObjectToObject(root, "rateLimit");
+    cJSON_AddNumberToObject(rate, "getAdmitted", ws_rate_stats.admitted[PROTO_CLASS_GET]);
+    cJSON_AddNumberToObject(rate, "getLimited", ws_rate_stats.limited[PROTO_CLASS_GET]);
+    cJSON_AddNumberToObject(rate, "setAdmitted", ws_rate_stats.admitted[PROTO_CLASS_SET]);
+    cJSON_AddNumberToObject(rate, "setLimited", ws_rate_stats.limited[PROTO_CLASS_SET]);
     const char *sys_info = cJSON_Print(root);
     httpd_resp_sendstr(req, sys_info);
     free((void *)sys_info);
     cJSON_Delete(root);
     return ESP_OK;
 }
+
+/* Generated responses are streamed out in chunks, through a small stack buffer */
+#define RESP_CHUNK_SIZE (256)
+
+typedef struct {
+    httpd_req_t *req;
+    size_t len;
+    char buf[RESP_CHUNK_SIZE];
+} resp_chunk_t;
+
+static void resp_chunk_write(void *ctx, const char *text, size_t len)
+{
+    resp_chunk_t *chunk = ctx;
+    if (chunk->len + len > sizeof(chunk->buf)) {
+        httpd_resp_send_chunk(chunk->req, chunk->buf, chunk->len);
+        chunk->len = 0;
+    }
+    memcpy(chunk->buf + chunk->len, text, len);
+    chunk->len += len;
+}
+
+static void resp_chunk_finish(resp_chunk_t *chunk)
+{
+    if (chunk->len) {
+        httpd_resp_send_chunk(chunk->req, chunk->buf, chunk->len);
+    }
+    httpd_resp_send_chunk(chunk->req, NULL, 0);
+}
+
+/* Handler for the Server-Sent Events stream of state changes */
+static esp_err_t events_get_handler(httpd_req_t *req)
+{
+    int sockfd = httpd_req_to_sockfd(req);
+    if (!ws_registry_upgrade(&ws_clients, sockfd, WS_CLIENT_EVENTS, PROTO_ENC_TEXT)) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_set_hdr(req, "Retry-After", "10");
+        httpd_resp_sendstr(req, "Too many event streams");
+        return ESP_OK;
+    }
+    // Heartbeats watch the stream instead, a WebSocket ping would corrupt it
+    wss_keep_alive_remove_client(httpd_get_global_user_ctx(req->handle), sockfd);
+
+    // No length: the response lasts as long as the connection
+    static const char head[] = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/event-stream\r\n"
+                               "Cache-Control: no-cache\r\n\r\n";
+    if (httpd_send(req, head, sizeof(head) - 1) != sizeof(head) - 1) {
+        return ESP_FAIL;
+    }
+
+    // Browsers send back the ID of the last event they got when they reconnect
+    uint32_t since = 0;
+    char last_id[16];
+    if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", last_id, sizeof(last_id)) == ESP_OK) {
+        since = strtoul(last_id, NULL, 10);
+    }
+    proto_field_t fields[PROTO_FIELD_MAX];
+    size_t count = proto_fields_since(&proto_ops, since, fields);
+    for (size_t i = 0; i < count; ++i) {
+        proto_update_t update;
+        proto_format_update(fields[i], proto_load(fields[i]), proto_changed_at(fields[i]), &update);
+        char event[PROTO_EVENT_MAX_LEN];
+        size_t len = proto_format_event(&update, event);
+        if (httpd_send(req, event, len) != (int)len) {
+            return ESP_FAIL;
+        }
+        metrics_inc(METRIC_SSE_EVENTS_SENT);
+    }
+    ESP_LOGI(REST_TAG, "Event stream on fd %d, resumed after generation %u", sockfd, (unsigned)since);
+    return ESP_OK;
+}
+
+/* Tasks whose stack high-water mark is reported, by FreeRTOS task name */
+static const char *const METRICS_TASKS[][2] = {
+    { "httpd", "task=\"httpd\"" },
+    { "keep_alive_task", "task=\"keep_alive\"" },
+    { "nvs_flush_task", "task=\"nvs_flush\"" },
+    { "actuator", "task=\"actuator\"" },
+    { "choreo", "task=\"choreo\"" },
+    { "led", "task=\"led\"" },
+};
+#define METRICS_TASK_COUNT (sizeof(METRICS_TASKS) / sizeof(METRICS_TASKS[0]))
+
+/* Handler for scraping the firmware metrics */
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    storage_stats_t storage;
+    storage_get_stats(&storage);
+
+    metrics_gauge_t gauges[5 + METRICS_TASK_COUNT] = {
+        { "heap_free_bytes", "Free heap", NULL, false, esp_get_free_heap_size() },
+        { "heap_min_free_bytes", "Lowest free heap since boot", NULL, false, esp_get_minimum_free_heap_size() },
+        { "heap_largest_free_block_bytes", "Largest allocatable block", NULL, false,
+          heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) },
+        { "nvs_commits_total", "NVS commits", NULL, true, storage.commits },
+        { "nvs_flush_errors_total", "Failed NVS flushes", NULL, true, storage.flush_errors },
+    };
+    size_t count = 5;
+    for (size_t i = 0; i < METRICS_TASK_COUNT; ++i) {
+        TaskHandle_t task = xTaskGetHandle(METRICS_TASKS[i][0]);
+        if (task == NULL) {
+            continue;
+        }
+        // Only the first gauge of the family carries HELP and TYPE
+        gauges[count] = (metrics_gauge_t) {
+            "task_stack_free_min_bytes", count == 5 ? "Lowest free stack of a task" : NULL,
+            METRICS_TASKS[i][1], false, uxTaskGetStackHighWaterMark(task),
+        };
+        count++;
+    }
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    resp_chunk_t chunk = { .req = req };
+    metrics_render(resp_chunk_write, &chunk, gauges, count);
+    resp_chunk_finish(&chunk);
+    return ESP_OK;
+}
+
+#if CONFIG_MK3_TRACE
+/* Handler for dumping the trace ring as Chrome trace_event JSON */
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    resp_chunk_t chunk = { .req = req };
+    trace_export(resp_chunk_write, &chunk);
+    resp_chunk_finish(&chunk);
+    return ESP_OK;
+}
+#endif
+
+/* Wraps a URI handler to record its latency and failures, and trace it */
+#define METERED_HANDLER(handler, metric)                                        \
+    static esp_err_t handler##_metered(httpd_req_t *req)                        \
+    {                                                                           \
+        TRACE_SPAN_BEGIN(span);                                                 \
+        int64_t start = esp_timer_get_time();                                   \
+        esp_err_t ret = handler(req);                                           \
+        metrics_observe(metric, esp_timer_get_time() - start, ret == ESP_OK);   \
+        TRACE_SPAN_END(span, TRACE_EV_HANDLER, metric);                         \
+        return ret;                                                             \
+    }
+
+METERED_HANDLER(ws_handler, METRIC_HANDLER_WS)
+METERED_HANDLER(rest_common_get_handler, METRIC_HANDLER_FILE)
+METERED_HANDLER(light_brightness_post_handler, METRIC_HANDLER_LIGHT_POST)
+METERED_HANDLER(visor_state_post_handler, METRIC_HANDLER_VISOR_POST)
+METERED_HANDLER(system_info_get_handler, METRIC_HANDLER_SYSTEM_INFO)
+METERED_HANDLER(metrics_get_handler, METRIC_HANDLER_METRICS)
+METERED_HANDLER(events_get_handler, METRIC_HANDLER_EVENTS)
+METERED_HANDLER(state_get_handler, METRIC_HANDLER_STATE)
 /**
  * ========================================
 */
@@ -429,20 +1138,27 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
 bool client_not_alive_cb(wss_keep_alive_t h, int fd)
 {
     ESP_LOGE(REST_TAG, "Client not alive, closing fd %d", fd);
+    metrics_inc(METRIC_KEEP_ALIVE_TIMEOUTS);
     httpd_sess_trigger_close(wss_keep_alive_get_user_ctx(h), fd);
     return true;
 }
 
-bool check_client_alive_cb(wss_keep_alive_t h, int fd)
+bool check_clients_alive_cb(wss_keep_alive_t h, const int *fds, size_t count)
 {
-    ESP_LOGI(REST_TAG, "Checking if client (fd=%d) is alive", fd);
-    struct async_resp_arg *resp_arg = malloc(sizeof(struct async_resp_arg));
-    resp_arg->hd = wss_keep_alive_get_user_ctx(h);
-    resp_arg->fd = fd;
+    ESP_LOGI(REST_TAG, "Checking if %u client(s) are alive", (unsigned)count);
+    // The previous batch is still queued, the keep-alive engine retries these shortly
+    if (__atomic_exchange_n(&ping_batch_busy, 1, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    ping_batch.hd = wss_keep_alive_get_user_ctx(h);
+    ping_batch.count = MIN(count, sizeof(ping_batch.fds) / sizeof(ping_batch.fds[0]));
+    memcpy(ping_batch.fds, fds, ping_batch.count * sizeof(int));
 
-    if (httpd_queue_work(resp_arg->hd, send_ping, resp_arg) == ESP_OK) {
+    if (httpd_queue_work(ping_batch.hd, send_pings, NULL) == ESP_OK) {
         return true;
     }
+    metrics_inc(METRIC_QUEUE_WORK_FAILURES);
+    __atomic_store_n(&ping_batch_busy, 0, __ATOMIC_RELEASE);
     return false;
 }
 
@@ -450,12 +1166,16 @@ esp_err_t start_rest_server(const char *base_path)
 {
   // Prepare keep-alive engine
     wss_keep_alive_config_t keep_alive_config = KEEP_ALIVE_CONFIG_DEFAULT();
-    keep_alive_config.max_clients = max_clients;
+    keep_alive_config.max_clients = CONFIG_MK3_HTTPD_MAX_SOCKETS;
     keep_alive_config.client_not_alive_cb = client_not_alive_cb;
-    keep_alive_config.check_client_alive_cb = check_client_alive_cb;
+    keep_alive_config.check_clients_alive_cb = check_clients_alive_cb;
     wss_keep_alive_t keep_alive = wss_keep_alive_start(&keep_alive_config);
 
+    REST_CHECK(keep_alive, "Keep-alive start failed", err);
     REST_CHECK(base_path, "wrong base path", err);
+    REST_CHECK(choreo_init(choreo_state_changed) == ESP_OK, "Choreography init failed", err);
+    REST_CHECK(actuator_init(actuate_now) == ESP_OK, "Actuator init failed", err);
+    servo_set_move_cb(visor_move_ended, NULL);
     rest_server_context_t *rest_context = calloc(1, sizeof(rest_server_context_t));
     REST_CHECK(rest_context, "No memory for rest context", err);
     strlcpy(rest_context->base_path, base_path, sizeof(rest_context->base_path));
@@ -463,22 +1183,28 @@ esp_err_t start_rest_server(const char *base_path)
     ESP_LOGI(REST_TAG, "Starting HTTP + WS Server");
 
     httpd_ssl_config_t conf = HTTPD_SSL_CONFIG_DEFAULT();
-    conf.httpd.max_open_sockets = max_clients;
+    ws_registry_init(&ws_clients, ws_client_slots, CONFIG_MK3_HTTPD_MAX_SOCKETS, CONFIG_MK3_WS_MAX_CLIENTS,
+                     CONFIG_MK3_SSE_MAX_CLIENTS);
+    conf.httpd.max_open_sockets = CONFIG_MK3_HTTPD_MAX_SOCKETS;
     conf.httpd.global_user_ctx = keep_alive;
     conf.httpd.open_fn = wss_open_fd;
     conf.httpd.close_fn = wss_close_fd;
 
-    extern const unsigned char cacert_pem_start[] asm("_binary_cacert_pem_start");
-    extern const unsigned char cacert_pem_end[]   asm("_binary_cacert_pem_end");
-    conf.cacert_pem = cacert_pem_start;
-    conf.cacert_len = cacert_pem_end - cacert_pem_start;
+    tls_server_configure(&conf);
 
-    extern const unsigned char prvtkey_pem_start[] asm("_binary_prvtkey_pem_start");
-    extern const unsigned char prvtkey_pem_end[]   asm("_binary_prvtkey_pem_end");
-    conf.prvtkey_pem = prvtkey_pem_start;
-    conf.prvtkey_len = prvtkey_pem_end - prvtkey_pem_start;
+    conf.httpd.uri_match_fn = httpd_uri_match_wildcard;
+    conf.httpd.max_uri_handlers = 12;
 
-    // conf.uri_match_fn = httpd_uri_match_wildcard;
+#if !CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+    char manifest_path[FILE_PATH_MAX];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/" ASSETS_MANIFEST_NAME, base_path);
+    int assets = assets_load_manifest(manifest_path);
+    if (assets < 0) {
+        ESP_LOGW(REST_TAG, "No %s, serving files without caching headers", manifest_path);
+    } else {
+        ESP_LOGI(REST_TAG, "Loaded %d asset(s) from %s", assets, manifest_path);
+    }
+#endif
 
     REST_CHECK(httpd_ssl_start(&server, &conf) == ESP_OK, "Start server failed", err_start);
 
@@ -492,16 +1218,71 @@ esp_err_t start_rest_server(const char *base_path)
     httpd_uri_t system_info_get_uri = {
         .uri = "/api/v1/system/info",
         .method = HTTP_GET,
-        .handler = system_info_get_handler,
+        .handler = system_info_get_handler_metered,
         .user_ctx = rest_context
     };
     httpd_register_uri_handler(server, &system_info_get_uri);
 
+    /* URI handler for scraping metrics */
+    httpd_uri_t metrics_get_uri = {
+        .uri = "/api/v1/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler_metered,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &metrics_get_uri);
+
+    /* URI handler for the read-only stream of state changes */
+    httpd_uri_t events_get_uri = {
+        .uri = "/api/v1/events",
+        .method = HTTP_GET,
+        .handler = events_get_handler_metered,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &events_get_uri);
+
+    if (sse_heartbeat_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = sse_heartbeat_tick,
+            .name = "sse_heartbeat",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &sse_heartbeat_timer));
+    }
+    esp_timer_start_periodic(sse_heartbeat_timer, CONFIG_MK3_SSE_HEARTBEAT_S * 1000000ULL);
+
+    /* URI handler for the current state, long-polled by clients without a WebSocket */
+    httpd_uri_t state_get_uri = {
+        .uri = "/api/v1/state",
+        .method = HTTP_GET,
+        .handler = state_get_handler_metered,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &state_get_uri);
+
+    if (state_poll_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = state_poll_tick,
+            .name = "state_poll",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &state_poll_timer));
+    }
+
+#if CONFIG_MK3_TRACE
+    /* URI handler for dumping the trace ring */
+    httpd_uri_t trace_get_uri = {
+        .uri = "/api/v1/trace",
+        .method = HTTP_GET,
+        .handler = trace_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &trace_get_uri);
+#endif
+
     /* URI handler for light brightness control */
     httpd_uri_t light_brightness_post_uri = {
         .uri = "/api/v1/light/brightness",
         .method = HTTP_POST,
-        .handler = light_brightness_post_handler,
+        .handler = light_brightness_post_handler_metered,
         .user_ctx = rest_context
     };
     httpd_register_uri_handler(server, &light_brightness_post_uri);
@@ -510,33 +1291,34 @@ esp_err_t start_rest_server(const char *base_path)
     httpd_uri_t visor_state_post_uri = {
         .uri = "/api/v1/visor/state",
         .method = HTTP_POST,
-        .handler = visor_state_post_handler,
+        .handler = visor_state_post_handler_metered,
         .user_ctx = rest_context
     };
     httpd_register_uri_handler(server, &visor_state_post_uri);
 
 
-    /* URI handler for getting web server files */
-    httpd_uri_t common_get_uri = {
-        .uri = "/",
-        .method = HTTP_GET,
-        .handler = rest_common_get_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &common_get_uri);
-
     /* URI handler for websocket */
     httpd_uri_t ws = {
         .uri        = "/ws",
         .method     = HTTP_GET,
-        .handler    = ws_handler,
+        .handler    = ws_handler_metered,
         .user_ctx   = NULL,
         .is_websocket = true,
-        .handle_ws_control_frames = true
+        .handle_ws_control_frames = true,
+        .supported_subprotocol = PROTO_BIN_SUBPROTOCOL
     };
     httpd_register_uri_handler(server, &ws);
     wss_keep_alive_set_user_ctx(keep_alive, server);
 
+    /* URI handler for getting web server files, registered last as it matches every path */
+    httpd_uri_t common_get_uri = {
+        .uri = "/*",
+        .method = HTTP_GET,
+        .handler = rest_common_get_handler_metered,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &common_get_uri);
+
 
     return ESP_OK;
 err_start:
@@ -544,24 +1326,3 @@ err_start:
 err:
     return ESP_FAIL;
 }
-
-/* Handle WSS on disconnect */
-static void disconnect_handler(void* arg, esp_event_base_t event_base,
-                               int32_t event_id, void* event_data)
-{
-    httpd_handle_t* server = (httpd_handle_t*) arg;
-    if (*server) {
-        stop_rest_server(*server);
-        *server = NULL;
-    }
-}
-
-/* Handle WSS on connect */
-static void connect_handler(void* arg, esp_event_base_t event_base,
-                            int32_t event_id, void* event_data)
-{
-    httpd_handle_t* server = (httpd_handle_t*) arg;
-    if (*server == NULL) {
-        *server = (void *) start_rest_server(CONFIG_EXAMPLE_WEB_MOUNT_POINT);
-    }
-}
\ No newline at end of file
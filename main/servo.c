@@ -1,9 +1,15 @@
 #include <stdio.h>
+#include <sys/param.h>
 
 #include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
 #include "driver/mcpwm.h"
 #include "soc/mcpwm_periph.h"
 #include "esp_log.h"
+#include "servo.h"
+#include "storage.h"
+#include "trajectory.h"
 
 //You can get these value from the datasheet of servo you use, in general pulse width varies between 1000 to 2000 mocrosecond
 #define SERVO_MIN_PULSEWIDTH 330 //Minimum pulse width in microsecond
@@ -22,6 +28,18 @@
 #define SERVO_BOT_POS_UP 60
 #define SERVO_BOT_POS_DOWN 10
 
+/* Trajectory axes */
+#define AXIS_TOP 0
+#define AXIS_BOT 1
+
+static traj_t traj;
+static portMUX_TYPE traj_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t traj_timer;
+static bool traj_timer_armed;
+static uint32_t move_id;
+static servo_move_cb_t move_cb;
+static void *move_cb_arg;
+
 static void init_servo_gpio(void) {
     ESP_LOGI("example", "initializing mcpwm servo control gpio......\n");
     mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0A, SERVO_BOT_PIN);    //Set bottom servo pin as PWM0A
@@ -39,10 +57,6 @@ static void init_servo_mcpwm(void) {
     mcpwm_init(MCPWM_UNIT_0, MCPWM_TIMER_0, &pwm_config);    //Configure PWM0A & PWM0B with above settings
 }
 
-void init_servo() {
-    init_servo_gpio();
-    init_servo_mcpwm();
-}
 
 /**
  * @brief Use this function to calcute pulse width for per degree rotation
@@ -60,14 +74,89 @@ static uint32_t servo_per_degree_init(uint32_t degree_of_rotation)
 }
 
 /**
- * @brief Set servo by degree and channel
- * 
- * @param degree angle to set servo to, from 0-180
- * @param channel enum, MCPWM_OPR_A = 0, MCPWM_OPR_B = 1
+ * @brief Output pulse widths, one tick of the current trajectory
+ */
+static void traj_tick(void *arg)
+{
+    uint16_t pulse[TRAJ_MAX_AXES];
+    portENTER_CRITICAL(&traj_lock);
+    traj_event_t event = traj_step(&traj, pulse);
+    traj_timer_armed = event == TRAJ_MOVING;
+    uint32_t id = move_id;
+    portEXIT_CRITICAL(&traj_lock);
+
+    if (event == TRAJ_IDLE) {
+        return;
+    }
+    mcpwm_set_duty_in_us(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_TOP_CHANNEL, pulse[AXIS_TOP]);
+    mcpwm_set_duty_in_us(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_BOT_CHANNEL, pulse[AXIS_BOT]);
+
+    if (event == TRAJ_MOVING) {
+        esp_timer_start_once(traj_timer, CONFIG_MK3_SERVO_TICK_MS * 1000);
+    } else if (move_cb) {
+        move_cb(id, SERVO_MOVE_DONE, move_cb_arg);
+    }
+}
+
+/**
+ * @brief Start moving along a path, preempting the current move
  */
-static void servo_set_degree(uint32_t degree, uint8_t channel) {
-    uint32_t angle = servo_per_degree_init(degree);
-    mcpwm_set_duty_in_us(MCPWM_UNIT_0, MCPWM_TIMER_0, channel, angle);
+static uint32_t servo_move(const traj_waypoint_t *path, size_t count)
+{
+    portENTER_CRITICAL(&traj_lock);
+    bool preempted = traj_start(&traj, path, count);
+    uint32_t previous = move_id;
+    uint32_t id = ++move_id;
+    // The tick re-arms itself while moving, only start it if it went idle
+    bool start_timer = !traj_timer_armed;
+    traj_timer_armed = true;
+    portEXIT_CRITICAL(&traj_lock);
+
+    if (preempted && move_cb) {
+        move_cb(previous, SERVO_MOVE_PREEMPTED, move_cb_arg);
+    }
+    if (start_timer) {
+        esp_timer_start_once(traj_timer, 0);
+    }
+    return id;
+}
+
+void servo_set_move_cb(servo_move_cb_t cb, void *arg)
+{
+    move_cb_arg = arg;
+    move_cb = cb;
+}
+
+void init_servo(void) {
+    init_servo_gpio();
+    init_servo_mcpwm();
+
+    const traj_config_t config = {
+        .axes = 2,
+        .tick_ms = CONFIG_MK3_SERVO_TICK_MS,
+        .max_speed = CONFIG_MK3_SERVO_MAX_SPEED,
+        .accel = CONFIG_MK3_SERVO_ACCEL,
+    };
+    // Outputs stay off until the first move, assume the visor rests where it was left
+    uint16_t pulse[TRAJ_MAX_AXES];
+    pulse[AXIS_TOP] = servo_per_degree_init(read_visor() ? SERVO_TOP_POS_UP2 : SERVO_TOP_POS_DOWN);
+    pulse[AXIS_BOT] = servo_per_degree_init(read_visor() ? SERVO_BOT_POS_UP : SERVO_BOT_POS_DOWN);
+    traj_init(&traj, &config, pulse);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = traj_tick,
+        .name = "servo",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &traj_timer));
+}
+
+uint32_t servo_set_pose(uint8_t top_degree, uint8_t bottom_degree)
+{
+    const traj_waypoint_t path[] = {
+        { .pulse = { [AXIS_TOP] = servo_per_degree_init(MIN(top_degree, SERVO_MAX_DEGREE)),
+                     [AXIS_BOT] = servo_per_degree_init(MIN(bottom_degree, SERVO_MAX_DEGREE)) } },
+    };
+    return servo_move(path, sizeof(path) / sizeof(path[0]));
 }
 
 /**
@@ -75,16 +164,24 @@ static void servo_set_degree(uint32_t degree, uint8_t channel) {
  * 
  * @param state 0 = down, 1 = up
  */
-void visor_set_state(uint8_t state) {
+uint32_t visor_set_state(uint8_t state) {
     if (state == 0) {
         // Visor down
         ESP_LOGI("example", "Setting visor down..");
-        servo_set_degree(SERVO_TOP_POS_DOWN, SERVO_TOP_CHANNEL);
-        servo_set_degree(SERVO_BOT_POS_DOWN, SERVO_BOT_CHANNEL);
+        const traj_waypoint_t path[] = {
+            { .pulse = { [AXIS_TOP] = servo_per_degree_init(SERVO_TOP_POS_DOWN),
+                         [AXIS_BOT] = servo_per_degree_init(SERVO_BOT_POS_DOWN) } },
+        };
+        return servo_move(path, sizeof(path) / sizeof(path[0]));
     } else {
         ESP_LOGI("example", "Setting visor up..");
-        servo_set_degree(SERVO_TOP_POS_UP1, SERVO_TOP_CHANNEL);
-        servo_set_degree(SERVO_BOT_POS_UP, SERVO_BOT_CHANNEL);
-        servo_set_degree(SERVO_TOP_POS_UP2, SERVO_TOP_CHANNEL);
+        // Clear the jaw with the faceplate half open before lifting it all the way
+        const traj_waypoint_t path[] = {
+            { .pulse = { [AXIS_TOP] = servo_per_degree_init(SERVO_TOP_POS_UP1),
+                         [AXIS_BOT] = servo_per_degree_init(SERVO_BOT_POS_UP) } },
+            { .pulse = { [AXIS_TOP] = servo_per_degree_init(SERVO_TOP_POS_UP2),
+                         [AXIS_BOT] = servo_per_degree_init(SERVO_BOT_POS_UP) } },
+        };
+        return servo_move(path, sizeof(path) / sizeof(path[0]));
     }
-}
\ No newline at end of file
+}
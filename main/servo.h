@@ -0,0 +1,55 @@
+/* Visor servos
+
+   Moves are planned by the trajectory engine and played back from an
+   esp_timer callback, so the callers never block while the visor moves.
+*/
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    SERVO_MOVE_DONE,        /*!< the move reached its final pose */
+    SERVO_MOVE_PREEMPTED,   /*!< a newer move took over before the end */
+} servo_move_result_t;
+
+/**
+ * @brief Move completion callback
+ *
+ * Called from the esp_timer task when a move ends, or from the task starting a
+ * new move when the previous one is preempted. Must not block.
+ *
+ * @param move_id id returned by the servo call that started the move
+ * @param result how the move ended
+ * @param arg user argument
+ */
+typedef void (*servo_move_cb_t)(uint32_t move_id, servo_move_result_t result, void *arg);
+
+/**
+ * @brief Configures the PWM outputs and the motion timer
+ *
+ * The servos stay unpowered until the first move, which starts from the pose
+ * of the persisted visor state, so init_nvs() must run first.
+ */
+void init_servo(void);
+
+/**
+ * @brief Sets the callback reporting the end of moves
+ */
+void servo_set_move_cb(servo_move_cb_t cb, void *arg);
+
+/**
+ * @brief Moves both servos to an arbitrary pose, returns immediately
+ *
+ * @param top_degree top servo angle, 0-180
+ * @param bottom_degree bottom servo angle, 0-180
+ * @return id of the move, passed to the move callback
+ */
+uint32_t servo_set_pose(uint8_t top_degree, uint8_t bottom_degree);
+
+/**
+ * @brief High level servo control for visor state, returns immediately
+ *
+ * @param state 0 = down, 1 = up
+ * @return id of the move, passed to the move callback
+ */
+uint32_t visor_set_state(uint8_t state);
@@ -0,0 +1,83 @@
+/* RAM-shadowed persistent state
+
+   Every read is served from an in-RAM copy of the persisted values. Writes only
+   update the copy and mark it dirty; a background task coalesces dirty values
+   into a single NVS commit once writes go idle or the dirty window expires.
+   The values are persisted together, as one versioned and CRC-checked blob,
+   so loading costs one read and a commit one write however many there are.
+
+   Every write that changes a value bumps the state generation, a counter that
+   only grows while the device is up, so clients can ask for what changed
+   since the generation they last saw.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Persistence counters
+ */
+typedef struct {
+    uint32_t writes;                /*!< number of write_* calls */
+    uint32_t writes_unchanged;      /*!< writes that did not change the stored value */
+    uint32_t commits;               /*!< NVS commits actually performed */
+    uint32_t commits_avoided;       /*!< writes that did not cost a commit of their own */
+    uint32_t flush_errors;          /*!< failed flushes (values stay dirty and are retried) */
+} storage_stats_t;
+
+/**
+ * @brief Initializes NVS, loads the persisted state into RAM and starts the flusher task
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t init_nvs(void);
+
+uint8_t read_led(void);
+uint8_t read_visor(void);
+
+/**
+ * @brief Updates a value
+ *
+ * @return generation of the change, or 0 if the value was already stored
+ */
+uint32_t write_led(uint8_t val);
+uint32_t write_visor(uint8_t val);
+
+/**
+ * @brief Updates the LED and the visor together, as one change
+ *
+ * The values that change share one generation and are committed together.
+ *
+ * @param led new LED value, or -1 to leave it
+ * @param visor new visor state, or -1 to leave it
+ * @return generation of the change, or 0 if both values were already stored
+ */
+uint32_t write_scene(int led, int visor);
+
+/**
+ * @brief Gets the current state generation
+ */
+uint32_t storage_generation(void);
+
+/**
+ * @brief Gets the generation at which a value last changed
+ */
+uint32_t read_led_generation(void);
+uint32_t read_visor_generation(void);
+
+/**
+ * @brief Writes all dirty values to NVS with a single commit, blocking until done
+ *
+ * Registered as a shutdown handler, so it also runs on esp_restart().
+ *
+ * @return ESP_OK on success or if nothing was dirty
+ */
+esp_err_t storage_flush(void);
+
+/**
+ * @brief Gets a snapshot of the persistence counters
+ *
+ * @param stats output
+ */
+void storage_get_stats(storage_stats_t *stats);
@@ -0,0 +1,160 @@
+/* TLS setup of the HTTPS/WSS server
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <sys/param.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_tls.h>
+#include "freertos/FreeRTOS.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/ssl_ticket.h"
+#include "tls_server.h"
+
+/*
+ * esp-tls builds the mbedTLS configuration of each connection itself, so the
+ * hooks below are reached by wrapping symbols at link time (see CMakeLists.txt):
+ *   esp_tls_server_session_create  times the whole handshake
+ *   mbedtls_ssl_setup              adds the session cache and cipher profile to server configs
+ *   mbedtls_ssl_ticket_parse       notices ticket-based resumption
+ * All handshakes run on the httpd task, one at a time, so the per-handshake
+ * flag needs no locking; only the counters are read from other tasks.
+ */
+
+static const char *TAG = "tls";
+
+static tls_server_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool handshake_resumed;
+
+#if CONFIG_MK3_TLS_SESSION_CACHE
+static mbedtls_ssl_cache_context session_cache;
+static bool session_cache_ready;
+#endif
+
+#if CONFIG_MK3_TLS_PROFILE_ECDSA_P256
+#define PROFILE_NAME "ECDSA P-256"
+
+static const int ECDSA_CIPHERSUITES[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA,
+    0
+};
+
+static const mbedtls_ecp_group_id ECDSA_CURVES[] = {
+    MBEDTLS_ECP_DP_SECP256R1,
+    MBEDTLS_ECP_DP_NONE
+};
+#else
+#define PROFILE_NAME "RSA 2048"
+#endif
+
+void tls_server_configure(httpd_ssl_config_t *conf)
+{
+    // The profile picks which pair is embedded, under the same symbol names
+    extern const unsigned char cacert_pem_start[] asm("_binary_cacert_pem_start");
+    extern const unsigned char cacert_pem_end[]   asm("_binary_cacert_pem_end");
+    conf->cacert_pem = cacert_pem_start;
+    conf->cacert_len = cacert_pem_end - cacert_pem_start;
+
+    extern const unsigned char prvtkey_pem_start[] asm("_binary_prvtkey_pem_start");
+    extern const unsigned char prvtkey_pem_end[]   asm("_binary_prvtkey_pem_end");
+    conf->prvtkey_pem = prvtkey_pem_start;
+    conf->prvtkey_len = prvtkey_pem_end - prvtkey_pem_start;
+
+#if CONFIG_MK3_TLS_SESSION_TICKETS
+    conf->session_tickets = true;
+    ESP_LOGI(TAG, "Session tickets enabled");
+#endif
+#if CONFIG_MK3_TLS_SESSION_CACHE
+    if (!session_cache_ready) {
+        mbedtls_ssl_cache_init(&session_cache);
+        mbedtls_ssl_cache_set_max_entries(&session_cache, CONFIG_MK3_TLS_SESSION_CACHE_SIZE);
+        mbedtls_ssl_cache_set_timeout(&session_cache, CONFIG_MK3_TLS_SESSION_CACHE_TIMEOUT);
+        session_cache_ready = true;
+    }
+    ESP_LOGI(TAG, "Session cache: %d entries, %d s", CONFIG_MK3_TLS_SESSION_CACHE_SIZE,
+             CONFIG_MK3_TLS_SESSION_CACHE_TIMEOUT);
+#endif
+    ESP_LOGI(TAG, "Certificate profile: " PROFILE_NAME);
+}
+
+void tls_server_get_stats(tls_server_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+#if CONFIG_MK3_TLS_SESSION_CACHE
+static int session_cache_get(void *ctx, mbedtls_ssl_session *session)
+{
+    int ret = mbedtls_ssl_cache_get(ctx, session);
+    handshake_resumed |= ret == 0;
+    return ret;
+}
+#endif
+
+int __real_mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf);
+
+int __wrap_mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf)
+{
+    if (conf->endpoint == MBEDTLS_SSL_IS_SERVER) {
+        // Owned by the esp_tls_t of this connection, which is not const
+        mbedtls_ssl_config *server_conf = (mbedtls_ssl_config *)conf;
+#if CONFIG_MK3_TLS_SESSION_CACHE
+        mbedtls_ssl_conf_session_cache(server_conf, &session_cache, session_cache_get, mbedtls_ssl_cache_set);
+#endif
+#if CONFIG_MK3_TLS_PROFILE_ECDSA_P256
+        mbedtls_ssl_conf_ciphersuites(server_conf, ECDSA_CIPHERSUITES);
+        mbedtls_ssl_conf_curves(server_conf, ECDSA_CURVES);
+#endif
+        (void)server_conf;
+    }
+    return __real_mbedtls_ssl_setup(ssl, conf);
+}
+
+#if CONFIG_MK3_TLS_SESSION_TICKETS
+int __real_mbedtls_ssl_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len);
+
+int __wrap_mbedtls_ssl_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len)
+{
+    int ret = __real_mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+    handshake_resumed |= ret == 0;
+    return ret;
+}
+#endif
+
+int __real_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls);
+
+int __wrap_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls)
+{
+    handshake_resumed = false;
+    int64_t start = esp_timer_get_time();
+    int ret = __real_esp_tls_server_session_create(cfg, sockfd, tls);
+    uint32_t elapsed = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&stats_lock);
+    if (ret != 0) {
+        stats.failed++;
+    } else if (handshake_resumed) {
+        stats.resumed++;
+        stats.resumed_us += elapsed;
+        stats.resumed_max_us = MAX(stats.resumed_max_us, elapsed);
+    } else {
+        stats.full++;
+        stats.full_us += elapsed;
+        stats.full_max_us = MAX(stats.full_max_us, elapsed);
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    ESP_LOGD(TAG, "fd %d: %s handshake in %u us", sockfd,
+             ret != 0 ? "failed" : handshake_resumed ? "resumed" : "full", elapsed);
+    return ret;
+}
@@ -0,0 +1,38 @@
+/* TLS setup of the HTTPS/WSS server
+
+   Picks the certificate profile, enables session resumption (a bounded
+   session ID cache and/or session tickets, see the "TLS" menu) and times
+   every handshake, so the cost of full and resumed handshakes can be
+   compared on the device.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <esp_https_server.h>
+
+/**
+ * @brief Handshake counters, times in microseconds
+ */
+typedef struct {
+    uint32_t full;              /*!< completed full handshakes */
+    uint32_t resumed;           /*!< completed abbreviated handshakes */
+    uint32_t failed;            /*!< handshakes that did not complete */
+    uint64_t full_us;           /*!< total time spent in full handshakes */
+    uint64_t resumed_us;        /*!< total time spent in resumed handshakes */
+    uint32_t full_max_us;       /*!< slowest full handshake */
+    uint32_t resumed_max_us;    /*!< slowest resumed handshake */
+} tls_server_stats_t;
+
+/**
+ * @brief Fills in the certificate and session resumption settings
+ *
+ * @param conf server configuration to update
+ */
+void tls_server_configure(httpd_ssl_config_t *conf);
+
+/**
+ * @brief Gets a snapshot of the handshake counters
+ *
+ * @param[out] stats counters
+ */
+void tls_server_get_stats(tls_server_stats_t *stats);
@@ -0,0 +1,34 @@
+/* Token bucket rate limiter
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "token_bucket.h"
+
+#define MILLI_TOKENS 1000
+
+void token_bucket_init(token_bucket_t *tb, const token_bucket_config_t *config, uint32_t now_ms)
+{
+    tb->level = config->burst * MILLI_TOKENS;
+    tb->last_ms = now_ms;
+}
+
+bool token_bucket_take(token_bucket_t *tb, const token_bucket_config_t *config, uint32_t now_ms)
+{
+    if (config->rate == 0) {
+        return true;
+    }
+    // rate tokens per second is rate thousandths of a token per millisecond
+    uint64_t level = tb->level + (uint64_t)(now_ms - tb->last_ms) * config->rate;
+    uint32_t full = config->burst * MILLI_TOKENS;
+    tb->level = level > full ? full : level;
+    tb->last_ms = now_ms;
+    if (tb->level < MILLI_TOKENS) {
+        return false;
+    }
+    tb->level -= MILLI_TOKENS;
+    return true;
+}
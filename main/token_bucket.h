@@ -0,0 +1,38 @@
+/* Token bucket rate limiter
+
+   A bucket holds up to `burst` tokens and refills at `rate` tokens per
+   second; every admitted event takes one token. Levels are kept in
+   thousandths of a token, so refills are exact for whole-millisecond ticks.
+   No ESP-IDF dependencies, so it also builds on the host.
+
+   Times are 32-bit millisecond ticks; differences are wrap-around safe.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Bucket parameters, shared by every bucket of one class
+ */
+typedef struct {
+    uint32_t rate;      /*!< tokens added per second, 0 for no limit */
+    uint32_t burst;     /*!< bucket size, in tokens */
+} token_bucket_config_t;
+
+typedef struct {
+    uint32_t level;     // thousandths of a token
+    uint32_t last_ms;   // time of the last refill
+} token_bucket_t;
+
+/**
+ * @brief Fills a bucket
+ */
+void token_bucket_init(token_bucket_t *tb, const token_bucket_config_t *config, uint32_t now_ms);
+
+/**
+ * @brief Refills a bucket for the time elapsed and takes one token if there is one
+ *
+ * @return true if the event is admitted
+ */
+bool token_bucket_take(token_bucket_t *tb, const token_bucket_config_t *config, uint32_t now_ms);
@@ -0,0 +1,162 @@
+/* Hot-path trace ring
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "sdkconfig.h"
+
+#if CONFIG_MK3_TRACE
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "esp_ipc.h"
+#include "trace.h"
+
+#define TRACE_RING_SIZE CONFIG_MK3_TRACE_RING_SIZE
+
+typedef struct {
+    uint32_t start;         // cycle count of the core that recorded it
+    uint32_t cycles;        // span length
+    uint16_t arg;
+    uint8_t event;
+    uint8_t core : 7;
+    uint8_t instant : 1;
+} trace_record_t;
+
+static const char *const EVENT_NAMES[TRACE_EV_MAX] = {
+    [TRACE_EV_HANDLER] = "handler",
+    [TRACE_EV_WS_PARSE] = "ws_parse",
+    [TRACE_EV_NVS_WRITE] = "nvs_write",
+    [TRACE_EV_ACTUATE] = "actuate",
+    [TRACE_EV_BROADCAST] = "broadcast",
+    [TRACE_EV_WS_SEND] = "ws_send",
+};
+
+static trace_record_t ring[TRACE_RING_SIZE];
+static uint32_t head;       // records claimed so far
+static uint32_t paused;
+
+static void record(trace_event_t event, uint16_t arg, uint32_t start, uint32_t cycles, bool instant)
+{
+    if (__atomic_load_n(&paused, __ATOMIC_RELAXED)) {
+        return;
+    }
+    uint32_t idx = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    trace_record_t *rec = &ring[idx % TRACE_RING_SIZE];
+    rec->start = start;
+    rec->cycles = cycles;
+    rec->arg = arg;
+    rec->event = event;
+    rec->core = xPortGetCoreID();
+    rec->instant = instant;
+}
+
+void trace_span(trace_event_t event, uint16_t arg, uint32_t start)
+{
+    uint32_t now = trace_now();
+    record(event, arg, start, now - start, false);
+}
+
+void trace_instant(trace_event_t event, uint16_t arg)
+{
+    record(event, arg, trace_now(), 0, true);
+}
+
+/* Pairs of (cycle count, esp_timer time) taken on each core at export time */
+typedef struct {
+    uint32_t cycles;
+    int64_t us;
+} trace_anchor_t;
+
+static void take_anchor(void *arg)
+{
+    trace_anchor_t *anchor = arg;
+    anchor->us = esp_timer_get_time();
+    anchor->cycles = trace_now();
+}
+
+__attribute__((format(printf, 3, 4)))
+static void emit(trace_write_cb_t write, void *ctx, const char *fmt, ...)
+{
+    char line[128];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len > 0) {
+        write(ctx, line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+/*
+ * Cycle counters are per core and wrap every few seconds, so each record is
+ * placed by its age relative to an anchor taken on its core now. Walking from
+ * the newest record back, ages grow, except that a span is recorded when it
+ * ends, so an enclosing span comes before the spans it contains; those step
+ * back by far less than half a wrap, a bigger drop means the counter wrapped
+ * in between. Gaps longer than one wrap (2^32 cycles, about 18 s at 240 MHz)
+ * between two records of a core cannot be seen and are shortened.
+ */
+void trace_export(trace_write_cb_t write, void *ctx)
+{
+    __atomic_store_n(&paused, 1, __ATOMIC_RELAXED);
+
+    trace_anchor_t anchors[portNUM_PROCESSORS];
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        if (core == xPortGetCoreID()) {
+            take_anchor(&anchors[core]);
+        } else {
+            esp_ipc_call_blocking(core, take_anchor, &anchors[core]);
+        }
+    }
+    const uint32_t cycles_per_us = esp_rom_get_cpu_ticks_per_us();
+
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    uint32_t count = end < TRACE_RING_SIZE ? end : TRACE_RING_SIZE;
+
+    // Ages are resolved newest first, then written oldest first
+    static uint64_t ages[TRACE_RING_SIZE];
+    uint32_t last_age[portNUM_PROCESSORS] = { 0 };
+    uint32_t wraps[portNUM_PROCESSORS] = { 0 };
+    for (uint32_t i = 0; i < count; ++i) {
+        const trace_record_t *rec = &ring[(end - 1 - i) % TRACE_RING_SIZE];
+        uint32_t age = anchors[rec->core].cycles - rec->start;
+        if (last_age[rec->core] - age > 0x80000000u && age < last_age[rec->core]) {
+            wraps[rec->core]++;
+        }
+        last_age[rec->core] = age;
+        ages[i] = ((uint64_t)wraps[rec->core] << 32) + age;
+    }
+
+    emit(write, ctx, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (uint32_t i = count; i-- > 0;) {
+        const trace_record_t *rec = &ring[(end - 1 - i) % TRACE_RING_SIZE];
+        int64_t ts_ns = anchors[rec->core].us * 1000 - (int64_t)(ages[i] * 1000 / cycles_per_us);
+        if (ts_ns < 0) {
+            ts_ns = 0;
+        }
+        emit(write, ctx, "%s{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%lld.%03u",
+             i == count - 1 ? "" : ",", EVENT_NAMES[rec->event], rec->instant ? "i" : "X", rec->core,
+             (long long)(ts_ns / 1000), (unsigned)(ts_ns % 1000));
+        if (rec->instant) {
+            emit(write, ctx, ",\"s\":\"t\"");
+        } else {
+            uint64_t dur_ns = (uint64_t)rec->cycles * 1000 / cycles_per_us;
+            emit(write, ctx, ",\"dur\":%llu.%03u", (unsigned long long)(dur_ns / 1000), (unsigned)(dur_ns % 1000));
+        }
+        emit(write, ctx, ",\"args\":{\"arg\":%u}}\n", rec->arg);
+    }
+    emit(write, ctx, "]}\n");
+
+    __atomic_store_n(&paused, 0, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/* Hot-path trace ring
+
+   Records spans and instants of the command path (handler, frame parse,
+   NVS write, actuator call, broadcast, socket sends) into a fixed-size ring,
+   timestamped with the CPU cycle counter, and exports the ring as Chrome
+   trace_event JSON (load it in chrome://tracing or ui.perfetto.dev).
+
+   Enabled with CONFIG_MK3_TRACE. When disabled, every TRACE_* macro
+   compiles to nothing and its arguments are not evaluated.
+
+   Span arguments:
+     handler        metrics_handler_t of the URI handler
+     ws_parse       frame length
+     nvs_write      storage field, or the field count for a scene
+     actuate        proto_field_t
+     broadcast      type character of the update ('l', 'v')
+     ws_send        socket fd
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+typedef enum {
+    TRACE_EV_HANDLER = 0,
+    TRACE_EV_WS_PARSE,
+    TRACE_EV_NVS_WRITE,
+    TRACE_EV_ACTUATE,
+    TRACE_EV_BROADCAST,
+    TRACE_EV_WS_SEND,
+    TRACE_EV_MAX,
+} trace_event_t;
+
+#if CONFIG_MK3_TRACE
+
+#include "esp_cpu.h"
+
+/**
+ * @brief Receives the exported JSON piece by piece
+ */
+typedef void (*trace_write_cb_t)(void *ctx, const char *text, size_t len);
+
+static inline uint32_t trace_now(void)
+{
+    return esp_cpu_get_ccount();
+}
+
+/**
+ * @brief Records a span that started at the given cycle count and ends now, lock-free
+ */
+void trace_span(trace_event_t event, uint16_t arg, uint32_t start);
+
+/**
+ * @brief Records an instant event, lock-free
+ */
+void trace_instant(trace_event_t event, uint16_t arg);
+
+/**
+ * @brief Writes the ring as Chrome trace_event JSON, oldest event first
+ *
+ * Recording is paused meanwhile.
+ */
+void trace_export(trace_write_cb_t write, void *ctx);
+
+#define TRACE_SPAN_BEGIN(span)          uint32_t span = trace_now()
+#define TRACE_SPAN_END(span, ev, arg)   trace_span((ev), (arg), (span))
+#define TRACE_INSTANT(ev, arg)          trace_instant((ev), (arg))
+
+#else
+
+#define TRACE_SPAN_BEGIN(span)          do { } while (0)
+#define TRACE_SPAN_END(span, ev, arg)   do { } while (0)
+#define TRACE_INSTANT(ev, arg)          do { } while (0)
+
+#endif
@@ -0,0 +1,134 @@
+/* Servo trajectory planner
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "trajectory.h"
+
+#define Q 8
+
+static inline int32_t abs32(int32_t x)
+{
+    return x < 0 ? -x : x;
+}
+
+static inline uint16_t to_pulse(int32_t pos)
+{
+    return (pos + (1 << (Q - 1))) >> Q;
+}
+
+void traj_init(traj_t *traj, const traj_config_t *config, const uint16_t *pulse)
+{
+    memset(traj, 0, sizeof(*traj));
+    traj->axes = config->axes < TRAJ_MAX_AXES ? config->axes : TRAJ_MAX_AXES;
+    traj->tick_ms = config->tick_ms ? config->tick_ms : 1;
+    // Per second to per tick: v * t and a * t^2, kept at least one LSB
+    int64_t t = traj->tick_ms;
+    traj->max_speed = ((int64_t)config->max_speed * t << Q) / 1000;
+    traj->accel = ((int64_t)config->accel * t * t << Q) / 1000000;
+    if (traj->max_speed < 1) {
+        traj->max_speed = 1;
+    }
+    if (traj->accel < 1) {
+        traj->accel = 1;
+    }
+    for (int i = 0; i < traj->axes; ++i) {
+        traj->pos[i] = (int32_t)pulse[i] << Q;
+    }
+}
+
+bool traj_start(traj_t *traj, const traj_waypoint_t *path, size_t count)
+{
+    bool preempted = traj->active;
+    if (count > TRAJ_MAX_WAYPOINTS) {
+        count = TRAJ_MAX_WAYPOINTS;
+    }
+    memcpy(traj->path, path, count * sizeof(traj_waypoint_t));
+    traj->count = count;
+    traj->index = 0;
+    traj->dwell_ticks = 0;
+    traj->active = count > 0;
+    return preempted;
+}
+
+// Distance covered after a step at speed, braking by accel every tick until stopped
+static int64_t stopping_distance(int32_t speed, int32_t accel)
+{
+    int64_t n = speed / accel;
+    return n * speed - (int64_t)accel * n * (n + 1) / 2;
+}
+
+// Moves one axis a tick closer to target, returns true once it rests on it
+static bool step_axis(traj_t *traj, int axis, int32_t target)
+{
+    int32_t err = target - traj->pos[axis];
+    int32_t vel = traj->vel[axis];
+    int32_t accel = traj->accel;
+    if (err == 0) {
+        // Steps never pass the target, so any speed left is dropped here
+        traj->vel[axis] = 0;
+        return true;
+    }
+
+    int32_t dir = err > 0 ? 1 : -1;
+    int32_t speed = abs32(vel);
+    if (vel != 0 && (vel > 0) != (err > 0)) {
+        // Preempted while heading the other way: brake first
+        speed = speed > accel ? speed - accel : 0;
+        traj->vel[axis] = vel > 0 ? speed : -speed;
+    } else {
+        // Fastest of accelerating, cruising and braking that can still stop on the target
+        int32_t faster = speed + accel < traj->max_speed ? speed + accel : traj->max_speed;
+        int32_t candidates[] = { faster, speed, speed - accel };
+        int32_t next = speed > accel ? speed - accel : accel;
+        for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+            if (candidates[i] > 0 && candidates[i] + stopping_distance(candidates[i], accel) <= abs32(err)) {
+                next = candidates[i];
+                break;
+            }
+        }
+        // Only a preemption too close to stop in can still need this, it arrives early rather than pass
+        speed = next < abs32(err) ? next : abs32(err);
+        traj->vel[axis] = dir * speed;
+    }
+    traj->pos[axis] += traj->vel[axis];
+    return false;
+}
+
+traj_event_t traj_step(traj_t *traj, uint16_t *pulse)
+{
+    if (!traj->active) {
+        return TRAJ_IDLE;
+    }
+
+    const traj_waypoint_t *wp = &traj->path[traj->index];
+    bool arrived = true;
+    for (int i = 0; i < traj->axes; ++i) {
+        arrived &= step_axis(traj, i, (int32_t)wp->pulse[i] << Q);
+        pulse[i] = to_pulse(traj->pos[i]);
+    }
+
+    if (arrived) {
+        if (traj->dwell_ticks == 0 && wp->dwell_ms) {
+            // Just arrived, the arrival tick counts towards the hold
+            traj->dwell_ticks = (wp->dwell_ms + traj->tick_ms - 1) / traj->tick_ms;
+        }
+        if (traj->dwell_ticks > 0 && --traj->dwell_ticks > 0) {
+            return TRAJ_MOVING;
+        }
+        if (++traj->index >= traj->count) {
+            traj->active = false;
+            return TRAJ_DONE;
+        }
+    }
+    return TRAJ_MOVING;
+}
+
+bool traj_active(const traj_t *traj)
+{
+    return traj->active;
+}
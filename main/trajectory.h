@@ -0,0 +1,96 @@
+/* Servo trajectory planner
+
+   Moves a group of axes (servo pulse widths, in microseconds) through a path
+   of waypoints with trapezoidal velocity profiles: each axis accelerates at a
+   bounded rate up to a top speed and brakes so it stops exactly on the
+   waypoint. The profile is computed online, one tick at a time, in integer
+   fixed point, so a new path can replace the current one at any tick and
+   starts from the current position and velocity without a jump. An axis
+   never passes the waypoint it heads for: a new path whose first waypoint is
+   closer than the braking distance stops on it harder than the bound.
+
+   No ESP-IDF dependencies, so it also builds on the host. Not thread-safe,
+   callers serialize access.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRAJ_MAX_AXES       2
+#define TRAJ_MAX_WAYPOINTS  4
+
+/**
+ * @brief Planner configuration
+ */
+typedef struct {
+    uint8_t axes;               /*!< number of axes, up to TRAJ_MAX_AXES */
+    uint32_t tick_ms;           /*!< time between two traj_step() calls */
+    uint32_t max_speed;         /*!< top speed, in us of pulse width per second */
+    uint32_t accel;             /*!< acceleration and braking, in us per second squared */
+} traj_config_t;
+
+/**
+ * @brief One point of a path
+ */
+typedef struct {
+    uint16_t pulse[TRAJ_MAX_AXES];  /*!< target pulse width of each axis, in us */
+    uint16_t dwell_ms;              /*!< time to hold the point before moving on */
+} traj_waypoint_t;
+
+typedef enum {
+    TRAJ_IDLE,                  /*!< nothing to do, outputs unchanged */
+    TRAJ_MOVING,                /*!< outputs updated, path not finished */
+    TRAJ_DONE,                  /*!< outputs updated, last waypoint reached and held */
+} traj_event_t;
+
+/**
+ * @brief Planner state
+ */
+typedef struct {
+    int32_t pos[TRAJ_MAX_AXES];     /*!< position, us in Q8 */
+    int32_t vel[TRAJ_MAX_AXES];     /*!< velocity, us per tick in Q8 */
+    int32_t max_speed;              /*!< us per tick in Q8 */
+    int32_t accel;                  /*!< us per tick squared in Q8 */
+    uint32_t tick_ms;
+    uint8_t axes;
+    uint8_t count;                  /*!< waypoints in path */
+    uint8_t index;                  /*!< waypoint being approached or held */
+    bool active;
+    uint32_t dwell_ticks;           /*!< ticks left to hold the current waypoint */
+    traj_waypoint_t path[TRAJ_MAX_WAYPOINTS];
+} traj_t;
+
+/**
+ * @brief Initializes a planner at rest
+ *
+ * @param traj planner
+ * @param config configuration
+ * @param pulse initial pulse width of each axis, in us
+ */
+void traj_init(traj_t *traj, const traj_config_t *config, const uint16_t *pulse);
+
+/**
+ * @brief Starts a new path, replacing the current one
+ *
+ * Motion continues from the current position and velocity.
+ *
+ * @param path waypoints, truncated to TRAJ_MAX_WAYPOINTS
+ * @param count number of waypoints
+ * @return true if an unfinished path was preempted
+ */
+bool traj_start(traj_t *traj, const traj_waypoint_t *path, size_t count);
+
+/**
+ * @brief Advances the motion by one tick
+ *
+ * @param[out] pulse pulse width of each axis to output, in us
+ * @return what happened during this tick
+ */
+traj_event_t traj_step(traj_t *traj, uint16_t *pulse);
+
+/**
+ * @brief Checks whether a path is in progress
+ */
+bool traj_active(const traj_t *traj);
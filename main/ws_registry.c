@@ -0,0 +1,112 @@
+/* Registry of the open connections and their subscriptions
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "ws_registry.h"
+
+static void count_topics(ws_registry_t *reg, uint32_t topics, int delta)
+{
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if (topics & PROTO_TOPIC(i)) {
+            __atomic_store_n(&reg->subscribers[i], reg->subscribers[i] + delta, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void count_kind(ws_registry_t *reg, ws_client_kind_t kind, int delta)
+{
+    __atomic_store_n(&reg->kinds[kind], reg->kinds[kind] + delta, __ATOMIC_RELAXED);
+}
+
+void ws_registry_init(ws_registry_t *reg, ws_client_t *storage, size_t capacity,
+                      size_t max_websockets, size_t max_streams)
+{
+    reg->clients = storage;
+    reg->capacity = capacity;
+    reg->count = 0;
+    for (int i = 0; i < WS_CLIENT_KIND_MAX; ++i) {
+        reg->kinds[i] = 0;
+    }
+    reg->limits[WS_CLIENT_HTTP] = capacity;
+    reg->limits[WS_CLIENT_WEBSOCKET] = max_websockets;
+    reg->limits[WS_CLIENT_EVENTS] = max_streams;
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        reg->subscribers[i] = 0;
+    }
+}
+
+ws_client_t *ws_registry_find(ws_registry_t *reg, int fd)
+{
+    for (size_t i = 0; i < reg->count; ++i) {
+        if (reg->clients[i].fd == fd) {
+            return &reg->clients[i];
+        }
+    }
+    return NULL;
+}
+
+bool ws_registry_add(ws_registry_t *reg, int fd)
+{
+    if (reg->count == reg->capacity || ws_registry_find(reg, fd)) {
+        return false;
+    }
+    reg->clients[reg->count++] = (ws_client_t) {
+        .fd = fd,
+        .kind = WS_CLIENT_HTTP,
+        .encoding = PROTO_ENC_TEXT,
+        .topics = 0,
+    };
+    return true;
+}
+
+void ws_registry_remove(ws_registry_t *reg, int fd)
+{
+    ws_client_t *client = ws_registry_find(reg, fd);
+    if (client == NULL) {
+        return;
+    }
+    if (client->kind != WS_CLIENT_HTTP) {
+        count_kind(reg, client->kind, -1);
+        count_topics(reg, client->topics, -1);
+    }
+    // Keep the array dense so broadcasts only walk live clients
+    *client = reg->clients[--reg->count];
+}
+
+bool ws_registry_upgrade(ws_registry_t *reg, int fd, ws_client_kind_t kind, proto_encoding_t encoding)
+{
+    ws_client_t *client = ws_registry_find(reg, fd);
+    if (client == NULL || kind == WS_CLIENT_HTTP) {
+        return false;
+    }
+    if (client->kind == kind) {
+        client->encoding = encoding;
+        return true;
+    }
+    if (client->kind != WS_CLIENT_HTTP || reg->kinds[kind] == reg->limits[kind]) {
+        return false;
+    }
+    count_kind(reg, kind, 1);
+    client->kind = kind;
+    client->encoding = encoding;
+    client->topics = PROTO_TOPIC_ALL;
+    count_topics(reg, client->topics, 1);
+    return true;
+}
+
+bool ws_registry_subscribe(ws_registry_t *reg, int fd, uint32_t topics)
+{
+    ws_client_t *client = ws_registry_find(reg, fd);
+    if (client == NULL || client->kind == WS_CLIENT_HTTP) {
+        return false;
+    }
+    topics &= PROTO_TOPIC_ALL;
+    count_topics(reg, client->topics & ~topics, -1);
+    count_topics(reg, topics & ~client->topics, 1);
+    client->topics = topics;
+    return true;
+}
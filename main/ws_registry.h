@@ -0,0 +1,130 @@
+/* Registry of the open connections and their subscriptions
+
+   Tracks every httpd session from open to close, which of them became a
+   WebSocket client or an event stream, the encoding each negotiated and the
+   topics it is subscribed to (one per protocol field, see PROTO_TOPIC).
+   Broadcasts walk the registry instead of asking httpd for its client list
+   and the type of every socket, and skip a topic with no subscribers without
+   any work.
+
+   Clients are kept densely packed in the storage given to ws_registry_init(),
+   in no particular order. Changes are made from the httpd task only; the
+   client and subscriber counts may be read from any task.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+typedef enum {
+    WS_CLIENT_HTTP = 0,         /*!< plain requests, gets no broadcasts */
+    WS_CLIENT_WEBSOCKET,        /*!< completed the /ws handshake */
+    WS_CLIENT_EVENTS,           /*!< Server-Sent Events stream */
+    WS_CLIENT_KIND_MAX,
+} ws_client_kind_t;
+
+typedef struct {
+    int fd;                     /*!< httpd session socket */
+    ws_client_kind_t kind;
+    proto_encoding_t encoding;  /*!< encoding of broadcasts */
+    uint32_t topics;            /*!< PROTO_TOPIC mask, all topics after the upgrade */
+} ws_client_t;
+
+typedef struct {
+    ws_client_t *clients;       /*!< clients[0..count) are in use */
+    size_t capacity;            /*!< connections of any kind */
+    size_t count;
+    size_t limits[WS_CLIENT_KIND_MAX];      /*!< connections that may upgrade to each kind */
+    size_t kinds[WS_CLIENT_KIND_MAX];       /*!< connections of each kind, HTTP not counted */
+    uint16_t subscribers[PROTO_FIELD_MAX];  /*!< clients per topic */
+} ws_registry_t;
+
+/**
+ * @brief Initializes an empty registry
+ *
+ * @param reg registry
+ * @param storage room for capacity clients
+ * @param capacity maximum open connections
+ * @param max_websockets maximum WebSocket clients among them
+ * @param max_streams maximum event streams among them
+ */
+void ws_registry_init(ws_registry_t *reg, ws_client_t *storage, size_t capacity,
+                      size_t max_websockets, size_t max_streams);
+
+/**
+ * @brief Registers a new connection, as a plain HTTP client
+ *
+ * @return false if the registry is full or the fd is already registered
+ */
+bool ws_registry_add(ws_registry_t *reg, int fd);
+
+/**
+ * @brief Forgets a connection, if registered
+ */
+void ws_registry_remove(ws_registry_t *reg, int fd);
+
+/**
+ * @brief Finds a connection
+ *
+ * @return client, or NULL if the fd is not registered
+ */
+ws_client_t *ws_registry_find(ws_registry_t *reg, int fd);
+
+/**
+ * @brief Turns a connection into a client of the given kind, subscribed to every topic
+ *
+ * Upgrading a client to its own kind again only changes its encoding.
+ *
+ * @param kind WS_CLIENT_WEBSOCKET or WS_CLIENT_EVENTS
+ * @param encoding encoding of its broadcasts
+ * @return false if the fd is not registered, is already of another kind,
+ *         or the limit of the kind is reached
+ */
+bool ws_registry_upgrade(ws_registry_t *reg, int fd, ws_client_kind_t kind, proto_encoding_t encoding);
+
+/**
+ * @brief Replaces the topics of a WebSocket client or event stream
+ *
+ * @param topics PROTO_TOPIC mask, bits of unknown topics are ignored
+ * @return false if the fd is a plain HTTP client or not registered
+ */
+bool ws_registry_subscribe(ws_registry_t *reg, int fd, uint32_t topics);
+
+/**
+ * @brief Number of clients of a kind
+ */
+static inline size_t ws_registry_count(const ws_registry_t *reg, ws_client_kind_t kind)
+{
+    return __atomic_load_n(&reg->kinds[kind], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Number of clients subscribed to the topic of a field
+ */
+static inline size_t ws_registry_subscribers(const ws_registry_t *reg, proto_field_t field)
+{
+    return __atomic_load_n(&reg->subscribers[field], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Whether any client is subscribed to one of the topics
+ */
+static inline bool ws_registry_has_subscribers(const ws_registry_t *reg, uint32_t topics)
+{
+    for (int i = 0; i < PROTO_FIELD_MAX; ++i) {
+        if ((topics & PROTO_TOPIC(i)) && ws_registry_subscribers(reg, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Whether a client gets an update of the given topics
+ */
+static inline bool ws_client_wants(const ws_client_t *client, uint32_t topics)
+{
+    return client->kind != WS_CLIENT_HTTP && (client->topics & topics);
+}
@@ -0,0 +1,99 @@
+/* Web bundle served straight from a memory-mapped flash partition
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "sdkconfig.h"
+
+#if CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "www_image.h"
+#include "www_index.h"
+
+static const char *TAG = "www";
+
+#define WWW_IMAGE_MAGIC "MK3W"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t image_id;
+    uint32_t size;
+} www_header_t;
+
+static const uint8_t *image;
+static spi_flash_mmap_handle_t image_handle;
+
+esp_err_t www_image_mount(const char *label)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (part == NULL) {
+        ESP_LOGE(TAG, "No \"%s\" partition", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (part->size < WWW_IMAGE_SIZE) {
+        ESP_LOGE(TAG, "Partition holds %d bytes, image needs %d", part->size, WWW_IMAGE_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const void *ptr;
+    esp_err_t ret = esp_partition_mmap(part, 0, WWW_IMAGE_SIZE, SPI_FLASH_MMAP_DATA, &ptr, &image_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    const www_header_t *header = ptr;
+    if (memcmp(header->magic, WWW_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != WWW_IMAGE_VERSION || header->image_id != WWW_IMAGE_ID ||
+        header->size != WWW_IMAGE_SIZE) {
+        ESP_LOGE(TAG, "Web image does not match this firmware, run 'idf.py flash' again");
+        spi_flash_munmap(image_handle);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    image = ptr;
+    ESP_LOGI(TAG, "Mapped %d file(s), %d bytes", sizeof(WWW_FILES) / sizeof(WWW_FILES[0]), WWW_IMAGE_SIZE);
+    return ESP_OK;
+}
+
+const www_file_t *www_image_find(const char *path, size_t len)
+{
+    if (image == NULL) {
+        return NULL;
+    }
+    size_t lo = 0, hi = sizeof(WWW_FILES) / sizeof(WWW_FILES[0]);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const char *candidate = WWW_FILES[mid].asset.path;
+        int cmp = strncmp(candidate, path, len);
+        if (cmp == 0 && candidate[len] != '\0') {
+            cmp = 1;
+        }
+        if (cmp == 0) {
+            return &WWW_FILES[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *www_image_data(const www_file_t *file, bool gzip, size_t *size)
+{
+    if (gzip && file->asset.gzip) {
+        *size = file->gz_size;
+        return image + file->gz_offset;
+    }
+    *size = file->size;
+    return image + file->offset;
+}
+
+#endif // CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
@@ -0,0 +1,50 @@
+/* Web bundle served straight from a memory-mapped flash partition
+
+   Used with CONFIG_EXAMPLE_WEB_DEPLOY_MMAP. The bundle is packed at build time
+   by tools/pack_www.py into a flat image in the "www" partition, and the path
+   index is compiled into the firmware, so serving a file needs no VFS, no file
+   descriptor and no copy: the response is sent directly from mapped flash.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "assets.h"
+
+typedef struct {
+    asset_t asset;          /*!< metadata shared with the VFS deploy modes */
+    uint32_t offset;        /*!< offset of the file in the image */
+    uint32_t size;          /*!< size of the file */
+    uint32_t gz_offset;     /*!< offset of the gzip variant, if asset.gzip */
+    uint32_t gz_size;       /*!< size of the gzip variant, if asset.gzip */
+} www_file_t;
+
+/**
+ * @brief Maps the image and checks it matches the compiled-in index
+ *
+ * @param label partition label
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_NOT_FOUND if the partition does not exist
+ *  - ESP_ERR_INVALID_VERSION if the image was built for another firmware
+ */
+esp_err_t www_image_mount(const char *label);
+
+/**
+ * @brief Looks up a file by URI path
+ *
+ * @param path URI path without query string
+ * @param len length of path
+ * @return file, or NULL if not in the image
+ */
+const www_file_t *www_image_find(const char *path, size_t len);
+
+/**
+ * @brief Gets a pointer to the contents of a file in mapped flash
+ *
+ * @param file file returned by www_image_find()
+ * @param gzip whether to return the gzip variant
+ * @param[out] size size of the contents
+ * @return contents, valid while the image stays mounted
+ */
+const uint8_t *www_image_data(const www_file_t *file, bool gzip, size_t *size);
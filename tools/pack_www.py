@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Packs the web bundle into a flat image for the memory-mapped deploy mode.
+
+Reads dist/asset-manifest.txt (written by front/controls-ui/scripts/compress-dist.js)
+and the files it lists, and writes:
+
+  * a raw image flashed to the "www" partition: a 16-byte header followed by
+    every file, and its .gz sibling if any, each aligned to 4 bytes;
+  * a C header with the sorted path index, compiled into the firmware so a
+    lookup needs nothing but a binary search (see main/www_image.c).
+
+Header layout (little endian): magic "MK3W", u32 version, u32 image id, u32 size.
+The image id is derived from the contents and is checked against the index at
+start-up, so a stale partition is never served with a newer firmware.
+"""
+import argparse
+import hashlib
+import os
+import struct
+import sys
+
+MAGIC = b'MK3W'
+VERSION = 1
+HEADER_SIZE = 16
+ALIGN = 4
+MANIFEST = 'asset-manifest.txt'
+
+# Keep in sync with CONTENT_TYPES in main/assets.c
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.js': 'application/javascript',
+    '.css': 'text/css',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+    '.svg': 'image/svg+xml',
+    '.json': 'application/json',
+}
+
+
+def content_type(path):
+    return CONTENT_TYPES.get(os.path.splitext(path)[1].lower(), 'text/plain')
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def read_manifest(dist):
+    path = os.path.join(dist, MANIFEST)
+    if not os.path.exists(path):
+        sys.exit("{} doesn't exist, run 'yarn build' in front/controls-ui".format(path))
+    entries = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 3:
+                etag, flags, uri = fields
+                entries.append((uri, etag, '' if flags == '-' else flags))
+    return sorted(entries)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('dist', help='web bundle directory')
+    parser.add_argument('image', help='output partition image')
+    parser.add_argument('index', help='output C header')
+    parser.add_argument('--partition-size', type=lambda x: int(x, 0), default=0,
+                        help='fail if the image does not fit')
+    args = parser.parse_args()
+
+    blob = bytearray()
+    files = []
+    for uri, etag, flags in read_manifest(args.dist):
+        local = os.path.join(args.dist, *uri.lstrip('/').split('/'))
+        sections = []
+        for suffix in ('', '.gz') if 'g' in flags else ('',):
+            with open(local + suffix, 'rb') as f:
+                data = f.read()
+            blob += b'\0' * (-len(blob) % ALIGN)
+            sections.append((HEADER_SIZE + len(blob), len(data)))
+            blob += data
+        if len(sections) == 1:
+            sections.append((0, 0))
+        files.append((uri, etag, flags, sections))
+
+    image_id = struct.unpack('<I', hashlib.sha256(blob).digest()[:4])[0]
+    size = HEADER_SIZE + len(blob)
+    if args.partition_size and size > args.partition_size:
+        sys.exit('web image is {} bytes, the www partition only holds {}'.format(size, args.partition_size))
+
+    with open(args.image, 'wb') as f:
+        f.write(struct.pack('<4sIII', MAGIC, VERSION, image_id, size))
+        f.write(blob)
+
+    lines = [
+        '/* Generated by tools/pack_www.py, do not edit */',
+        '#pragma once',
+        '',
+        '#define WWW_IMAGE_VERSION {}'.format(VERSION),
+        '#define WWW_IMAGE_ID 0x{:08x}u'.format(image_id),
+        '#define WWW_IMAGE_SIZE {}u'.format(size),
+        '',
+        'static const www_file_t WWW_FILES[] = {',
+    ]
+    for uri, etag, flags, ((offset, length), (gz_offset, gz_length)) in files:
+        lines.append('    {{ {{ {}, {}, {}, {}, {}, {} }}, {}, {}, {}, {} }},'.format(
+            c_string(uri), c_string('"' + etag + '"'), c_string('"' + etag + '-gz"'), c_string(content_type(uri)),
+            'true' if 'g' in flags else 'false', 'true' if 'i' in flags else 'false',
+            offset, length, gz_offset, gz_length))
+    lines += ['};', '']
+    with open(args.index, 'w') as f:
+        f.write('\n'.join(lines))
+
+    print('www image: {} files, {} bytes'.format(len(files), size))
+
+
+if __name__ == '__main__':
+    main()